@@ -0,0 +1,80 @@
+
+#include "BufferPool.hpp"
+
+// Index of the smallest size class that fits the size.
+static int get_size_class(size_t size) {
+    int size_class = 0;
+
+    while ((MIN_BUFFER_SIZE << size_class) < size) {
+        size_class++;
+    }
+
+    return size_class;
+}
+
+BufferPool::~BufferPool() {
+    for (std::vector<uint8_t *> &idle : m_idle) {
+        for (uint8_t *data : idle) {
+            delete[] data;
+        }
+    }
+}
+
+Buffer BufferPool::acquire(size_t size, bool deferrable) {
+    int size_class = get_size_class(size);
+    Buffer buffer;
+    buffer.m_capacity = MIN_BUFFER_SIZE << size_class;
+
+    if (deferrable && m_in_use > 0 && m_in_use + buffer.m_capacity > m_budget) {
+        buffer.m_capacity = 0;
+        return buffer;
+    }
+
+    if (size_class < m_idle.size() && !m_idle[size_class].empty()) {
+        buffer.m_data = m_idle[size_class].back();
+        m_idle[size_class].pop_back();
+        m_idle_size -= buffer.m_capacity;
+    } else {
+        buffer.m_data = new uint8_t[buffer.m_capacity];
+    }
+    m_in_use += buffer.m_capacity;
+    trim();
+
+    return buffer;
+}
+
+void BufferPool::release(Buffer &buffer) {
+    if (buffer.m_data == nullptr) {
+        return;
+    }
+
+    int size_class = get_size_class(buffer.m_capacity);
+    if (size_class >= m_idle.size()) {
+        m_idle.resize(size_class + 1);
+    }
+    m_in_use -= buffer.m_capacity;
+
+    if (m_idle[size_class].size() < MAX_IDLE_BUFFERS) {
+        m_idle[size_class].push_back(buffer.m_data);
+        m_idle_size += buffer.m_capacity;
+        trim();
+    } else {
+        delete[] buffer.m_data;
+    }
+
+    buffer = Buffer();
+}
+
+void BufferPool::trim() {
+    // Largest first, they're the least likely to be reused.
+    for (int size_class = m_idle.size() - 1;
+            size_class >= 0 && m_in_use + m_idle_size > m_budget; size_class--) {
+
+        std::vector<uint8_t *> &idle = m_idle[size_class];
+        while (!idle.empty() && m_in_use + m_idle_size > m_budget) {
+            delete[] idle.back();
+            idle.pop_back();
+            m_idle_size -= MIN_BUFFER_SIZE << size_class;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Buffers come in power-of-two sizes starting with this one.
+static const size_t MIN_BUFFER_SIZE = 4096;
+
+// Number of idle buffers of each size kept for reuse.
+static const int MAX_IDLE_BUFFERS = 4;
+
+// A block of memory from a BufferPool.
+struct Buffer {
+    uint8_t *m_data;
+    size_t m_capacity;
+
+    Buffer()
+        : m_data(nullptr), m_capacity(0) {
+
+        // Nothing.
+    }
+};
+
+// Message buffers shared by all connections, in size classes so that they
+// can be reused, and within a memory budget.
+class BufferPool {
+    // Budget in bytes.
+    size_t m_budget;
+
+    // Bytes of buffers handed out and not released.
+    size_t m_in_use;
+
+    // Bytes of idle buffers.
+    size_t m_idle_size;
+
+    // Idle buffers, by size class.
+    std::vector<std::vector<uint8_t *>> m_idle;
+
+public:
+    BufferPool(size_t budget)
+        : m_budget(budget), m_in_use(0), m_idle_size(0) {
+
+        // Nothing.
+    }
+
+    virtual ~BufferPool();
+
+    // Get a buffer of at least the size. If deferrable, fails (returning a
+    // buffer with null data) if that would go over budget, unless no buffers
+    // are in use at all. The caller should try again later.
+    Buffer acquire(size_t size, bool deferrable);
+
+    // Give back a buffer from acquire(). Does nothing for null data.
+    void release(Buffer &buffer);
+
+    // Whether buffers in use have reached the budget, so that new transfers
+    // should wait. Never if no buffers are in use.
+    bool is_exhausted() const {
+        return m_in_use > 0 && m_in_use >= m_budget;
+    }
+
+private:
+    // Free idle buffers until everything fits in the budget.
+    void trim();
+};
+
+#endif // BUFFER_POOL_HPP
@@ -0,0 +1,102 @@
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+
+#include "Calibration.hpp"
+
+static std::string make_key(const std::string &hostname, const std::string &benchmark) {
+    return hostname + "\t" + benchmark;
+}
+
+// Read the cache file into the map. It's fine if it doesn't exist.
+static void read_cache(const std::string &pathname, std::map<std::string, double> &seconds_map) {
+    std::ifstream f(pathname);
+    std::string line;
+
+    // Each line is "seconds<TAB>hostname<TAB>benchmark".
+    while (std::getline(f, line)) {
+        std::string::size_type tab = line.find('\t');
+        if (tab != std::string::npos) {
+            double seconds = strtod(line.c_str(), nullptr);
+            if (seconds > 0) {
+                seconds_map[line.substr(tab + 1)] = seconds;
+            }
+        }
+    }
+}
+
+void Calibration::load() {
+    if (m_pathname.empty()) {
+        return;
+    }
+
+    read_cache(m_pathname, m_seconds);
+}
+
+double Calibration::get_seconds(const std::string &hostname, const std::string &benchmark) const {
+    std::map<std::string, double>::const_iterator itr = m_seconds.find(make_key(hostname, benchmark));
+
+    return itr == m_seconds.end() ? 0 : itr->second;
+}
+
+void Calibration::set_seconds(const std::string &hostname, const std::string &benchmark,
+        double seconds) {
+
+    std::string key = make_key(hostname, benchmark);
+    m_seconds[key] = seconds;
+    m_measured.insert(key);
+    save();
+}
+
+double Calibration::get_speed_factor(const std::string &benchmark, double seconds) const {
+    double fastest = seconds;
+    std::string suffix = "\t" + benchmark;
+
+    for (const std::pair<const std::string, double> &entry : m_seconds) {
+        const std::string &key = entry.first;
+        if (key.size() > suffix.size() &&
+                key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0 &&
+                entry.second < fastest) {
+
+            fastest = entry.second;
+        }
+    }
+
+    return fastest/seconds;
+}
+
+void Calibration::save() {
+    if (m_pathname.empty()) {
+        return;
+    }
+
+    // Other controllers may have cached hosts since we loaded.
+    std::map<std::string, double> cached;
+    read_cache(m_pathname, cached);
+    for (const std::pair<const std::string, double> &entry : cached) {
+        if (m_measured.find(entry.first) == m_measured.end()) {
+            m_seconds[entry.first] = entry.second;
+        }
+    }
+
+    // Write beside the file and rename, so that readers never see half of it.
+    std::string tmp_pathname = m_pathname + "." + std::to_string(getpid());
+    std::ofstream f(tmp_pathname);
+    if (!f) {
+        std::cerr << "Warning: Can't write calibration cache " << m_pathname << "\n";
+        return;
+    }
+
+    for (const std::pair<const std::string, double> &entry : m_seconds) {
+        f << entry.second << "\t" << entry.first << "\n";
+    }
+    f.close();
+
+    if (!f || rename(tmp_pathname.c_str(), m_pathname.c_str()) == -1) {
+        std::cerr << "Warning: Can't write calibration cache " << m_pathname << "\n";
+        unlink(tmp_pathname.c_str());
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CALIBRATION_HPP
+#define CALIBRATION_HPP
+
+#include <string>
+#include <map>
+#include <set>
+
+// Benchmark name for the worker's built-in CPU benchmark.
+static const char BUILTIN_BENCHMARK[] = "builtin";
+
+// Measured benchmark times for each host, cached on disk so that hosts
+// don't have to be re-calibrated for every job.
+class Calibration {
+    // Pathname of the cache file, or empty to not cache.
+    std::string m_pathname;
+
+    // Seconds for each "hostname<TAB>benchmark" key.
+    std::map<std::string, double> m_seconds;
+
+    // Keys we measured ourselves, which win over what other controllers
+    // wrote to the cache file.
+    std::set<std::string> m_measured;
+
+public:
+    Calibration(const std::string &pathname)
+        : m_pathname(pathname) {
+
+        // Nothing.
+    }
+
+    // Load the cache file. It's fine if it doesn't exist.
+    void load();
+
+    // Seconds the host took to run the benchmark, or 0 if unknown.
+    double get_seconds(const std::string &hostname, const std::string &benchmark) const;
+
+    // Record the time the host took to run the benchmark and update the cache file.
+    void set_seconds(const std::string &hostname, const std::string &benchmark, double seconds);
+
+    // Speed of a host relative to the fastest known host for the benchmark
+    // (which gets 1.0), given the host's benchmark time.
+    double get_speed_factor(const std::string &benchmark, double seconds) const;
+
+private:
+    // Merge our measurements into the cache file, keeping entries that
+    // other controllers wrote since we loaded it, and replace the file all
+    // at once.
+    void save();
+};
+
+#endif // CALIBRATION_HPP
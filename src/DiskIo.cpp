@@ -0,0 +1,222 @@
+
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "DiskIo.hpp"
+#include "util.hpp"
+
+DiskIo::DiskIo()
+    : m_stopping(false), m_next_id(0) {
+
+    if (pipe2(m_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("pipe2");
+        exit(-1);
+    }
+
+    for (int i = 0; i < DISK_IO_THREAD_COUNT; i++) {
+        m_threads.push_back(std::thread(&DiskIo::run, this));
+    }
+}
+
+DiskIo::~DiskIo() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    for (std::thread &thread : m_threads) {
+        thread.join();
+    }
+
+    close(m_pipe[0]);
+    close(m_pipe[1]);
+}
+
+void DiskIo::collect() {
+    char buffer[256];
+    while (::read(m_pipe[0], buffer, sizeof(buffer)) > 0) {
+        // Nothing.
+    }
+
+    std::deque<Job> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        finished.swap(m_finished);
+    }
+
+    for (Job &job : finished) {
+        if (job.m_write) {
+            if (m_writes_abandoned.erase(job.m_id) == 0) {
+                m_writes_done[job.m_id] = job.m_success;
+            }
+
+            // Start the next write to the same file.
+            std::map<std::string, std::deque<Job>>::iterator itr =
+                m_writes_waiting.find(job.m_pathname);
+            if (itr->second.empty()) {
+                m_writes_waiting.erase(itr);
+            } else {
+                queue(std::move(itr->second.front()));
+                itr->second.pop_front();
+            }
+        } else {
+            std::map<std::string, Read>::iterator itr = m_reads.find(job.m_pathname);
+            Read &read = itr->second;
+            read.m_done = true;
+            read.m_success = job.m_success;
+            read.m_content = std::move(job.m_content);
+
+            // Everyone stopped waiting.
+            if (read.m_waiters == 0 && std::find(m_read_ahead.begin(), m_read_ahead.end(),
+                        job.m_pathname) == m_read_ahead.end()) {
+
+                m_reads.erase(itr);
+            }
+        }
+    }
+}
+
+void DiskIo::read(const std::string &pathname) {
+    std::map<std::string, Read>::iterator itr = m_reads.find(pathname);
+    if (itr == m_reads.end()) {
+        m_reads[pathname] = Read { false, false, "", 1 };
+        queue(Job { 0, false, pathname, "", false });
+        return;
+    }
+
+    // Someone's waiting for it now. It's only read ahead if no one waited
+    // for it before, not if everyone stopped waiting for it.
+    if (itr->second.m_waiters++ == 0) {
+        std::deque<std::string>::iterator ahead = std::find(m_read_ahead.begin(),
+                m_read_ahead.end(), pathname);
+        if (ahead != m_read_ahead.end()) {
+            m_read_ahead.erase(ahead);
+        }
+    }
+}
+
+void DiskIo::read_ahead(const std::string &pathname) {
+    if (m_reads.find(pathname) != m_reads.end()) {
+        return;
+    }
+
+    // Forget the oldest file read ahead, if it's done.
+    if (m_read_ahead.size() >= MAX_READ_AHEAD_COUNT) {
+        std::map<std::string, Read>::iterator itr = m_reads.find(m_read_ahead.front());
+        if (!itr->second.m_done) {
+            return;
+        }
+        m_reads.erase(itr);
+        m_read_ahead.pop_front();
+    }
+
+    m_reads[pathname] = Read { false, false, "", 0 };
+    m_read_ahead.push_back(pathname);
+    queue(Job { 0, false, pathname, "", false });
+}
+
+bool DiskIo::take_read(const std::string &pathname, bool &success, std::string &content) {
+    std::map<std::string, Read>::iterator itr = m_reads.find(pathname);
+    if (itr == m_reads.end() || !itr->second.m_done) {
+        return false;
+    }
+
+    Read &read = itr->second;
+    success = read.m_success;
+    read.m_waiters--;
+    if (read.m_waiters == 0) {
+        content = std::move(read.m_content);
+        m_reads.erase(itr);
+    } else {
+        content = read.m_content;
+    }
+
+    return true;
+}
+
+void DiskIo::cancel_read(const std::string &pathname) {
+    std::map<std::string, Read>::iterator itr = m_reads.find(pathname);
+    if (itr != m_reads.end() && --itr->second.m_waiters == 0 && itr->second.m_done) {
+        m_reads.erase(itr);
+    }
+}
+
+int DiskIo::write(const std::string &pathname, std::string content) {
+    Job job { m_next_id++, true, pathname, std::move(content), false };
+
+    std::map<std::string, std::deque<Job>>::iterator itr = m_writes_waiting.find(pathname);
+    if (itr == m_writes_waiting.end()) {
+        m_writes_waiting[pathname];
+        queue(std::move(job));
+    } else {
+        itr->second.push_back(std::move(job));
+    }
+
+    return m_next_id - 1;
+}
+
+bool DiskIo::take_write(int id, bool &success) {
+    std::map<int, bool>::iterator itr = m_writes_done.find(id);
+    if (itr == m_writes_done.end()) {
+        return false;
+    }
+
+    success = itr->second;
+    m_writes_done.erase(itr);
+
+    return true;
+}
+
+void DiskIo::cancel_write(int id) {
+    if (m_writes_done.erase(id) == 0) {
+        m_writes_abandoned.insert(id);
+    }
+}
+
+void DiskIo::queue(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+}
+
+void DiskIo::run() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        if (job.m_write) {
+            job.m_success = write_file(job.m_pathname, job.m_content);
+            job.m_content.clear();
+        } else {
+            try {
+                job.m_content = read_file(job.m_pathname);
+                job.m_success = true;
+            } catch (std::runtime_error &e) {
+                job.m_success = false;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.push_back(std::move(job));
+        }
+
+        // Wake up the poll loop. If the pipe is full, it's already awake.
+        char c = 0;
+        if (::write(m_pipe[1], &c, 1) == -1) {
+            // Nothing.
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef DISK_IO_HPP
+#define DISK_IO_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Number of threads reading and writing files for the controller.
+static const int DISK_IO_THREAD_COUNT = 4;
+
+// Number of files read ahead that no one has asked for yet.
+static const int MAX_READ_AHEAD_COUNT = 8;
+
+// Reads and writes files on a pool of threads, so that a slow disk doesn't
+// stall the poll loop. Everything but the threads themselves runs on the
+// loop's thread: start a read or write, poll get_fd() for completions, call
+// collect(), then take the results.
+class DiskIo {
+    // A read or write, done on a thread.
+    struct Job {
+        int m_id;
+        bool m_write;
+        std::string m_pathname;
+        std::string m_content;
+        bool m_success;
+    };
+
+    // A file being read or that has been read.
+    struct Read {
+        bool m_done;
+        bool m_success;
+        std::string m_content;
+
+        // Number of read() calls not yet matched by take_read() or cancel_read().
+        int m_waiters;
+    };
+
+    // Shared with the threads.
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job> m_queue;
+    std::deque<Job> m_finished;
+    bool m_stopping;
+
+    // Threads write a byte to the end of this pipe for each finished job.
+    int m_pipe[2];
+
+    // Identifier of the next write.
+    int m_next_id;
+
+    // Reads, by pathname.
+    std::map<std::string, Read> m_reads;
+
+    // Pathnames read ahead that no one waits for, oldest first.
+    std::deque<std::string> m_read_ahead;
+
+    // Finished writes not yet taken, by identifier, and whether they succeeded.
+    std::map<int, bool> m_writes_done;
+
+    // Writes whose results no one will take.
+    std::set<int> m_writes_abandoned;
+
+    // Writes waiting for an earlier write to the same file, by pathname. A
+    // pathname is in the map while a write to it is in progress.
+    std::map<std::string, std::deque<Job>> m_writes_waiting;
+
+public:
+    DiskIo();
+    virtual ~DiskIo();
+
+    // File descriptor that's readable when jobs have finished.
+    int get_fd() const {
+        return m_pipe[0];
+    }
+
+    // Collect finished jobs. Call when get_fd() is readable.
+    void collect();
+
+    // Start reading the file, unless it's already being read or was read
+    // ahead. Each call must be followed by take_read() or cancel_read().
+    void read(const std::string &pathname);
+
+    // Start reading a file that will probably be read soon.
+    void read_ahead(const std::string &pathname);
+
+    // If the file started by read() has been read, returns true and fills
+    // whether that was successful and the content.
+    bool take_read(const std::string &pathname, bool &success, std::string &content);
+
+    // No longer wait for a file started by read().
+    void cancel_read(const std::string &pathname);
+
+    // Start writing the file. Writes to the same file are done in order.
+    // Returns an identifier for take_write() or cancel_write().
+    int write(const std::string &pathname, std::string content);
+
+    // If the write has finished, returns true and fills whether it was successful.
+    bool take_write(int id, bool &success);
+
+    // No longer wait for the write.
+    void cancel_write(int id);
+
+private:
+    // Add a job for the threads.
+    void queue(Job job);
+
+    // Main function of each thread.
+    void run();
+};
+
+#endif // DISK_IO_HPP
@@ -0,0 +1,32 @@
+
+#include "FairShare.hpp"
+
+int choose_share(const std::vector<Share> &shares) {
+    int best = -1;
+
+    for (int i = 0; i < shares.size(); i++) {
+        const Share &share = shares[i];
+        if (!share.m_wants_worker ||
+                (share.m_max_running != -1 && share.m_running >= share.m_max_running)) {
+
+            continue;
+        }
+        if (best == -1) {
+            best = i;
+            continue;
+        }
+
+        const Share &other = shares[best];
+        bool below_min = share.m_running < share.m_min_running;
+        bool other_below_min = other.m_running < other.m_min_running;
+        if (share.m_priority > other.m_priority ||
+                (share.m_priority == other.m_priority && below_min && !other_below_min) ||
+                (share.m_priority == other.m_priority && below_min == other_below_min &&
+                 share.m_running*other.m_weight < other.m_running*share.m_weight)) {
+
+            best = i;
+        }
+    }
+
+    return best;
+}
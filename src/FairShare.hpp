@@ -0,0 +1,34 @@
+#ifndef FAIR_SHARE_HPP
+#define FAIR_SHARE_HPP
+
+#include <vector>
+
+// A claim on the workers, for choosing who gets the next one: a job of the
+// controller, or a controller name at the proxy.
+struct Share {
+    // Jobs with a higher priority get workers first.
+    int m_priority;
+
+    // Jobs of the same priority get workers in proportion to their weights.
+    double m_weight;
+
+    // Number of workers running the job's tasks now.
+    int m_running;
+
+    // Shares running fewer than their minimum get workers before others of
+    // the same priority, and shares never run more than their maximum (-1
+    // for no maximum).
+    int m_min_running;
+    int m_max_running;
+
+    // Whether the job has a task ready to run.
+    bool m_wants_worker;
+};
+
+// Index of the share that should get the next idle worker, or -1 if none
+// wants one: among the wanting shares of the highest priority, one below its
+// minimum, then the one running the fewest tasks for its weight. Ties go to
+// the earliest share.
+int choose_share(const std::vector<Share> &shares);
+
+#endif // FAIR_SHARE_HPP
@@ -0,0 +1,23 @@
+
+#include <algorithm>
+
+#include "FrameTimes.hpp"
+
+void FrameTimes::add(double seconds) {
+    if (m_seconds.size() < FRAME_TIME_WINDOW) {
+        m_seconds.push_back(seconds);
+    } else {
+        m_seconds[m_next] = seconds;
+        m_next = (m_next + 1) % FRAME_TIME_WINDOW;
+    }
+
+    if (m_factor == 0 || m_seconds.size() < MIN_FRAME_TIME_COUNT) {
+        return;
+    }
+
+    std::vector<double> sorted = m_seconds;
+    std::vector<double>::iterator percentile = sorted.begin() +
+        (int) (FRAME_TIME_PERCENTILE*(sorted.size() - 1));
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    m_timeout = std::max(MIN_FRAME_TIMEOUT_S, m_factor*(*percentile));
+}
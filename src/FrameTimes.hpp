@@ -0,0 +1,48 @@
+#ifndef FRAME_TIMES_HPP
+#define FRAME_TIMES_HPP
+
+#include <vector>
+
+// Number of recent frame times that the timeout is based on.
+static const int FRAME_TIME_WINDOW = 1000;
+
+// Number of frames that must finish before any frame times out.
+static const int MIN_FRAME_TIME_COUNT = 5;
+
+// Fraction of recent frames that finished in the time that's multiplied
+// to get the timeout.
+static const double FRAME_TIME_PERCENTILE = 0.95;
+
+// Frames never time out sooner than this.
+static const double MIN_FRAME_TIMEOUT_S = 60;
+
+// Recent times of finished frames, to guess when a running frame is stuck.
+class FrameTimes {
+    // Timeout as a multiple of the percentile time, or 0 for none.
+    double m_factor;
+
+    // Most recent times, in seconds. Once full, m_next is the oldest.
+    std::vector<double> m_seconds;
+    int m_next;
+
+    // Current timeout, or 0 for none.
+    double m_timeout;
+
+public:
+    FrameTimes(double factor)
+        : m_factor(factor), m_next(0), m_timeout(0) {
+
+        // Nothing.
+    }
+
+    // Record how long a frame took.
+    void add(double seconds);
+
+    // Seconds after which a running frame is probably stuck, or 0 if we
+    // don't know yet or frames never time out.
+    double get_timeout() const {
+        return m_timeout;
+    }
+};
+
+#endif // FRAME_TIMES_HPP
@@ -1,7 +1,10 @@
 
 #include <stdlib.h>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <iterator>
 
 #include "Frames.hpp"
 
@@ -21,48 +24,460 @@ static int parse_int(const char *&s) {
     return value;
 }
 
-bool Frames::parse(const std::string &spec) {
+// Whether the string is one to three comma-separated integers, the legacy
+// "first[,last[,step]]" format.
+static bool is_legacy_spec(const std::string &spec) {
+    int count = 0;
     const char *s = spec.c_str();
 
-    try {
-        m_first = parse_int(s);
+    while (true) {
+        if (*s == '-') {
+            s++;
+        }
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        while (*s >= '0' && *s <= '9') {
+            s++;
+        }
+        count++;
+        if (*s == '\0') {
+            return count <= 3;
+        }
+        if (*s != ',') {
+            return false;
+        }
+        s++;
+    }
+}
+
+// Parse the legacy "first[,last[,step]]" format.
+static FrameItem parse_legacy_spec(const char *s) {
+    int first = parse_int(s);
+    int last;
+    int step;
+
+    if (*s == ',') {
+        s += 1;
+        last = parse_int(s);
 
         if (*s == ',') {
             s += 1;
-            m_last = parse_int(s);
+            step = parse_int(s);
+        } else {
+            // Auto-compute step.
+            step = first <= last ? 1 : -1;
+        }
+    } else {
+        // One-frame range.
+        last = first;
+        step = 1;
+    }
 
-            if (*s == ',') {
-                s += 1;
-                m_step = parse_int(s);
-            } else {
-                // Auto-compute step.
-                m_step = m_first <= m_last ? 1 : -1;
+    return FrameItem(first, last, step);
+}
+
+// Parse a single non-legacy item, not including the @pathname form.
+static FrameItem parse_item(const char *&s) {
+    int first = parse_int(s);
+    int last = first;
+    int step = 1;
+
+    if (*s == '-') {
+        s += 1;
+        last = parse_int(s);
+
+        if (*s == ':') {
+            s += 1;
+            step = parse_int(s);
+        }
+
+        // Step is a magnitude, direction comes from the range.
+        if (last < first) {
+            step = -step;
+        }
+    }
+
+    return FrameItem(first, last, step);
+}
+
+// Read the next frame number from a file of one frame per line. Skips blank
+// lines and comments that start with #. Returns false at end of file.
+static bool read_frame(std::istream &f, int &frame) {
+    std::string line;
+
+    while (std::getline(f, line)) {
+        const char *s = line.c_str();
+        while (*s == ' ' || *s == '\t') {
+            s++;
+        }
+        if (*s == '\0' || *s == '#') {
+            continue;
+        }
+
+        char *e;
+        frame = strtol(s, &e, 10);
+        if (s == e) {
+            std::cerr << "Ignoring bad line in frame file: " << line << "\n";
+            continue;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool FrameRuns::contains(int frame) const {
+    // Last run that starts at or before the frame.
+    std::map<int, int>::const_iterator itr = m_runs.upper_bound(frame);
+    if (itr == m_runs.begin()) {
+        return false;
+    }
+    --itr;
+
+    return frame <= itr->second;
+}
+
+bool FrameRuns::insert(int frame) {
+    std::map<int, int>::iterator next = m_runs.upper_bound(frame);
+
+    // Extend the run before, joining it to the one after if they now touch.
+    if (next != m_runs.begin()) {
+        std::map<int, int>::iterator prev = std::prev(next);
+        if (frame <= prev->second) {
+            return false;
+        }
+        if (frame == prev->second + 1) {
+            prev->second = frame;
+            if (next != m_runs.end() && next->first == frame + 1) {
+                prev->second = next->second;
+                m_runs.erase(next);
             }
+            return true;
+        }
+    }
+
+    // Extend the run after backward.
+    if (next != m_runs.end() && next->first == frame + 1) {
+        int last = next->second;
+        next = m_runs.erase(next);
+        m_runs.emplace_hint(next, frame, last);
+        return true;
+    }
+
+    m_runs.emplace_hint(next, frame, frame);
+    return true;
+}
+
+bool FrameSet::parse(const std::string &spec, bool allow_legacy) {
+    m_items.clear();
+    m_file_frames.clear();
+    m_file_frames_loaded = false;
+
+    try {
+        if (allow_legacy && is_legacy_spec(spec)) {
+            m_items.push_back(parse_legacy_spec(spec.c_str()));
         } else {
-            // One-frame range.
-            m_last = m_first;
-            m_step = 1;
+            const char *s = spec.c_str();
+
+            while (true) {
+                if (*s == '@') {
+                    // File of frames, up to the next comma.
+                    const char *comma = strchr(s, ',');
+                    std::string pathname = comma == nullptr ?
+                        std::string(s + 1) : std::string(s + 1, comma - s - 1);
+                    if (pathname.empty()) {
+                        std::cerr << "Missing pathname in frame specification: " << spec << "\n";
+                        return false;
+                    }
+                    if (!std::ifstream(pathname)) {
+                        std::cerr << "Cannot open frame file " << pathname << "\n";
+                        return false;
+                    }
+                    m_items.push_back(FrameItem(pathname));
+                    s += pathname.size() + 1;
+                } else {
+                    m_items.push_back(parse_item(s));
+                }
+
+                if (*s != ',') {
+                    break;
+                }
+                s += 1;
+            }
+
+            // Must have eaten up entire string.
+            if (*s != '\0') {
+                std::cerr << "Cannot parse frame specification: " << spec << "\n";
+                return false;
+            }
         }
     } catch (std::invalid_argument e) {
         std::cerr << "Invalid number in frame specification: " << e.what() << "\n";
         return false;
     }
 
-    // Must have eaten up entire string.
-    if (*s != '\0') {
-        std::cerr << "Cannot parse frame specification: " << spec << "\n";
-        return false;
+    // Compute offsets of ranges.
+    m_offsets.clear();
+    int64_t offset = 0;
+    for (const FrameItem &item : m_items) {
+        if (item.m_pathname.empty() && item.m_step == 0) {
+            std::cerr << "Frame step cannot be zero: " << spec << "\n";
+            return false;
+        }
+        offset += item.get_count();
+        m_offsets.push_back(offset);
     }
 
     return true;
 }
 
+bool FrameSet::has_files() const {
+    for (const FrameItem &item : m_items) {
+        if (!item.m_pathname.empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int FrameSet::get_frame(int64_t index, int &item_index) const {
+    // Find the first range that ends after the index.
+    item_index = std::upper_bound(m_offsets.begin(), m_offsets.end(), index) - m_offsets.begin();
+    const FrameItem &item = m_items[item_index];
+    int64_t start = item_index == 0 ? 0 : m_offsets[item_index - 1];
+
+    return item.m_first + (index - start)*item.m_step;
+}
+
+bool FrameSet::contains(int frame) const {
+    return in_earlier_item(m_items.size(), frame);
+}
+
+bool FrameSet::in_earlier_item(int item_index, int frame) const {
+    for (int i = 0; i < item_index; i++) {
+        if (item_contains(i, frame)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FrameSet::item_contains(int item_index, int frame) const {
+    const FrameItem &item = m_items[item_index];
+
+    if (!item.m_pathname.empty()) {
+        load_files();
+        return m_file_frames[item_index].contains(frame);
+    }
+
+    if (item.get_count() == 0) {
+        return false;
+    }
+
+    int low = std::min(item.m_first, item.m_last);
+    int high = std::max(item.m_first, item.m_last);
+
+    return frame >= low && frame <= high && (frame - item.m_first) % item.m_step == 0;
+}
+
+void FrameSet::load_files() const {
+    if (m_file_frames_loaded) {
+        return;
+    }
+
+    m_file_frames.resize(m_items.size());
+    for (int i = 0; i < m_items.size(); i++) {
+        const FrameItem &item = m_items[i];
+        if (!item.m_pathname.empty()) {
+            std::ifstream f(item.m_pathname);
+            if (!f) {
+                std::cerr << "Cannot open frame file " << item.m_pathname << "\n";
+            }
+            int file_frame;
+            while (read_frame(f, file_frame)) {
+                m_file_frames[i].insert(file_frame);
+            }
+        }
+    }
+    m_file_frames_loaded = true;
+}
+
+int Frames::get_step() const {
+    for (const FrameItem &item : m_set.get_items()) {
+        if (item.m_pathname.empty()) {
+            return item.m_step;
+        }
+    }
+
+    return 1;
+}
+
 std::deque<int> Frames::get_all() const {
     std::deque<int> v;
 
-    for (int frame = m_first; !is_done(frame); frame += m_step) {
+    FrameSource source(*this);
+    int frame;
+    while (source.next(frame)) {
         v.push_back(frame);
     }
 
     return v;
 }
+
+FrameSource::FrameSource(const Frames &frames)
+    : m_frames(frames),
+        m_index_order(frames.m_order, frames.m_set.has_files() ? 0 : frames.m_set.get_count(),
+                frames.m_seed),
+        m_item_index(0), m_frame(0), m_item_started(false) {
+
+    // Nothing.
+}
+
+bool FrameSource::next(int &frame) {
+    const FrameSet &set = m_frames.m_set;
+    int item_index;
+
+    while (next_item_frame(frame, item_index)) {
+        if (!set.in_earlier_item(item_index, frame) &&
+                !m_frames.m_exclusions.contains(frame)) {
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FrameSource::next_item_frame(int &frame, int &item_index) {
+    const FrameSet &set = m_frames.m_set;
+
+    if (!set.has_files()) {
+        int64_t index;
+        if (!m_index_order.next(index)) {
+            return false;
+        }
+        frame = set.get_frame(index, item_index);
+        return true;
+    }
+
+    // Walk the items in order, reading files as we go.
+    const std::vector<FrameItem> &items = set.get_items();
+    while (m_item_index < items.size()) {
+        const FrameItem &item = items[m_item_index];
+        item_index = m_item_index;
+
+        if (item.m_pathname.empty()) {
+            if (!m_item_started) {
+                m_frame = item.m_first;
+                m_item_started = true;
+            }
+            if (!item.is_done(m_frame)) {
+                frame = m_frame;
+                m_frame += item.m_step;
+                return true;
+            }
+        } else {
+            if (!m_item_started) {
+                m_file.open(item.m_pathname);
+                if (!m_file) {
+                    std::cerr << "Cannot open frame file " << item.m_pathname << "\n";
+                }
+                m_file_seen.clear();
+                m_item_started = true;
+            }
+            while (read_frame(m_file, frame)) {
+                // Skip lines that repeat a frame of this file.
+                if (m_file_seen.insert(frame)) {
+                    return true;
+                }
+            }
+            m_file.close();
+        }
+
+        // Move on to next item.
+        m_item_index++;
+        m_item_started = false;
+    }
+
+    return false;
+}
+
+IndexOrder::IndexOrder(FrameOrder order, int64_t count, uint64_t seed)
+    : m_order(order), m_count(count), m_next(0), m_bits(0), m_seed(seed) {
+
+    // Smallest power of two that covers the count. Random order needs an
+    // even number of bits to split into two halves.
+    while ((1LL << m_bits) < m_count || (m_order == ORDER_RANDOM && m_bits % 2 != 0)) {
+        m_bits++;
+    }
+
+    m_space = m_order == ORDER_REFINE || m_order == ORDER_RANDOM ? 1LL << m_bits : m_count;
+}
+
+bool IndexOrder::next(int64_t &index) {
+    while (m_next < m_space) {
+        index = map(m_next++);
+        if (index < m_count) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int64_t IndexOrder::map(int64_t value) const {
+    switch (m_order) {
+        case ORDER_SEQUENTIAL:
+        default:
+            return value;
+
+        case ORDER_REVERSE:
+            return m_count - 1 - value;
+
+        case ORDER_REFINE: {
+            // Reverse the bits, giving 0, 1/2, 1/4, 3/4, 1/8, ... of the space.
+            int64_t index = 0;
+            for (int i = 0; i < m_bits; i++) {
+                index = (index << 1) | ((value >> i) & 1);
+            }
+            return index;
+        }
+
+        case ORDER_RANDOM: {
+            // Feistel network, which is a permutation of the space no matter
+            // what the round function is.
+            int half = m_bits/2;
+            uint64_t mask = (1ULL << half) - 1;
+            uint64_t left = value >> half;
+            uint64_t right = value & mask;
+            for (int round = 0; round < 4; round++) {
+                uint64_t hash = (right + m_seed + round)*0x9E3779B97F4A7C15ULL;
+                hash ^= hash >> 29;
+                uint64_t new_right = (left ^ hash) & mask;
+                left = right;
+                right = new_right;
+            }
+            return (left << half) | right;
+        }
+    }
+}
+
+bool parse_frame_order(const std::string &name, FrameOrder &order) {
+    if (name == "sequential") {
+        order = ORDER_SEQUENTIAL;
+    } else if (name == "reverse") {
+        order = ORDER_REVERSE;
+    } else if (name == "refine") {
+        order = ORDER_REFINE;
+    } else if (name == "random") {
+        order = ORDER_RANDOM;
+    } else {
+        return false;
+    }
+
+    return true;
+}
@@ -2,25 +2,236 @@
 #define FRAMES_HPP
 
 #include <deque>
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+// Order in which to hand out frames.
+enum FrameOrder {
+    // First to last.
+    ORDER_SEQUENTIAL,
+
+    // Last to first.
+    ORDER_REVERSE,
+
+    // Progressively refine the whole range: first, middle, quarters, eighths, etc.
+    ORDER_REFINE,
+
+    // Shuffled.
+    ORDER_RANDOM,
+};
+
+// Visits every index from 0 to count - 1 exactly once, in the specified
+// order. Doesn't allocate, so it works for huge counts.
+class IndexOrder {
+    FrameOrder m_order;
+    int64_t m_count;
+
+    // We count through a space at least as large as m_count, map each value
+    // to an index, and skip indices that are out of range.
+    int64_t m_space;
+    int64_t m_next;
+
+    // Number of bits in m_space, for ORDER_REFINE and ORDER_RANDOM.
+    int m_bits;
+
+    // Seed for ORDER_RANDOM.
+    uint64_t m_seed;
 
-// Frame sequence specification.
-class Frames {
 public:
+    IndexOrder(FrameOrder order, int64_t count, uint64_t seed);
+
+    // Get the next index. Returns false when all have been visited.
+    bool next(int64_t &index);
+
+private:
+    // Map a value in the space to an index, which might be out of range.
+    int64_t map(int64_t value) const;
+};
+
+// Parse an order name ("sequential", "reverse", "refine", or "random").
+// Returns whether successful.
+bool parse_frame_order(const std::string &name, FrameOrder &order);
+
+// One item of a frame specification: either a range of frames or a file
+// listing frame numbers.
+struct FrameItem {
+    // Range of frames, if m_pathname is empty.
     int m_first;
     int m_last;
     int m_step;
 
-    // Format is "first[,last[,step]]". Returns whether successful. If not,
-    // also prints error to standard error.
-    bool parse(const std::string &spec);
+    // File with one frame number per line, or empty for a range.
+    std::string m_pathname;
+
+    FrameItem(int first, int last, int step)
+        : m_first(first), m_last(last), m_step(step) {
+
+        // Nothing.
+    }
+
+    FrameItem(const std::string &pathname)
+        : m_first(0), m_last(0), m_step(1), m_pathname(pathname) {
+
+        // Nothing.
+    }
 
-    // Whether this frame is past the end (taking step into account).
+    // Whether this frame is past the end of the range (taking step into account).
     bool is_done(int frame) const {
         return m_step > 0 ? frame > m_last : frame < m_last;
     }
 
-    // Get all frames, in order from first to last.
+    // Number of frames in the range.
+    int64_t get_count() const {
+        return is_done(m_first) ? 0 : ((int64_t) m_last - m_first)/m_step + 1;
+    }
+};
+
+// Set of frames kept as runs of consecutive frames, so that the long lists
+// of frame files take little memory.
+class FrameRuns {
+    // Last frame of each run, by first frame. Runs never touch or overlap.
+    std::map<int, int> m_runs;
+
+public:
+    // Whether the frame is in the set.
+    bool contains(int frame) const;
+
+    // Add the frame. Returns whether it wasn't already in the set.
+    bool insert(int frame);
+
+    void clear() {
+        m_runs.clear();
+    }
+};
+
+// Set of frames, as a union of ranges and files. Doesn't list the frames
+// in memory, so it can describe huge sets.
+class FrameSet {
+    std::vector<FrameItem> m_items;
+
+    // Number of frames before each range item. Only valid if there are no files.
+    std::vector<int64_t> m_offsets;
+
+    // Frames of each file item (empty for ranges), loaded on demand.
+    mutable std::vector<FrameRuns> m_file_frames;
+    mutable bool m_file_frames_loaded;
+
+public:
+    FrameSet()
+        : m_file_frames_loaded(false) {
+
+        // Nothing.
+    }
+
+    // Format is a comma-separated list of items, each "frame", "first-last",
+    // "first-last:step", or "@pathname". If allow_legacy is true, one to three
+    // bare numbers are instead parsed as "first[,last[,step]]". Files must
+    // be readable. Returns whether successful. If not, also prints error to
+    // standard error.
+    bool parse(const std::string &spec, bool allow_legacy);
+
+    const std::vector<FrameItem> &get_items() const {
+        return m_items;
+    }
+
+    // Whether any item is a file.
+    bool has_files() const;
+
+    // Total number of frames, counting frames in overlapping items more
+    // than once. Only valid if there are no files.
+    int64_t get_count() const {
+        return m_offsets.empty() ? 0 : m_offsets.back();
+    }
+
+    // Get the frame at this index (0 to get_count() - 1), and the index of
+    // the item it comes from. Only valid if there are no files.
+    int get_frame(int64_t index, int &item_index) const;
+
+    // Whether the frame is in the set. Loads files the first time it's called.
+    bool contains(int frame) const;
+
+    // Whether the frame is in any item before this one, in which case it was
+    // already produced by that item. Loads files the first time it's called.
+    bool in_earlier_item(int item_index, int frame) const;
+
+private:
+    // Whether the frame is in this item.
+    bool item_contains(int item_index, int frame) const;
+
+    // Load the frames of all file items, if not already loaded.
+    void load_files() const;
+};
+
+// Frame sequence specification.
+class Frames {
+public:
+    // Frames to render.
+    FrameSet m_set;
+
+    // Frames to skip.
+    FrameSet m_exclusions;
+
+    FrameOrder m_order;
+
+    // Seed for ORDER_RANDOM.
+    uint64_t m_seed;
+
+    Frames()
+        : m_order(ORDER_SEQUENTIAL), m_seed(0) {
+
+        // Nothing.
+    }
+
+    // Parse the main frame specification (see FrameSet::parse()). Returns
+    // whether successful. If not, also prints error to standard error.
+    bool parse(const std::string &spec) {
+        return m_set.parse(spec, true);
+    }
+
+    // Step of the first range, for finding contiguous frames.
+    int get_step() const;
+
+    // Whether the frame is rendered: in the set and not excluded.
+    bool contains(int frame) const {
+        return m_set.contains(frame) && !m_exclusions.contains(frame);
+    }
+
+    // Get all frames, in the order specified by m_order. Only for tests, the
+    // controller uses a FrameSource.
     std::deque<int> get_all() const;
 };
 
+// Produces frames of a Frames specification one at a time, in order, without
+// listing them in memory.
+class FrameSource {
+    const Frames &m_frames;
+
+    // For specifications without files: order of indices into the set.
+    IndexOrder m_index_order;
+
+    // For specifications with files: current item and position within it.
+    int m_item_index;
+    int m_frame;
+    std::ifstream m_file;
+    bool m_item_started;
+
+    // Frames already read from the current file, to skip repeated lines.
+    FrameRuns m_file_seen;
+
+public:
+    FrameSource(const Frames &frames);
+
+    // Get the next frame. Frames in more than one item are only produced
+    // once. Returns false when there are no more.
+    bool next(int &frame);
+
+private:
+    // Get the next frame and the index of the item it comes from, ignoring
+    // exclusions and frames already produced by earlier items.
+    bool next_item_frame(int &frame, int &item_index);
+};
+
 #endif // FRAMES_HPP
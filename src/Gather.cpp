@@ -0,0 +1,61 @@
+
+#include <iostream>
+#include <sys/wait.h>
+
+#include "Gather.hpp"
+
+void Gather::task_done(const Task &task) {
+    if (m_parameters.m_gather_command.empty() || task.m_frame == -1) {
+        return;
+    }
+
+    // Seed passes arrive already merged.
+    int tile_count = m_parameters.get_tile_count();
+    if (!m_parameters.m_merge_command.empty()) {
+        tile_count /= m_parameters.get_seed_count();
+    }
+
+    int &tiles_done = m_tiles_done[task.m_frame];
+    tiles_done++;
+    if (tiles_done == tile_count) {
+        m_tiles_done.erase(task.m_frame);
+        start(task.m_frame);
+    }
+}
+
+void Gather::start(int frame) {
+    // Substitute the frame number. Other dimensions have no meaning here.
+    std::vector<std::string> words;
+    for (const std::string &word : m_parameters.m_gather_command) {
+        words.push_back(substitute_parameter(word, frame));
+    }
+
+    std::cout << "Gathering frame " << frame << "\n";
+
+    pid_t pid = start_local_command(words);
+    if (pid == -1) {
+        perror("fork");
+        m_failed = true;
+        return;
+    }
+
+    m_running[pid] = frame;
+}
+
+void Gather::reap() {
+    // Only our own commands, other jobs have theirs.
+    for (std::map<pid_t, int>::iterator itr = m_running.begin(); itr != m_running.end(); ) {
+        int status;
+        if (waitpid(itr->first, &status, WNOHANG) <= 0) {
+            ++itr;
+            continue;
+        }
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Error: Failed to gather frame " << itr->second << " (status " <<
+                (WIFEXITED(status) ? WEXITSTATUS(status) : -1) << ").\n";
+            m_failed = true;
+        }
+        itr = m_running.erase(itr);
+    }
+}
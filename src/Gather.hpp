@@ -0,0 +1,54 @@
+#ifndef GATHER_HPP
+#define GATHER_HPP
+
+#include <map>
+#include <sys/types.h>
+
+#include "Parameters.hpp"
+#include "Task.hpp"
+
+// Runs the user's gather command locally once all tiles of a frame have
+// arrived, such as to stitch tiles into the final image. Commands run in
+// the background so the controller keeps handing out work meanwhile.
+class Gather {
+    const Parameters &m_parameters;
+
+    // Number of tiles that have arrived for frames still missing some.
+    std::map<int, int> m_tiles_done;
+
+    // Frame of each running gather command, by process ID.
+    std::map<pid_t, int> m_running;
+
+    // Whether any gather command failed.
+    bool m_failed;
+
+public:
+    Gather(const Parameters &parameters)
+        : m_parameters(parameters), m_failed(false) {
+
+        // Nothing.
+    }
+
+    // Record a finished task, starting the gather command if it was the
+    // last tile of its frame.
+    void task_done(const Task &task);
+
+    // Collect gather commands that have exited, without blocking.
+    void reap();
+
+    // Whether any gather commands are still running.
+    bool is_busy() const {
+        return !m_running.empty();
+    }
+
+    // Whether any gather command failed.
+    bool has_failed() const {
+        return m_failed;
+    }
+
+private:
+    // Start the gather command for the frame.
+    void start(int frame);
+};
+
+#endif // GATHER_HPP
@@ -0,0 +1,354 @@
+
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+
+#include "Graph.hpp"
+
+bool Graph::is_pinned(const Task &task) const {
+    if (is_relay(task) || is_removal(task)) {
+        return true;
+    }
+
+    std::map<NodeKey, Node>::const_iterator itr =
+        m_nodes.find(NodeKey(task.m_stage, task.m_frame));
+    return task.m_stage > 0 && itr != m_nodes.end() && itr->second.m_worker_id != -1;
+}
+
+bool Graph::take_pinned_task(int worker_id, Task &task) {
+    std::map<int, std::deque<Task>>::iterator itr = m_pinned_tasks.find(worker_id);
+    if (itr == m_pinned_tasks.end() || itr->second.empty()) {
+        return false;
+    }
+
+    task = itr->second.front();
+    itr->second.pop_front();
+
+    return true;
+}
+
+void Graph::task_done(const Task &task, int worker_id, std::deque<Task> &tasks) {
+    std::map<std::string, Relay>::iterator relay_itr = m_relays.find(task.m_id);
+    if (relay_itr != m_relays.end()) {
+        Relay relay = relay_itr->second;
+        m_relays.erase(relay_itr);
+
+        // Ignore relays for nodes that have been reset since.
+        std::map<NodeKey, Node>::iterator itr = m_nodes.find(relay.m_node);
+        if (itr == m_nodes.end() || itr->second.m_generation != relay.m_generation ||
+                itr->second.m_state != NODE_RELAYING) {
+
+            unlink(relay.m_pathname.c_str());
+            return;
+        }
+
+        Node &node = itr->second;
+        node.m_relay_count--;
+        if (node.m_relay_count == 0) {
+            node.m_state = NODE_RUNNING;
+            queue(node, tasks);
+        }
+        return;
+    }
+
+    std::map<std::string, int>::iterator removal_itr = m_removals.find(task.m_id);
+    if (removal_itr != m_removals.end()) {
+        m_removals.erase(removal_itr);
+        return;
+    }
+
+    if (m_parameters.m_stages.empty() || task.m_frame == -1) {
+        return;
+    }
+
+    NodeKey key(task.m_stage, task.m_frame);
+    Node &node = m_nodes[key];
+    if (node.m_state == NODE_RELAYING || node.m_state == NODE_RUNNING) {
+        m_busy_count--;
+    }
+    node.m_state = NODE_DONE;
+    node.m_worker_id = worker_id;
+    for (const std::string &pathname : node.m_relay_pathnames) {
+        unlink(pathname.c_str());
+    }
+    node.m_relay_pathnames.clear();
+    node.m_relay_workers.clear();
+
+    // The first time it's done, count the stages that will use its kept files.
+    if (node.m_dependents_left == -1) {
+        node.m_dependents_left = 0;
+        for_each_dependent(key, [&node](const NodeKey &dependent) {
+            node.m_dependents_left++;
+        });
+    }
+
+    for_each_dependent(key, [this, &tasks](const NodeKey &dependent) {
+        start_if_ready(dependent, tasks);
+    });
+
+    // It's done with the kept files of the stages it depends on.
+    for_each_dependency(key, [this](const NodeKey &dependency) {
+        std::map<NodeKey, Node>::iterator itr = m_nodes.find(dependency);
+        if (itr != m_nodes.end() && --itr->second.m_dependents_left == 0) {
+            release(dependency);
+        }
+    });
+    if (node.m_dependents_left == 0) {
+        release(key);
+    }
+}
+
+void Graph::worker_died(int worker_id, std::deque<Task> &tasks) {
+    m_pinned_tasks.erase(worker_id);
+
+    // Its files are gone anyway.
+    for (std::map<std::string, int>::iterator itr = m_removals.begin();
+            itr != m_removals.end(); ) {
+
+        if (itr->second == worker_id) {
+            itr = m_removals.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+
+    std::vector<NodeKey> keys;
+    for (const std::pair<const NodeKey, Node> &entry : m_nodes) {
+        keys.push_back(entry.first);
+    }
+
+    // Stages running there, or waiting for files from there, start over.
+    for (const NodeKey &key : keys) {
+        Node &node = m_nodes[key];
+
+        if ((node.m_state == NODE_RUNNING && node.m_worker_id == worker_id) ||
+                (node.m_state == NODE_RELAYING && (node.m_worker_id == worker_id ||
+                    std::find(node.m_relay_workers.begin(), node.m_relay_workers.end(),
+                        worker_id) != node.m_relay_workers.end()))) {
+
+            reset(node);
+        }
+    }
+
+    // Stages whose kept files were there are redone if they're still needed.
+    for (const NodeKey &key : keys) {
+        Node &node = m_nodes[key];
+
+        if (node.m_state == NODE_DONE && node.m_worker_id == worker_id &&
+                !m_parameters.m_stages[key.first].m_kept.empty() &&
+                has_waiting_dependents(key)) {
+
+            redo(key, worker_id, tasks);
+        }
+    }
+
+    // Whatever has its inputs can start again, including stages that were
+    // forgotten and are redone for the ones above.
+    keys.clear();
+    for (const std::pair<const NodeKey, Node> &entry : m_nodes) {
+        keys.push_back(entry.first);
+    }
+    for (const NodeKey &key : keys) {
+        if (key.first > 0) {
+            start_if_ready(key, tasks);
+        }
+    }
+}
+
+template <typename F>
+void Graph::for_each_dependent(const NodeKey &key, F f) {
+    const std::vector<Stage> &stages = m_parameters.m_stages;
+
+    for (int stage = key.first + 1; stage < stages.size(); stage++) {
+        for (const Dependency &dependency : stages[stage].m_dependencies) {
+            if (dependency.m_stage == key.first) {
+                for (int frame = key.second - dependency.m_high;
+                        frame <= key.second - dependency.m_low; frame++) {
+
+                    if (m_parameters.m_frames.contains(frame)) {
+                        f(NodeKey(stage, frame));
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename F>
+void Graph::for_each_dependency(const NodeKey &key, F f) {
+    for (const Dependency &dependency : m_parameters.m_stages[key.first].m_dependencies) {
+        for (int frame = key.second + dependency.m_low;
+                frame <= key.second + dependency.m_high; frame++) {
+
+            if (m_parameters.m_frames.contains(frame)) {
+                f(NodeKey(dependency.m_stage, frame));
+            }
+        }
+    }
+}
+
+bool Graph::has_waiting_dependents(const NodeKey &key) {
+    bool waiting = false;
+
+    // Dependents of a done node were all made when it was done, so any that
+    // are gone were done and forgotten.
+    for_each_dependent(key, [this, &waiting](const NodeKey &dependent) {
+        std::map<NodeKey, Node>::const_iterator itr = m_nodes.find(dependent);
+        if (itr != m_nodes.end() && itr->second.m_state == NODE_WAITING) {
+            waiting = true;
+        }
+    });
+
+    return waiting;
+}
+
+void Graph::start_if_ready(const NodeKey &key, std::deque<Task> &tasks) {
+    const Stage &stage = m_parameters.m_stages[key.first];
+    Node &node = m_nodes[key];
+
+    if (node.m_state != NODE_WAITING) {
+        return;
+    }
+
+    // Find the kept files of the stages it depends on, and where they are.
+    std::vector<std::pair<int, std::string>> kept;
+    for (const Dependency &dependency : stage.m_dependencies) {
+        for (int frame = key.second + dependency.m_low;
+                frame <= key.second + dependency.m_high; frame++) {
+
+            if (!m_parameters.m_frames.contains(frame)) {
+                continue;
+            }
+
+            std::map<NodeKey, Node>::const_iterator itr =
+                m_nodes.find(NodeKey(dependency.m_stage, frame));
+            if (itr == m_nodes.end() || itr->second.m_state != NODE_DONE) {
+                // Not ready.
+                return;
+            }
+
+            for (const std::string &pathname : m_parameters.m_stages[dependency.m_stage].m_kept) {
+                kept.push_back(std::make_pair(itr->second.m_worker_id,
+                            substitute_parameter(pathname, frame)));
+            }
+        }
+    }
+
+    // Run on the worker with the most of them.
+    std::map<int, int> counts;
+    for (const std::pair<int, std::string> &file : kept) {
+        counts[file.first]++;
+    }
+    node.m_worker_id = -1;
+    int best_count = 0;
+    for (const std::pair<const int, int> &count : counts) {
+        if (count.second > best_count) {
+            node.m_worker_id = count.first;
+            best_count = count.second;
+        }
+    }
+
+    // Relay the rest through the controller.
+    node.m_task = make_stage_task(m_parameters, key.first, key.second);
+    node.m_relay_count = 0;
+    for (const std::pair<int, std::string> &file : kept) {
+        if (file.first != node.m_worker_id) {
+            int counter = m_relay_counter++;
+            std::string pathname = ".distray-relay-" + std::to_string(counter);
+
+            Task task;
+            task.m_id = node.m_task.m_id + ":relay" + std::to_string(counter);
+            task.m_frame = key.second;
+            task.m_stage = key.first;
+            task.m_copy_only = true;
+            task.m_out_copies.push_back(FileCopy(file.second, pathname));
+            m_pinned_tasks[file.first].push_back(task);
+            m_relays[task.m_id] = Relay { key, node.m_generation, pathname };
+
+            node.m_task.m_in_copies.push_back(FileCopy(pathname, file.second));
+            node.m_task.m_remove_pathnames.push_back(file.second);
+            node.m_relay_pathnames.push_back(pathname);
+            node.m_relay_workers.push_back(file.first);
+            node.m_relay_count++;
+        }
+    }
+
+    m_busy_count++;
+    if (node.m_relay_count > 0) {
+        node.m_state = NODE_RELAYING;
+    } else {
+        node.m_state = NODE_RUNNING;
+        queue(node, tasks);
+    }
+}
+
+void Graph::queue(Node &node, std::deque<Task> &tasks) {
+    if (node.m_worker_id == -1) {
+        tasks.push_front(node.m_task);
+    } else {
+        m_pinned_tasks[node.m_worker_id].push_back(node.m_task);
+    }
+}
+
+void Graph::reset(Node &node) {
+    m_busy_count--;
+    node.m_generation++;
+    for (const std::string &pathname : node.m_relay_pathnames) {
+        unlink(pathname.c_str());
+    }
+    node.m_relay_pathnames.clear();
+    node.m_relay_workers.clear();
+    node.m_relay_count = 0;
+    node.m_worker_id = -1;
+    node.m_state = NODE_WAITING;
+}
+
+void Graph::redo(const NodeKey &key, int dead_worker_id, std::deque<Task> &tasks) {
+    Node &node = m_nodes[key];
+    node.m_state = NODE_WAITING;
+    node.m_worker_id = -1;
+
+    if (key.first == 0) {
+        tasks.push_front(make_frame_task(m_parameters, key.second, 0));
+        return;
+    }
+
+    // It will use the kept files of the stages it depends on again.
+    for_each_dependency(key, [this, dead_worker_id, &tasks](const NodeKey &dependency) {
+        std::map<NodeKey, Node>::iterator itr = m_nodes.find(dependency);
+        if (itr == m_nodes.end()) {
+            m_nodes[dependency].m_dependents_left = 1;
+            redo(dependency, dead_worker_id, tasks);
+        } else {
+            Node &other = itr->second;
+            other.m_dependents_left++;
+            if (other.m_state == NODE_DONE && other.m_worker_id == dead_worker_id &&
+                    !m_parameters.m_stages[dependency.first].m_kept.empty()) {
+
+                redo(dependency, dead_worker_id, tasks);
+            }
+        }
+    });
+}
+
+void Graph::release(const NodeKey &key) {
+    std::map<NodeKey, Node>::iterator itr = m_nodes.find(key);
+    const Stage &stage = m_parameters.m_stages[key.first];
+    int worker_id = itr->second.m_worker_id;
+
+    if (!stage.m_kept.empty() && worker_id != -1) {
+        Task task;
+        task.m_id = stage.m_name + ":" + std::to_string(key.second) + ":remove" +
+            std::to_string(m_relay_counter++);
+        task.m_frame = key.second;
+        task.m_stage = key.first;
+        task.m_copy_only = true;
+        for (const std::string &pathname : stage.m_kept) {
+            task.m_remove_pathnames.push_back(substitute_parameter(pathname, key.second));
+        }
+        m_pinned_tasks[worker_id].push_back(task);
+        m_removals[task.m_id] = worker_id;
+    }
+
+    m_nodes.erase(itr);
+}
@@ -0,0 +1,165 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+
+#include <map>
+#include <deque>
+#include <utility>
+
+#include "Parameters.hpp"
+#include "Task.hpp"
+
+// Runs the later stages of each frame as the stages they depend on finish.
+// A stage's task goes to the worker that already has most of its inputs
+// (files kept by the stages it depends on). Kept files on other workers are
+// relayed through the controller. Once every stage that depends on a stage
+// is done, its kept files are deleted from its worker and it's forgotten.
+class Graph {
+    enum NodeState {
+        // Waiting for stages it depends on.
+        NODE_WAITING,
+
+        // Waiting for kept files to be copied from other workers.
+        NODE_RELAYING,
+
+        // Queued or running.
+        NODE_RUNNING,
+
+        // Finished.
+        NODE_DONE,
+    };
+
+    // A stage of a frame.
+    struct Node {
+        NodeState m_state;
+
+        // Worker it runs or ran on, or -1 if any worker.
+        int m_worker_id;
+
+        // Incremented when the node is reset, to ignore old relays.
+        int m_generation;
+
+        // Task to run once relays are done.
+        Task m_task;
+
+        // Relays still to be done.
+        int m_relay_count;
+
+        // Workers we're relaying files from.
+        std::vector<int> m_relay_workers;
+
+        // Local copies of relayed files, deleted when the node is done.
+        std::vector<std::string> m_relay_pathnames;
+
+        // Stages depending on it that haven't finished with its kept files,
+        // or -1 if it hasn't been done yet.
+        int m_dependents_left;
+
+        Node()
+            : m_state(NODE_WAITING), m_worker_id(-1), m_generation(0), m_relay_count(0),
+                m_dependents_left(-1) {
+
+            // Nothing.
+        }
+    };
+
+    // Stage and frame.
+    typedef std::pair<int, int> NodeKey;
+
+    // A copy of a kept file to the controller.
+    struct Relay {
+        NodeKey m_node;
+        int m_generation;
+        std::string m_pathname;
+    };
+
+    const Parameters &m_parameters;
+
+    // Nodes we know about, until the stages that depend on them are done.
+    // First-stage nodes only once they're done (or being run again).
+    std::map<NodeKey, Node> m_nodes;
+
+    // Relays in progress, by task ID.
+    std::map<std::string, Relay> m_relays;
+
+    // Removals of kept files in progress, by task ID, with their worker ID.
+    std::map<std::string, int> m_removals;
+
+    // Tasks waiting for their worker, by worker ID.
+    std::map<int, std::deque<Task>> m_pinned_tasks;
+
+    // Number of nodes relaying or running.
+    int m_busy_count;
+
+    // Counter for unique relay and removal IDs, and relay pathnames.
+    int m_relay_counter;
+
+public:
+    Graph(const Parameters &parameters)
+        : m_parameters(parameters), m_busy_count(0), m_relay_counter(0) {
+
+        // Nothing.
+    }
+
+    // Whether any later stages are relaying or running, or kept files are
+    // being deleted.
+    bool is_busy() const {
+        return m_busy_count > 0 || !m_removals.empty();
+    }
+
+    // Whether the task copies a kept file to the controller for another worker.
+    bool is_relay(const Task &task) const {
+        return m_relays.find(task.m_id) != m_relays.end();
+    }
+
+    // Whether the task deletes kept files that are no longer needed.
+    bool is_removal(const Task &task) const {
+        return m_removals.find(task.m_id) != m_removals.end();
+    }
+
+    // Whether the task must run on a particular worker, so shouldn't be
+    // requeued if that worker dies.
+    bool is_pinned(const Task &task) const;
+
+    // Get the next task that must run on this worker. Returns whether there
+    // was one.
+    bool take_pinned_task(int worker_id, Task &task);
+
+    // Record a finished task and start the stages that were waiting for it.
+    // Tasks for any worker are pushed onto the front of the queue.
+    void task_done(const Task &task, int worker_id, std::deque<Task> &tasks);
+
+    // Redo the stages whose kept files were on a dead worker and are still
+    // needed, and the stages that were running there.
+    void worker_died(int worker_id, std::deque<Task> &tasks);
+
+private:
+    // Call the function on each stage of a frame that depends on the node.
+    template <typename F>
+    void for_each_dependent(const NodeKey &key, F f);
+
+    // Call the function on each stage of a frame that the node depends on.
+    template <typename F>
+    void for_each_dependency(const NodeKey &key, F f);
+
+    // Whether any stages that depend on the node haven't started.
+    bool has_waiting_dependents(const NodeKey &key);
+
+    // Start the node if all the stages it depends on are done.
+    void start_if_ready(const NodeKey &key, std::deque<Task> &tasks);
+
+    // Queue the node's task for its worker.
+    void queue(Node &node, std::deque<Task> &tasks);
+
+    // Put a relaying or running node back to waiting.
+    void reset(Node &node);
+
+    // Put a done node back to waiting to run it again, along with the
+    // stages it depends on whose kept files are gone: deleted already, or
+    // on the dead worker.
+    void redo(const NodeKey &key, int dead_worker_id, std::deque<Task> &tasks);
+
+    // Delete the node's kept files from its worker and forget the node.
+    void release(const NodeKey &key);
+};
+
+#endif // GRAPH_HPP
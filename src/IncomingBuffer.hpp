@@ -4,6 +4,8 @@
 #include <sys/socket.h>
 #include <google/protobuf/message.h>
 
+#include "BufferPool.hpp"
+
 // Set a max for incoming file, to avoid bugs or attackers.
 static const int MAX_INCOMING_FILE_SIZE = 10*1024*1024;
 
@@ -12,8 +14,11 @@ class IncomingBuffer {
     // File descriptor we're receiving on.
     int m_fd;
 
-    // Buffer does not include size header.
-    uint8_t *m_buffer;
+    // Where our buffer's memory comes from.
+    BufferPool &m_pool;
+
+    // Buffer does not include size header. Held only while receiving a message.
+    Buffer m_buffer;
 
     // Size does not include size header.
     uint32_t m_size;
@@ -25,30 +30,33 @@ class IncomingBuffer {
     // bytes of size; otherwise bytes of buffer.
     uint32_t m_received;
 
-    // Buffer capacity.
-    uint32_t m_capacity;
+    // Whether we have the size but the pool had no room for the buffer.
+    bool m_deferred;
 
 public:
-    IncomingBuffer(int fd)
-        : m_fd(fd), m_buffer(nullptr), m_size(0), m_have_size(false), m_received(0), m_capacity(0) {
+    IncomingBuffer(int fd, BufferPool &pool)
+        : m_fd(fd), m_pool(pool), m_size(0), m_have_size(false), m_received(0),
+          m_deferred(false) {
 
         // Nothing.
     }
 
     virtual ~IncomingBuffer() {
-        delete[] m_buffer;
+        m_pool.release(m_buffer);
     }
 
     // Get the message. Assumes that need_receive() is false. Returns whether successful.
     bool get_message(google::protobuf::Message &message) {
-        return message.ParseFromArray(m_buffer, m_size);
+        return message.ParseFromArray(m_buffer.m_data, m_size);
     }
 
     // Get ready for the next message.
     void reset() {
+        m_pool.release(m_buffer);
         m_size = 0;
         m_have_size = false;
         m_received = 0;
+        m_deferred = false;
     }
 
     // Whether we want to receive more bytes for this message. If this returns
@@ -57,12 +65,31 @@ public:
         return !m_have_size || m_received < m_size;
     }
 
+    // Whether we're waiting for room in the pool before receiving the body.
+    // The other side waits in the socket buffers meanwhile.
+    bool is_deferred() const {
+        return m_deferred;
+    }
+
+    // Try again to get a buffer after being deferred. Returns whether we
+    // got one.
+    bool retry() {
+        if (m_deferred) {
+            m_buffer = m_pool.acquire(m_size, true);
+            m_deferred = m_buffer.m_data == nullptr;
+        }
+
+        return !m_deferred;
+    }
+
     // Receive as many bytes as we can. Returns whether successful. If not, sets errno.
     bool receive() {
-        if (m_have_size) {
+        if (m_deferred) {
+            // Nothing to receive into.
+        } else if (m_have_size) {
             int bytes_left = m_size - m_received;
 
-            int received_here = recv(m_fd, m_buffer + m_received, bytes_left, 0);
+            int received_here = recv(m_fd, m_buffer.m_data + m_received, bytes_left, 0);
             if (received_here == -1) {
                 return false;
             } else if (received_here == 0) {
@@ -80,6 +107,10 @@ public:
             int received_here = recv(m_fd, ((uint8_t *) &m_size) + m_received, bytes_left, 0);
             if (received_here == -1) {
                 return false;
+            } else if (received_here == 0) {
+                // Other side closed connection.
+                errno = ECONNRESET;
+                return false;
             }
 
             m_received += received_here;
@@ -94,12 +125,9 @@ public:
                 m_have_size = true;
                 m_received = 0;
 
-                // Grow buffer if necessary.
-                if (m_capacity < m_size) {
-                    delete[] m_buffer;
-                    m_buffer = new uint8_t[m_size];
-                    m_capacity = m_size;
-                }
+                // Wait for room if the pool is short.
+                m_deferred = true;
+                retry();
             }
         }
 
@@ -0,0 +1,147 @@
+
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Job.hpp"
+#include "Manifest.hpp"
+
+Job::Job(int id, const Parameters &parameters, DiskIo &disk_io)
+    : m_id(id), m_parameters(parameters), m_priority(0), m_weight(DEFAULT_JOB_WEIGHT),
+        m_task_source_done(false), m_gather(m_parameters), m_merge(m_parameters),
+        m_graph(m_parameters), m_sink(m_parameters), m_shared_inputs(disk_io),
+        m_frame_times(m_parameters.m_timeout_factor), m_total_work(0), m_work_count(0),
+        m_failed(false), m_finished(false), m_final_pid(-1), m_status(0), m_client_fd(-1) {
+
+    // Nothing.
+}
+
+Job::~Job() {
+    if (m_client_fd != -1) {
+        close(m_client_fd);
+    }
+}
+
+bool Job::start() {
+    // So that the order can be repeated with --seed.
+    if (m_parameters.m_manifest.empty() && m_parameters.m_frames.m_order == ORDER_RANDOM) {
+        std::cout << "Random order seed: " << m_parameters.m_frames.m_seed << "\n";
+    }
+
+    if (m_parameters.m_manifest.empty()) {
+        m_task_source.reset(new FrameTaskSource(m_parameters));
+    } else {
+        Manifest *manifest = new Manifest(m_parameters, m_results);
+        m_task_source.reset(manifest);
+        if (!manifest->is_open()) {
+            std::cerr << "Can't open manifest " << m_parameters.m_manifest << "\n";
+            return false;
+        }
+    }
+
+    if (!m_parameters.m_results.empty()) {
+        m_results.open(m_parameters.m_results, std::ios::app);
+        if (!m_results.is_open()) {
+            std::cerr << "Can't open results file " << m_parameters.m_results << "\n";
+            return false;
+        }
+    }
+
+    if (!m_parameters.m_sink_command.empty() && !m_sink.start()) {
+        return false;
+    }
+
+    return true;
+}
+
+bool Job::fill_tasks() {
+    while (!m_task_source_done && m_tasks.size() < LOCALITY_WINDOW) {
+        Task task;
+        if (m_task_source->next(task)) {
+            m_tasks.push_back(task);
+        } else {
+            m_task_source_done = true;
+        }
+    }
+
+    return !m_tasks.empty();
+}
+
+bool Job::has_work_left() const {
+    // Merges and stages won't get the tasks they wait for.
+    if (m_failed) {
+        return m_gather.is_busy();
+    }
+
+    return !m_tasks.empty() || !m_task_source_done || m_gather.is_busy() ||
+        m_merge.is_busy() || m_graph.is_busy() || m_sink.need_send();
+}
+
+void Job::fail() {
+    m_failed = true;
+    m_tasks.clear();
+    m_task_source_done = true;
+}
+
+void Job::finish() {
+    m_finished = true;
+    m_usage_report.print(std::cout);
+
+    if (!m_parameters.m_sink_command.empty() && !m_sink.finish()) {
+        m_status = -1;
+    }
+    if (m_gather.has_failed() || m_failed) {
+        m_status = -1;
+    }
+
+    if (!m_sink.is_running()) {
+        start_final();
+    }
+}
+
+void Job::start_final() {
+    // Whatever needs all the frames, such as encoding a video.
+    if (m_status == 0 && !m_parameters.m_final_command.empty()) {
+        std::cout << "Running final command\n";
+        m_final_pid = start_local_command(m_parameters.m_final_command);
+        if (m_final_pid == -1) {
+            std::cerr << "Error: Final command failed.\n";
+            m_status = -1;
+        }
+    }
+}
+
+bool Job::is_done() {
+    if (!m_finished) {
+        return false;
+    }
+
+    // The sink command may still be working through the last frames, and
+    // the final command may need its output.
+    if (m_sink.is_running()) {
+        if (!m_sink.reap()) {
+            return false;
+        }
+        if (m_sink.has_failed()) {
+            m_status = -1;
+        }
+        start_final();
+    }
+
+    if (m_final_pid == -1) {
+        return true;
+    }
+
+    int status;
+    pid_t pid = waitpid(m_final_pid, &status, WNOHANG);
+    if (pid == 0) {
+        return false;
+    }
+    if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Error: Final command failed.\n";
+        m_status = -1;
+    }
+    m_final_pid = -1;
+
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef JOB_HPP
+#define JOB_HPP
+
+#include <deque>
+#include <set>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <sys/types.h>
+
+#include "Parameters.hpp"
+#include "Task.hpp"
+#include "Gather.hpp"
+#include "Merge.hpp"
+#include "Graph.hpp"
+#include "Sink.hpp"
+#include "DiskIo.hpp"
+#include "SharedInputs.hpp"
+#include "FrameTimes.hpp"
+#include "Usage.hpp"
+
+// How far into a job's task queue to look for a task that suits a worker.
+// The queue is kept topped up to this many tasks.
+static const int LOCALITY_WINDOW = 64;
+
+// The tasks of one command line, and everything that follows their
+// progress. A controller runs one job, or the jobs submitted to its queue,
+// which share its workers.
+struct Job {
+    // For the log.
+    int m_id;
+
+    // Workers point to these, so the job must not move.
+    Parameters m_parameters;
+
+    // Claim on the workers when jobs share them (see FairShare).
+    int m_priority;
+    int m_weight;
+
+    // Source of tasks to do, either frames or the lines of a manifest. We
+    // only keep a small window of upcoming tasks in memory, plus tasks that
+    // need to be redone.
+    std::unique_ptr<TaskSource> m_task_source;
+    std::deque<Task> m_tasks;
+    bool m_task_source_done;
+
+    // Where to write the result of each task.
+    std::ofstream m_results;
+
+    // Stitches frames together as their tiles arrive.
+    Gather m_gather;
+
+    // Combines seed passes on the workers.
+    Merge m_merge;
+
+    // Runs the later stages of each frame.
+    Graph m_graph;
+
+    // Pipes frames in order to the sink command.
+    Sink m_sink;
+
+    // Files every worker of the job gets, read and serialized once.
+    SharedInputs m_shared_inputs;
+
+    // How long frames take, to notice stuck ones.
+    FrameTimes m_frame_times;
+
+    // Tasks that were cancelled for taking too long. They aren't cancelled again.
+    std::set<std::string> m_timed_out_ids;
+
+    // Resources used by the tasks, per host.
+    UsageReport m_usage_report;
+
+    // Average work of a frame, in units of calibration benchmark runs.
+    double m_total_work;
+    int m_work_count;
+
+    // Whether a task failed, so that no more are handed out.
+    bool m_failed;
+
+    // Whether finish() was called, the final command's process (or -1 if
+    // not running), and the job's exit status once it's done.
+    bool m_finished;
+    pid_t m_final_pid;
+    int m_status;
+
+    // Connection of the submit command waiting for the job, or -1 for none.
+    int m_client_fd;
+
+    Job(int id, const Parameters &parameters, DiskIo &disk_io);
+    virtual ~Job();
+
+    // Open the task source, the results file, and the sink. Returns whether
+    // successful, after writing an error to standard error if not.
+    bool start();
+
+    // Top up the window of upcoming tasks from the source. Returns whether
+    // there are any tasks in the window.
+    bool fill_tasks();
+
+    // Average work of a frame in units of calibration benchmark runs, or 0
+    // if unknown.
+    double get_work_per_frame() const {
+        return m_work_count == 0 ? 0 : m_total_work/m_work_count;
+    }
+
+    // Whether there are tasks to hand out or local commands to wait for,
+    // not counting tasks on workers.
+    bool has_work_left() const;
+
+    // Stop handing out tasks after one failed.
+    void fail();
+
+    // Wrap up once everything is done: print the resources used, finish
+    // the sink, and start the final command unless the sink is still running.
+    void finish();
+
+    // Whether the job is done, once the sink and final commands (if any)
+    // have exited. m_status is then valid.
+    bool is_done();
+
+    // Start the final command, if any and if all went well. Called once the
+    // sink command (if any) has exited.
+    void start_final();
+};
+
+#endif // JOB_HPP
@@ -0,0 +1,92 @@
+
+#include <iostream>
+
+#include "Manifest.hpp"
+#include "util.hpp"
+
+bool Manifest::next(Task &task) {
+    std::string line;
+
+    while (std::getline(m_file, line)) {
+        m_line_number++;
+
+        // Skip blank lines and comments.
+        std::string::size_type begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') {
+            continue;
+        }
+
+        task = Task();
+        if (parse_manifest_line(line, m_parameters.m_arguments, task)) {
+            task.m_server_key = m_parameters.m_server_key;
+            task.m_post_command = m_parameters.m_post_command;
+            return true;
+        }
+
+        std::cerr << "Skipping line " << m_line_number << " of manifest " <<
+            m_parameters.m_manifest << "\n";
+
+        // Record it as a failed task, under its first word, so that it's not
+        // mistaken for one that was never run.
+        if (m_results.is_open()) {
+            std::string::size_type end = line.find_first_of(" \t\r", begin);
+            m_results << line.substr(begin, end == std::string::npos ? end : end - begin) <<
+                "\t" << MANIFEST_LINE_STATUS << "\t-\t0\t0\t0\n";
+            m_results.flush();
+        }
+    }
+
+    return false;
+}
+
+bool parse_manifest_line(const std::string &line, const std::vector<std::string> &parameters,
+        Task &task) {
+
+    std::vector<std::string> words;
+    if (!split_words(line, words)) {
+        std::cerr << "Unterminated quote in manifest line: " << line << "\n";
+        return false;
+    }
+    if (words.empty()) {
+        std::cerr << "Missing task ID in manifest line: " << line << "\n";
+        return false;
+    }
+
+    task.m_id = words[0];
+    task.m_arguments = parameters;
+
+    int i = 1;
+    while (i < words.size() && words[i].compare(0, 2, "--") == 0) {
+        const std::string &flag = words[i++];
+
+        if (flag == "--") {
+            break;
+        } else if (flag == "--in" || flag == "--out") {
+            if (i + 2 > words.size()) {
+                std::cerr << "Must specify two pathnames with " << flag <<
+                    " in manifest line: " << line << "\n";
+                return false;
+            }
+            FileCopy fileCopy(words[i], words[i + 1]);
+            i += 2;
+
+            const std::string &remote_pathname = flag == "--in" ?
+                fileCopy.m_destination : fileCopy.m_source;
+            if (!is_pathname_local(remote_pathname)) {
+                std::cerr << "Remote pathname must be local with " << flag << ": "
+                    << remote_pathname << "\n";
+                return false;
+            }
+
+            (flag == "--in" ? task.m_in_copies : task.m_out_copies).push_back(fileCopy);
+        } else {
+            std::cerr << "Unknown flag " << flag << " in manifest line: " << line << "\n";
+            return false;
+        }
+    }
+
+    // The rest are arguments.
+    task.m_arguments.insert(task.m_arguments.end(), words.begin() + i, words.end());
+
+    return true;
+}
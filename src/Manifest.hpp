@@ -0,0 +1,47 @@
+#ifndef MANIFEST_HPP
+#define MANIFEST_HPP
+
+#include <fstream>
+
+#include "Task.hpp"
+
+// Status in the results file of a manifest line that couldn't be parsed.
+// Exit statuses are never negative.
+static const int MANIFEST_LINE_STATUS = -1;
+
+// Reads tasks from a manifest file as they're needed, so that the file can
+// be much larger than memory. Each line is a task:
+//
+//     ID [--in LOCAL REMOTE]... [--out REMOTE LOCAL]... [--] [ARGUMENT]...
+//
+// Blank lines and lines starting with # are skipped. Invalid lines are
+// skipped and written to the results file, if open, as failed tasks.
+class Manifest : public TaskSource {
+    const Parameters &m_parameters;
+    std::ifstream m_file;
+    int m_line_number;
+    std::ofstream &m_results;
+
+public:
+    Manifest(const Parameters &parameters, std::ofstream &results)
+        : m_parameters(parameters), m_file(parameters.m_manifest), m_line_number(0),
+            m_results(results) {
+
+        // Nothing.
+    }
+
+    // Whether the manifest file could be opened.
+    bool is_open() const {
+        return m_file.is_open();
+    }
+
+    virtual bool next(Task &task);
+};
+
+// Parse one line of a manifest into a task. The task's arguments start with
+// the command-line parameters. Returns whether successful. If not, also
+// prints error to standard error.
+bool parse_manifest_line(const std::string &line, const std::vector<std::string> &parameters,
+        Task &task);
+
+#endif // MANIFEST_HPP
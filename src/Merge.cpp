@@ -0,0 +1,345 @@
+
+#include <iostream>
+#include <unistd.h>
+
+#include "Merge.hpp"
+
+Merge::Merge(const Parameters &parameters)
+    : m_parameters(parameters), m_copy(nullptr), m_step_counter(0) {
+
+    // Parameters make sure there's exactly one when merging.
+    for (const FileCopy &fileCopy : parameters.m_out_copies) {
+        if (fileCopy.has_parameter()) {
+            m_copy = &fileCopy;
+        }
+    }
+}
+
+int Merge::count_partials(const Task &task, int worker_id) const {
+    if (m_copy == nullptr || task.m_stage != 0 || is_step(task)) {
+        return 0;
+    }
+
+    std::map<std::string, Group>::const_iterator itr = m_groups.find(substitute_parameters(
+                m_copy->m_destination, m_parameters.get_parameter_values(task.m_frame, task.m_tile)));
+    if (itr == m_groups.end()) {
+        return 0;
+    }
+
+    int count = 0;
+    for (const Partial &partial : itr->second.m_partials) {
+        if (partial.m_worker_id == worker_id) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+bool Merge::take_pinned_task(int worker_id, Task &task) {
+    std::map<int, std::deque<Task>>::iterator itr = m_pinned_tasks.find(worker_id);
+    if (itr == m_pinned_tasks.end() || itr->second.empty()) {
+        return false;
+    }
+
+    task = itr->second.front();
+    itr->second.pop_front();
+
+    return true;
+}
+
+bool Merge::task_done(const Task &task, int worker_id, std::deque<Task> &tasks) {
+    std::map<std::string, Step>::iterator itr = m_steps.find(task.m_id);
+
+    if (itr == m_steps.end()) {
+        // A seed pass, which stays on the worker.
+        std::map<std::string, int> values =
+            m_parameters.get_parameter_values(task.m_frame, task.m_tile);
+        std::string key = substitute_parameters(m_copy->m_destination, values);
+
+        Group &group = m_groups[key];
+        if (group.m_destination.empty()) {
+            group.m_frame = task.m_frame;
+            group.m_destination = key;
+            group.m_covered = 0;
+            group.m_step_count = 0;
+        }
+        group.m_partials.push_back(Partial {
+            worker_id, substitute_parameters(m_copy->m_source, values), { task.m_tile } });
+        group.m_covered++;
+        advance(key);
+
+        return false;
+    }
+
+    Step step = itr->second;
+    m_steps.erase(itr);
+    if (step.m_type == STEP_REMOVE) {
+        // The group may be gone already.
+        return false;
+    }
+    Group &group = m_groups[step.m_group];
+    group.m_step_count--;
+
+    switch (step.m_type) {
+        case STEP_MERGE: {
+            if (!step.m_relay_pathname.empty()) {
+                unlink(step.m_relay_pathname.c_str());
+            }
+
+            Partial partial = { step.m_worker_id, step.m_output, {} };
+            for (const Partial &input : step.m_inputs) {
+                partial.m_tiles.insert(partial.m_tiles.end(),
+                        input.m_tiles.begin(), input.m_tiles.end());
+            }
+            group.m_partials.push_back(partial);
+
+            // The worker that relayed one of the inputs still has it.
+            if (step.m_relayed.m_worker_id != -1) {
+                add_step(STEP_REMOVE, step.m_group, step.m_relayed.m_worker_id, {})
+                    .m_remove_pathnames.push_back(step.m_relayed.m_pathname);
+            }
+            break;
+        }
+
+        case STEP_RELAY: {
+            const Partial &relayed = step.m_inputs[0];
+            if (step.m_inputs.size() < 2) {
+                // The worker we were relaying to died, so we have nowhere to
+                // merge. The partial is still on its worker, to pair up again.
+                unlink(step.m_relay_pathname.c_str());
+                group.m_partials.push_back(relayed);
+                break;
+            }
+
+            // Send it to the worker with the other partial and merge there.
+            const Partial &target = step.m_inputs[1];
+            Partial copy = { target.m_worker_id, make_pathname(group, relayed), relayed.m_tiles };
+            Task &merge_task = add_step(STEP_MERGE, step.m_group, target.m_worker_id,
+                    { copy, target });
+            merge_task.m_in_copies.push_back(FileCopy(step.m_relay_pathname, copy.m_pathname));
+            m_steps[merge_task.m_id].m_relay_pathname = step.m_relay_pathname;
+            m_steps[merge_task.m_id].m_relayed = relayed;
+            break;
+        }
+
+        case STEP_FETCH: {
+            std::cout << "Merged " << group.m_destination << "\n";
+            m_groups.erase(step.m_group);
+            return true;
+        }
+
+        case STEP_REMOVE:
+            // Handled above.
+            break;
+    }
+
+    advance(step.m_group);
+
+    return false;
+}
+
+void Merge::worker_died(int worker_id, std::deque<Task> &tasks) {
+    // Partials on the worker are gone.
+    for (std::pair<const std::string, Group> &entry : m_groups) {
+        Group &group = entry.second;
+
+        for (int i = group.m_partials.size() - 1; i >= 0; i--) {
+            if (group.m_partials[i].m_worker_id == worker_id) {
+                requeue(group, group.m_partials[i], tasks);
+                group.m_partials.erase(group.m_partials.begin() + i);
+            }
+        }
+    }
+
+    // Steps on the worker won't finish. Their inputs on other workers are
+    // still good.
+    std::map<std::string, Step>::iterator itr = m_steps.begin();
+    while (itr != m_steps.end()) {
+        Step &step = itr->second;
+
+        if (step.m_type == STEP_REMOVE) {
+            // The group may be gone already, and there's nothing to undo.
+            if (step.m_worker_id == worker_id) {
+                itr = m_steps.erase(itr);
+            } else {
+                ++itr;
+            }
+            continue;
+        }
+
+        Group &group = m_groups[step.m_group];
+        if (step.m_relayed.m_worker_id == worker_id) {
+            step.m_relayed.m_worker_id = -1;
+        }
+
+        if (step.m_worker_id == worker_id) {
+            for (int i = 0; i < step.m_inputs.size(); i++) {
+                const Partial &input = step.m_inputs[i];
+                if (input.m_worker_id != worker_id) {
+                    group.m_partials.push_back(input);
+                } else if (i == 0 && step.m_relayed.m_worker_id != -1) {
+                    // A relayed copy, whose original is still good.
+                    group.m_partials.push_back(step.m_relayed);
+                } else {
+                    requeue(group, input, tasks);
+                }
+            }
+            if (!step.m_relay_pathname.empty()) {
+                unlink(step.m_relay_pathname.c_str());
+            }
+            group.m_step_count--;
+            itr = m_steps.erase(itr);
+        } else {
+            if (step.m_type == STEP_RELAY && step.m_inputs.size() == 2 &&
+                    step.m_inputs[1].m_worker_id == worker_id) {
+
+                requeue(group, step.m_inputs[1], tasks);
+                step.m_inputs.resize(1);
+            }
+            ++itr;
+        }
+    }
+
+    m_pinned_tasks.erase(worker_id);
+
+    // Partials returned from dead steps might pair up differently.
+    for (std::pair<const std::string, Group> &entry : m_groups) {
+        advance(entry.first);
+    }
+}
+
+void Merge::advance(const std::string &key) {
+    Group &group = m_groups[key];
+    int seed_count = m_parameters.get_seed_count();
+
+    while (group.m_partials.size() >= 2) {
+        std::vector<Partial> &partials = group.m_partials;
+
+        // Merge a pair on the same worker.
+        int first = -1;
+        int second = -1;
+        for (int i = 0; i < partials.size() && second == -1; i++) {
+            for (int j = i + 1; j < partials.size() && second == -1; j++) {
+                if (partials[i].m_worker_id == partials[j].m_worker_id) {
+                    first = i;
+                    second = j;
+                }
+            }
+        }
+        if (second != -1) {
+            std::vector<Partial> inputs = { partials[first], partials[second] };
+            partials.erase(partials.begin() + second);
+            partials.erase(partials.begin() + first);
+            add_step(STEP_MERGE, key, inputs[0].m_worker_id, inputs);
+            continue;
+        }
+
+        // Pairs on different workers can't improve once all passes are done.
+        if (group.m_covered < seed_count) {
+            break;
+        }
+
+        // Relay the first to the worker with the second.
+        std::vector<Partial> inputs = { partials[0], partials[1] };
+        partials.erase(partials.begin(), partials.begin() + 2);
+        add_step(STEP_RELAY, key, inputs[0].m_worker_id, inputs);
+    }
+
+    // Copy back the final result.
+    if (group.m_covered == seed_count && group.m_step_count == 0 &&
+            group.m_partials.size() == 1) {
+
+        Partial partial = group.m_partials[0];
+        group.m_partials.clear();
+        add_step(STEP_FETCH, key, partial.m_worker_id, { partial });
+    }
+}
+
+Task &Merge::add_step(StepType type, const std::string &key, int worker_id,
+        const std::vector<Partial> &inputs) {
+
+    static const char *STEP_NAMES[] = { "merge", "relay", "fetch", "remove" };
+
+    Group &group = m_groups[key];
+    int counter = m_step_counter++;
+
+    Step step;
+    step.m_type = type;
+    step.m_group = key;
+    step.m_worker_id = worker_id;
+    step.m_inputs = inputs;
+    step.m_relayed.m_worker_id = -1;
+
+    Task task;
+    task.m_id = std::to_string(group.m_frame) + ":" + STEP_NAMES[type] + std::to_string(counter);
+    task.m_frame = group.m_frame;
+
+    switch (type) {
+        case STEP_MERGE: {
+            std::map<std::string, int> values =
+                m_parameters.get_parameter_values(group.m_frame, inputs[0].m_tiles[0]);
+            step.m_output = make_pathname(group, inputs[0]);
+
+            const std::vector<std::string> &command = m_parameters.m_merge_command;
+            task.m_executable = substitute_parameters(command[0], values);
+            for (int i = 1; i < command.size(); i++) {
+                task.m_arguments.push_back(substitute_parameters(command[i], values));
+            }
+            task.m_arguments.push_back(step.m_output);
+            for (const Partial &input : inputs) {
+                task.m_arguments.push_back(input.m_pathname);
+                task.m_arguments.push_back(std::to_string(input.m_tiles.size()));
+                task.m_remove_pathnames.push_back(input.m_pathname);
+            }
+            break;
+        }
+
+        case STEP_RELAY:
+            step.m_relay_pathname = group.m_destination + ".relay" + std::to_string(counter);
+            task.m_copy_only = true;
+            task.m_out_copies.push_back(FileCopy(inputs[0].m_pathname, step.m_relay_pathname));
+            break;
+
+        case STEP_FETCH:
+            task.m_copy_only = true;
+            task.m_out_copies.push_back(FileCopy(inputs[0].m_pathname, group.m_destination));
+            task.m_remove_pathnames.push_back(inputs[0].m_pathname);
+            if (!m_parameters.m_sink_command.empty()) {
+                task.m_sink_copy = 0;
+            }
+            break;
+
+        case STEP_REMOVE:
+            task.m_copy_only = true;
+            break;
+    }
+
+    // Nothing waits for removals.
+    if (type != STEP_REMOVE) {
+        group.m_step_count++;
+    }
+    m_steps[task.m_id] = step;
+
+    std::deque<Task> &pinned_tasks = m_pinned_tasks[worker_id];
+    pinned_tasks.push_back(task);
+
+    return pinned_tasks.back();
+}
+
+std::string Merge::make_pathname(const Group &group, const Partial &partial) {
+    // Name it like a seed pass that doesn't exist.
+    std::map<std::string, int> values =
+        m_parameters.get_parameter_values(group.m_frame, partial.m_tiles[0]);
+    values[SEED_PARAMETER] = m_parameters.get_seed_count() + m_step_counter++;
+
+    return substitute_parameters(m_copy->m_source, values);
+}
+
+void Merge::requeue(Group &group, const Partial &partial, std::deque<Task> &tasks) {
+    for (int tile : partial.m_tiles) {
+        tasks.push_front(make_frame_task(m_parameters, group.m_frame, tile));
+    }
+
+    group.m_covered -= partial.m_tiles.size();
+}
@@ -0,0 +1,149 @@
+#ifndef MERGE_HPP
+#define MERGE_HPP
+
+#include <map>
+#include <deque>
+
+#include "Parameters.hpp"
+#include "Task.hpp"
+
+// Merges the seed passes of each frame as a tree reduction. Passes stay on
+// the workers that rendered them, and pairs on the same worker are merged
+// there. Once all passes of a frame are done, pairs on different workers are
+// merged by relaying one through the controller. Only the final result of a
+// frame is copied back to its local pathname. Partials are deleted from the
+// workers once they're used up.
+class Merge {
+    // A pass, or a merge of several, sitting on a worker.
+    struct Partial {
+        // Worker it's on.
+        int m_worker_id;
+
+        // Remote pathname.
+        std::string m_pathname;
+
+        // Tiles (seed passes) that it covers.
+        std::vector<int> m_tiles;
+    };
+
+    // All passes of one output of a frame.
+    struct Group {
+        int m_frame;
+
+        // Local pathname of the final result.
+        std::string m_destination;
+
+        // Results waiting to be merged.
+        std::vector<Partial> m_partials;
+
+        // Number of seed passes done, whether merged yet or not.
+        int m_covered;
+
+        // Number of steps in progress.
+        int m_step_count;
+    };
+
+    // A task we made to combine or move partials.
+    enum StepType {
+        // Merge two partials on the same worker.
+        STEP_MERGE,
+
+        // Copy a partial to the controller, to be sent to another worker.
+        STEP_RELAY,
+
+        // Copy the final result to its local pathname.
+        STEP_FETCH,
+
+        // Delete a relayed partial from its worker once it's merged. Nothing
+        // waits for it.
+        STEP_REMOVE,
+    };
+    struct Step {
+        StepType m_type;
+
+        // Key of the group in m_groups.
+        std::string m_group;
+
+        // Worker the step runs on.
+        int m_worker_id;
+
+        // Partials the step uses up. For relays, the second is the one on
+        // the worker that will do the merge.
+        std::vector<Partial> m_inputs;
+
+        // Remote pathname of the merged result, for merges.
+        std::string m_output;
+
+        // Local file relayed through the controller, or empty for none.
+        std::string m_relay_pathname;
+
+        // For merges of a relayed partial, the original on the other worker,
+        // or a worker ID of -1 for none (or if that worker died).
+        Partial m_relayed;
+    };
+
+    const Parameters &m_parameters;
+
+    // The per-frame out copy whose passes we merge.
+    const FileCopy *m_copy;
+
+    // Groups that aren't done, by local pathname of the final result.
+    std::map<std::string, Group> m_groups;
+
+    // Steps in progress, by task ID.
+    std::map<std::string, Step> m_steps;
+
+    // Step tasks waiting for their worker, by worker ID.
+    std::map<int, std::deque<Task>> m_pinned_tasks;
+
+    // Counter for unique step IDs and pathnames.
+    int m_step_counter;
+
+public:
+    Merge(const Parameters &parameters);
+
+    // Whether any frames still have passes to merge or copy back, or
+    // partials to delete.
+    bool is_busy() const {
+        return !m_groups.empty() || !m_steps.empty();
+    }
+
+    // Whether the task is one of our steps (not a seed pass).
+    bool is_step(const Task &task) const {
+        return m_steps.find(task.m_id) != m_steps.end();
+    }
+
+    // Number of partials of the seed pass's frame output that are already
+    // on this worker. 0 for steps, or if we're not merging.
+    int count_partials(const Task &task, int worker_id) const;
+
+    // Get the next step that must run on this worker. Returns whether there
+    // was one.
+    bool take_pinned_task(int worker_id, Task &task);
+
+    // Record a finished seed pass or step, and queue whatever steps it makes
+    // possible. Seed passes that must be redone are pushed onto the front of
+    // the queue. Returns whether it was the final copy of a frame's output.
+    bool task_done(const Task &task, int worker_id, std::deque<Task> &tasks);
+
+    // Forget the partials on a dead worker, and push the seed passes they
+    // covered back onto the front of the queue.
+    void worker_died(int worker_id, std::deque<Task> &tasks);
+
+private:
+    // Queue the steps that a group's partials make possible.
+    void advance(const std::string &key);
+
+    // Make a step task that runs on the worker, and remember the step.
+    Task &add_step(StepType type, const std::string &key, int worker_id,
+            const std::vector<Partial> &inputs);
+
+    // Unique remote pathname for a partial of the group, made from the
+    // pathname of the out copy.
+    std::string make_pathname(const Group &group, const Partial &partial);
+
+    // Push the seed passes covered by the partial back onto the front of the queue.
+    void requeue(Group &group, const Partial &partial, std::deque<Task> &tasks);
+};
+
+#endif // MERGE_HPP
@@ -0,0 +1,44 @@
+#ifndef MESSAGE_ARENA_HPP
+#define MESSAGE_ARENA_HPP
+
+#include <vector>
+#include <google/protobuf/arena.h>
+
+// Size of the block an arena keeps between messages. Messages with small
+// fields fit in it without allocating.
+static const size_t MESSAGE_ARENA_BLOCK_SIZE = 64*1024;
+
+// Arena for the messages of one connection. Messages are made with create()
+// and all go away at the next reset(), which keeps the first block for reuse.
+class MessageArena {
+    std::vector<char> m_block;
+    google::protobuf::Arena m_arena;
+
+public:
+    MessageArena()
+        : m_block(MESSAGE_ARENA_BLOCK_SIZE), m_arena(make_options(m_block)) {
+
+        // Nothing.
+    }
+
+    // Free all messages made since the last reset.
+    void reset() {
+        m_arena.Reset();
+    }
+
+    // Make an empty message that lives until the next reset.
+    template <typename T>
+    T &create() {
+        return *google::protobuf::Arena::CreateMessage<T>(&m_arena);
+    }
+
+private:
+    static google::protobuf::ArenaOptions make_options(std::vector<char> &block) {
+        google::protobuf::ArenaOptions options;
+        options.initial_block = block.data();
+        options.initial_block_size = block.size();
+        return options;
+    }
+};
+
+#endif // MESSAGE_ARENA_HPP
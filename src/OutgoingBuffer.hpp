@@ -1,49 +1,132 @@
 #ifndef OUTGOING_BUFFER_HPP
 #define OUTGOING_BUFFER_HPP
 
+#include <string>
+#include <memory>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <google/protobuf/message.h>
 
+#include "BufferPool.hpp"
+
+// A message with its size header, ready to send. Immutable once made, so
+// it can be shared by the buffers of several connections. The memory comes
+// from a pool, or from the heap for messages kept for the whole job.
+class MessageBuffer {
+    BufferPool *m_pool;
+    Buffer m_buffer;
+    size_t m_size;
+
+public:
+    MessageBuffer(BufferPool *pool, size_t size)
+        : m_pool(pool), m_size(size) {
+
+        if (m_pool != nullptr) {
+            m_buffer = m_pool->acquire(size, false);
+        } else {
+            m_buffer.m_data = new uint8_t[size];
+            m_buffer.m_capacity = size;
+        }
+    }
+
+    MessageBuffer(const MessageBuffer &) = delete;
+    MessageBuffer &operator=(const MessageBuffer &) = delete;
+
+    virtual ~MessageBuffer() {
+        if (m_pool != nullptr) {
+            m_pool->release(m_buffer);
+        } else {
+            delete[] m_buffer.m_data;
+        }
+    }
+
+    uint8_t *data() {
+        return m_buffer.m_data;
+    }
+
+    const uint8_t *data() const {
+        return m_buffer.m_data;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+};
+
+typedef std::shared_ptr<const MessageBuffer> SerializedMessage;
+
 // Represents data that needs to be sent asynchronously.
 class OutgoingBuffer {
     // File descriptor we're sending on.
     int m_fd;
 
-    // Buffer includes size header.
-    uint8_t *m_buffer;
+    // Where our messages' memory comes from.
+    BufferPool &m_pool;
 
-    // Size includes size header.
+    // Message we're sending if it's shared with other connections, or null.
+    SerializedMessage m_shared;
+
+    // Memory of the message we're sending if it's our own. Null data if none.
+    Buffer m_own;
+
+    // Message we're sending, with its size header, or null for none.
+    const uint8_t *m_data;
     uint32_t m_size;
 
     // How many bytes have been sent.
     uint32_t m_sent;
 
 public:
-    OutgoingBuffer(int fd)
-        : m_fd(fd), m_buffer(nullptr), m_size(0), m_sent(0) {
+    OutgoingBuffer(int fd, BufferPool &pool)
+        : m_fd(fd), m_pool(pool), m_data(nullptr), m_size(0), m_sent(0) {
 
         // Nothing.
     }
 
     virtual ~OutgoingBuffer() {
-        delete[] m_buffer;
+        m_pool.release(m_own);
     }
 
-    // Set the outgoing message. Does not send anything.
+    // Serialize a message with its size header, into memory from the pool,
+    // or from the heap if null.
+    static SerializedMessage serialize(const google::protobuf::Message &message,
+            BufferPool *pool) {
+
+        uint32_t data_size = message.ByteSizeLong();
+        MessageBuffer *buffer = new MessageBuffer(pool, sizeof(data_size) + data_size);
+        write_message(message, data_size, buffer->data());
+
+        return SerializedMessage(buffer);
+    }
+
+    // Set the outgoing message. Does not send anything. The message is
+    // serialized straight into a buffer from the pool.
     void set_message(const google::protobuf::Message &message) {
-        delete[] m_buffer;
+        clear();
+        uint32_t data_size = message.ByteSizeLong();
+        m_size = sizeof(data_size) + data_size;
+        m_own = m_pool.acquire(m_size, false);
+        write_message(message, data_size, m_own.m_data);
+        m_data = m_own.m_data;
+    }
 
-        int data_size = message.ByteSize();
-        m_size = data_size + sizeof(data_size);
-        m_buffer = new uint8_t[m_size];
-        *((uint32_t *) m_buffer) = htonl(data_size);
-        message.SerializeToArray(m_buffer + sizeof(data_size), data_size);
-        m_sent = 0;
+    // Set the outgoing message, already serialized. Does not send anything.
+    void set_message(const SerializedMessage &message) {
+        clear();
+        m_shared = message;
+        m_data = message->data();
+        m_size = message->size();
+    }
+
+    // Size of the message, including its size header, or 0 if there's
+    // nothing left to send.
+    size_t get_size() const {
+        return m_data == nullptr ? 0 : m_size;
     }
 
     // Whether we have something to write.
     bool need_send() const {
-        return m_sent < m_size;
+        return m_data != nullptr && m_sent < m_size;
     }
 
     // Sends as much as it can. Returns whether successful. If not, sets errno.
@@ -51,16 +134,39 @@ public:
         if (need_send()) {
             uint32_t bytes_left = m_size - m_sent;
 
-            int sent_here = ::send(m_fd, m_buffer + m_sent, bytes_left, 0);
+            int sent_here = ::send(m_fd, m_data + m_sent, bytes_left, 0);
             if (sent_here == -1) {
                 return false;
             }
 
             m_sent += sent_here;
+
+            // Let go of the memory as soon as we can.
+            if (m_sent == m_size) {
+                clear();
+            }
         }
 
         return true;
     }
+
+private:
+    // Write the size header and the message, whose size has just been computed.
+    static void write_message(const google::protobuf::Message &message, uint32_t data_size,
+            uint8_t *data) {
+
+        *((uint32_t *) data) = htonl(data_size);
+        message.SerializeWithCachedSizesToArray(data + sizeof(data_size));
+    }
+
+    // Forget the message.
+    void clear() {
+        m_pool.release(m_own);
+        m_shared.reset();
+        m_data = nullptr;
+        m_size = 0;
+        m_sent = 0;
+    }
 };
 
 #endif // OUTGOING_BUFFER_HPP
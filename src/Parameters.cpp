@@ -2,8 +2,12 @@
 #include <deque>
 #include <stdexcept>
 #include <cstring>
+#include <ctime>
+#include <cmath>
+#include <limits>
 
 #include "Parameters.hpp"
+#include "Stages.hpp"
 
 // Helper class to deal with list of arguments.
 class Arguments {
@@ -55,35 +59,161 @@ public:
     }
 };
 
+// Parses a non-negative decimal integer. Returns whether successful.
+static bool parse_non_negative(const std::string &str, int64_t &value) {
+    const char *s = str.c_str();
+    char *end;
+
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+
+    value = strtoll(s, &end, 10);
+    return *end == '\0';
+}
+
+// Parses a non-negative decimal number, possibly with a fraction. Returns
+// whether successful.
+static bool parse_non_negative_double(const std::string &str, double &value) {
+    const char *s = str.c_str();
+    char *end;
+
+    if ((*s < '0' || *s > '9') && *s != '.') {
+        return false;
+    }
+
+    value = strtod(s, &end);
+    return *end == '\0' && std::isfinite(value);
+}
+
+// Parses a number of megabytes into bytes. Returns whether successful.
+static bool parse_megabytes(const std::string &str, int64_t &bytes) {
+    int64_t megabytes;
+
+    if (!parse_non_negative(str, megabytes) ||
+            megabytes > std::numeric_limits<int64_t>::max()/(1024*1024)) {
+
+        return false;
+    }
+
+    bytes = megabytes*1024*1024;
+    return true;
+}
+
+// Parses a proxy share's WEIGHT[,MIN[,MAX]]. Returns whether successful.
+static bool parse_proxy_share(const std::string &str, ProxyShare &share) {
+    std::vector<int64_t> values;
+    size_t start = 0;
+    while (true) {
+        size_t comma = str.find(',', start);
+        int64_t value;
+        if (!parse_non_negative(str.substr(start, comma - start), value)) {
+            return false;
+        }
+        values.push_back(value);
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+
+    if (values.size() > 3 || values[0] == 0 ||
+            (values.size() == 3 && values[2] < values[1])) {
+
+        return false;
+    }
+
+    share.m_weight = values[0];
+    share.m_min_workers = values.size() >= 2 ? values[1] : 0;
+    share.m_max_workers = values.size() == 3 ? values[2] : -1;
+    return true;
+}
+
 // Prints program usage to standard error.
 void Parameters::usage() const {
-    std::cerr << "Usage: distray {worker,proxy,controller} [FLAGS] [ARGUMENTS]\n";
+    std::cerr << "Usage: distray {worker,proxy,controller,submit} [FLAGS] [ARGUMENTS]\n";
     std::cerr << "\n";
     std::cerr << "Commands:\n";
     std::cerr << "\n";
-    std::cerr << "    worker ENDPOINT\n";
+    std::cerr << "    worker [FLAGS] ENDPOINT\n";
     std::cerr << "        The ENDPOINT of either a proxy or a controller [:" << DEFAULT_WORKER_PORT << "].\n";
+    std::cerr << "        --slots COUNT       Connect COUNT times to run up to COUNT tasks at once [1].\n";
+    std::cerr << "        --pin               Keep each slot on its own CPUs and NUMA node.\n";
+    std::cerr << "        --daemon            Keep reconnecting, to serve job after job.\n";
     std::cerr << "\n";
     std::cerr << "    proxy [FLAGS]\n";
     std::cerr << "        --worker-listen ENDPOINT      ENDPOINT to listen for workers on [:"
         << DEFAULT_WORKER_PORT << "].\n";
     std::cerr << "        --controller-listen ENDPOINT  ENDPOINT to listen for controllers on [:"
         << DEFAULT_CONTROLLER_PORT << "].\n";
+    std::cerr << "        --share NAME WEIGHT[,MIN[,MAX]]  Give controllers called NAME workers in\n";
+    std::cerr << "                            proportion to WEIGHT [1], at least MIN first [0],\n";
+    std::cerr << "                            and at most MAX [no limit]. Can be repeated.\n";
     std::cerr << "\n";
     std::cerr << "    controller [FLAGS] FRAMES EXEC [PARAMETERS...]\n";
+    std::cerr << "    controller [FLAGS] --manifest PATHNAME EXEC [PARAMETERS...]\n";
+    std::cerr << "    controller [FLAGS] --queue PATHNAME\n";
     std::cerr << "        FRAMES is a frame range specification: FIRST[,LAST[,STEP]],\n";
     std::cerr << "        where STEP defaults to 1 or -1 (depending on order of FIRST and LAST)\n";
-    std::cerr << "        and LAST defaults to FIRST.\n";
+    std::cerr << "        and LAST defaults to FIRST. It can also be a comma-separated list\n";
+    std::cerr << "        of FRAME, FIRST-LAST, FIRST-LAST:STEP, and @PATHNAME items, where\n";
+    std::cerr << "        PATHNAME is a file with one frame number per line.\n";
+    std::cerr << "        With --manifest, each line of PATHNAME is a task:\n";
+    std::cerr << "        ID [--in LOCAL REMOTE]... [--out REMOTE LOCAL]... [--] [ARGS]...\n";
     std::cerr << "        EXEC is the executable to run on each worker.\n";
     std::cerr << "        PARAMETERS are the parameters to pass to the executed binary.\n";
     std::cerr << "        Use %d or %0Nd for the frame number, where N is a positive\n";
-    std::cerr << "        decimal integer that specifies field width.\n";
+    std::cerr << "        decimal integer that specifies field width. Use %/Kd or %0N/Kd\n";
+    std::cerr << "        for the frame number divided by K.\n";
     std::cerr << "        --proxy ENDPOINT    Proxy ENDPOINT to connect to [:"
         << DEFAULT_CONTROLLER_PORT << "]. Can be repeated.\n";
+    std::cerr << "        --name NAME         Name to claim the workers of proxies under [$USER].\n";
     std::cerr << "        --in LOCAL REMOTE   Copy LOCAL file to REMOTE file. Can be repeated.\n";
     std::cerr << "        --out REMOTE LOCAL  Copy REMOTE file to LOCAL file. Can be repeated.\n";
     std::cerr << "        --listen ENDPOINT   ENDPOINT to listen on [:"
         << DEFAULT_WORKER_PORT << "].\n";
+    std::cerr << "        --min-free-memory MB  Skip workers with less free memory ["
+        << DEFAULT_MIN_FREE_MEMORY_MB << "].\n";
+    std::cerr << "        --dim NAME COUNT    Split each frame into COUNT tasks along NAME,\n";
+    std::cerr << "                            substituted with %{NAME} or %0N{NAME}. Can be repeated.\n";
+    std::cerr << "        --seeds COUNT       Split each frame into COUNT passes, substituted with %{seed}.\n";
+    std::cerr << "        --merge COMMAND     Merge pairs of passes on the workers, as\n";
+    std::cerr << "                            COMMAND OUT IN1 COUNT1 IN2 COUNT2.\n";
+    std::cerr << "        --post COMMAND      Run COMMAND on the worker after EXEC, before copying out.\n";
+    std::cerr << "        --server KEY        Keep EXEC running on each worker while KEY is the same,\n";
+    std::cerr << "                            sending it a line of PARAMETERS for each task.\n";
+    std::cerr << "        --early-out         Copy out per-frame files as soon as EXEC closes them.\n";
+    std::cerr << "        --gather COMMAND    Run COMMAND locally once all tasks of a frame are done.\n";
+    std::cerr << "        --sink COMMAND      Pipe each frame's output into COMMAND, in frame order.\n";
+    std::cerr << "        --sink-memory MB    Hold early frames for --sink in memory up to MB ["
+        << DEFAULT_SINK_MEMORY_MB << "].\n";
+    std::cerr << "        --buffer-memory MB  Use at most MB for buffers of messages to and from\n";
+    std::cerr << "                            workers [" << DEFAULT_BUFFER_MEMORY_MB << "].\n";
+    std::cerr << "        --timeout-factor FACTOR  Move frames that take FACTOR times longer than\n";
+    std::cerr << "                            most to another worker, or never if 0 ["
+        << DEFAULT_TIMEOUT_FACTOR << "].\n";
+    std::cerr << "        --stages PATHNAME   Run the stages in PATHNAME on each frame after EXEC.\n";
+    std::cerr << "        --keep REMOTE       Leave REMOTE on the worker for later stages. Can be repeated.\n";
+    std::cerr << "        --final COMMAND     Run COMMAND locally once everything else is done.\n";
+    std::cerr << "        --manifest PATHNAME  Run the tasks in PATHNAME instead of frames.\n";
+    std::cerr << "        --results PATHNAME  Append the result of each task to PATHNAME.\n";
+    std::cerr << "        --exclude FRAMES    Skip these frames (list of items, as above).\n";
+    std::cerr << "        --order ORDER       Order of frames: sequential, reverse, refine, or random\n";
+    std::cerr << "                            [sequential].\n";
+    std::cerr << "        --seed SEED         Seed of the random order [current time].\n";
+    std::cerr << "        --calibrate         Measure each worker with a built-in CPU benchmark.\n";
+    std::cerr << "        --calibrate-frame FRAME  Measure each worker by rendering FRAME.\n";
+    std::cerr << "        --calibration-cache PATHNAME  Where to cache calibrations [~/"
+        << CALIBRATION_CACHE_FILENAME << "].\n";
+    std::cerr << "        --fixed-slots       Use every worker slot instead of tuning them per machine.\n";
+    std::cerr << "        --queue PATHNAME    Keep running jobs submitted to the Unix socket PATHNAME.\n";
+    std::cerr << "\n";
+    std::cerr << "    submit [FLAGS] PATHNAME [CONTROLLER FLAGS] FRAMES EXEC [PARAMETERS...]\n";
+    std::cerr << "        Run a job on the controller whose queue is PATHNAME, and wait for it.\n";
+    std::cerr << "        The rest are as for the controller command.\n";
+    std::cerr << "        --priority PRIORITY  Get workers before jobs of lower PRIORITY [0].\n";
+    std::cerr << "        --weight WEIGHT     Share workers with jobs of the same priority in\n";
+    std::cerr << "                            proportion to WEIGHT [" << DEFAULT_JOB_WEIGHT << "].\n";
     std::cerr << "\n";
     std::cerr << "ENDPOINTs are specified as HOSTNAME:PORT, where in some cases the\n";
     std::cerr << "HOSTNAME or the PORT have a default value.\n";
@@ -115,11 +245,21 @@ int Parameters::parse_arguments(int argc, char *argv[]) {
         m_command = CMD_CONTROLLER;
     } else if (arg == "unittest") {
         m_command = CMD_UNITTEST;
+    } else if (arg == "submit") {
+        m_command = CMD_SUBMIT;
     } else {
         std::cerr << "Command must be the first parameter.\n";
         return 1;
     }
 
+    // Whether --seed was given, rather than seeding from the time.
+    bool has_seed = false;
+
+    // The command line's executable is the first stage.
+    Stage main_stage;
+    main_stage.m_name = MAIN_STAGE;
+    std::string stages_pathname;
+
     while (args.next_is_flag()) {
         arg = args.next();
 
@@ -174,6 +314,330 @@ int Parameters::parse_arguments(int argc, char *argv[]) {
                 std::cerr << "Must specify listen endpoint with --listen flag.\n";
                 return 1;
             }
+        } else if (arg == "--name") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --name flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (args.has_at_least(1)) {
+                m_proxy_name = args.next();
+            } else {
+                std::cerr << "Must specify name with --name flag.\n";
+                return 1;
+            }
+        } else if (arg == "--min-free-memory") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --min-free-memory flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !parse_megabytes(args.next(), m_min_free_memory)) {
+                std::cerr << "Must specify megabytes with --min-free-memory flag.\n";
+                return 1;
+            }
+        } else if (arg == "--dim" || arg == "--seeds") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The " << arg << " flag is only valid for the controller command.\n";
+                return 1;
+            }
+            int64_t count;
+            if (!args.has_at_least(arg == "--dim" ? 2 : 1)) {
+                std::cerr << "Must specify " << (arg == "--dim" ? "name and count" : "count") <<
+                    " with " << arg << " flag.\n";
+                return 1;
+            }
+            std::string name = arg == "--dim" ? args.next() : SEED_PARAMETER;
+            if (!parse_non_negative(args.next(), count) || count == 0) {
+                std::cerr << "Must specify positive count with " << arg << " flag.\n";
+                return 1;
+            }
+            if (name.empty() || name == FRAME_PARAMETER || name == CPUS_PARAMETER ||
+                    name.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") != std::string::npos) {
+
+                std::cerr << "Invalid dimension name: " << name << "\n";
+                return 1;
+            }
+            for (const Dimension &dimension : m_dimensions) {
+                if (dimension.m_name == name) {
+                    std::cerr << "Dimension specified twice: " << name << "\n";
+                    return 1;
+                }
+            }
+            m_dimensions.push_back(Dimension(name, count));
+        } else if (arg == "--merge") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --merge flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !split_words(args.next(), m_merge_command) ||
+                    m_merge_command.empty()) {
+
+                std::cerr << "Must specify command with --merge flag.\n";
+                return 1;
+            }
+            if (!is_pathname_local(m_merge_command[0])) {
+                std::cerr << "Merge executable must be local: " << m_merge_command[0] << "\n";
+                return 1;
+            }
+        } else if (arg == "--post") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --post flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !split_words(args.next(), m_post_command) ||
+                    m_post_command.empty()) {
+
+                std::cerr << "Must specify command with --post flag.\n";
+                return 1;
+            }
+            if (!is_pathname_local(m_post_command[0])) {
+                std::cerr << "Post executable must be local: " << m_post_command[0] << "\n";
+                return 1;
+            }
+        } else if (arg == "--sink") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --sink flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !split_words(args.next(), m_sink_command) ||
+                    m_sink_command.empty()) {
+
+                std::cerr << "Must specify command with --sink flag.\n";
+                return 1;
+            }
+        } else if (arg == "--sink-memory") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --sink-memory flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !parse_megabytes(args.next(), m_sink_memory)) {
+                std::cerr << "Must specify megabytes with --sink-memory flag.\n";
+                return 1;
+            }
+        } else if (arg == "--buffer-memory") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --buffer-memory flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !parse_megabytes(args.next(), m_buffer_memory)) {
+                std::cerr << "Must specify megabytes with --buffer-memory flag.\n";
+                return 1;
+            }
+        } else if (arg == "--timeout-factor") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --timeout-factor flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) ||
+                    !parse_non_negative_double(args.next(), m_timeout_factor)) {
+                std::cerr << "Must specify factor with --timeout-factor flag.\n";
+                return 1;
+            }
+        } else if (arg == "--gather") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --gather flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !split_words(args.next(), m_gather_command) ||
+                    m_gather_command.empty()) {
+
+                std::cerr << "Must specify command with --gather flag.\n";
+                return 1;
+            }
+        } else if (arg == "--stages") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --stages flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1)) {
+                std::cerr << "Must specify pathname with --stages flag.\n";
+                return 1;
+            }
+            stages_pathname = args.next();
+        } else if (arg == "--keep") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --keep flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1)) {
+                std::cerr << "Must specify pathname with --keep flag.\n";
+                return 1;
+            }
+            std::string pathname = args.next();
+            if (!is_pathname_local(pathname) || !string_has_parameter(pathname)) {
+                std::cerr << "Kept pathname must be local and include the frame number: " <<
+                    pathname << "\n";
+                return 1;
+            }
+            main_stage.m_kept.push_back(pathname);
+        } else if (arg == "--final") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --final flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !split_words(args.next(), m_final_command) ||
+                    m_final_command.empty()) {
+
+                std::cerr << "Must specify command with --final flag.\n";
+                return 1;
+            }
+        } else if (arg == "--manifest" || arg == "--results") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The " << arg << " flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1)) {
+                std::cerr << "Must specify pathname with " << arg << " flag.\n";
+                return 1;
+            }
+            (arg == "--manifest" ? m_manifest : m_results) = args.next();
+        } else if (arg == "--exclude") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --exclude flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1)) {
+                std::cerr << "Must specify frames with --exclude flag.\n";
+                return 1;
+            }
+            if (!m_frames.m_exclusions.parse(args.next(), false)) {
+                return 1;
+            }
+        } else if (arg == "--order") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --order flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(1) || !parse_frame_order(args.next(), m_frames.m_order)) {
+                std::cerr << "Must specify sequential, reverse, refine, or random with --order flag.\n";
+                return 1;
+            }
+        } else if (arg == "--seed") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --seed flag is only valid for the controller command.\n";
+                return 1;
+            }
+            int64_t seed;
+            if (args.has_at_least(1) && parse_non_negative(args.next(), seed)) {
+                m_frames.m_seed = seed;
+                has_seed = true;
+            } else {
+                std::cerr << "Must specify non-negative seed with --seed flag.\n";
+                return 1;
+            }
+        } else if (arg == "--early-out") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --early-out flag is only valid for the controller command.\n";
+                return 1;
+            }
+            m_early_out = true;
+        } else if (arg == "--calibrate") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --calibrate flag is only valid for the controller command.\n";
+                return 1;
+            }
+            m_calibrate = true;
+        } else if (arg == "--calibrate-frame") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --calibrate-frame flag is only valid for the controller command.\n";
+                return 1;
+            }
+            int64_t frame;
+            if (args.has_at_least(1) && parse_non_negative(args.next(), frame)) {
+                m_calibrate = true;
+                m_calibration_frame = frame;
+            } else {
+                std::cerr << "Must specify frame with --calibrate-frame flag.\n";
+                return 1;
+            }
+        } else if (arg == "--calibration-cache") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --calibration-cache flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (args.has_at_least(1)) {
+                m_calibration_cache = args.next();
+            } else {
+                std::cerr << "Must specify pathname with --calibration-cache flag.\n";
+                return 1;
+            }
+        } else if (arg == "--server") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --server flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (args.has_at_least(1)) {
+                m_server_key = args.next();
+            }
+            if (m_server_key.empty()) {
+                std::cerr << "Must specify key with --server flag.\n";
+                return 1;
+            }
+        } else if (arg == "--fixed-slots") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --fixed-slots flag is only valid for the controller command.\n";
+                return 1;
+            }
+            m_fixed_slots = true;
+        } else if (arg == "--slots") {
+            if (m_command != CMD_WORKER) {
+                std::cerr << "The --slots flag is only valid for the worker command.\n";
+                return 1;
+            }
+            int64_t slots;
+            if (args.has_at_least(1) && parse_non_negative(args.next(), slots) && slots > 0) {
+                m_slots = slots;
+            } else {
+                std::cerr << "Must specify a positive count with --slots flag.\n";
+                return 1;
+            }
+        } else if (arg == "--pin") {
+            if (m_command != CMD_WORKER) {
+                std::cerr << "The --pin flag is only valid for the worker command.\n";
+                return 1;
+            }
+            m_pin = true;
+        } else if (arg == "--daemon") {
+            if (m_command != CMD_WORKER) {
+                std::cerr << "The --daemon flag is only valid for the worker command.\n";
+                return 1;
+            }
+            m_daemon = true;
+        } else if (arg == "--queue") {
+            if (m_command != CMD_CONTROLLER) {
+                std::cerr << "The --queue flag is only valid for the controller command.\n";
+                return 1;
+            }
+            if (args.has_at_least(1)) {
+                m_queue = args.next();
+            } else {
+                std::cerr << "Must specify pathname with --queue flag.\n";
+                return 1;
+            }
+        } else if (arg == "--priority") {
+            if (m_command != CMD_SUBMIT) {
+                std::cerr << "The --priority flag is only valid for the submit command.\n";
+                return 1;
+            }
+            int64_t priority;
+            if (args.has_at_least(1) && parse_non_negative(args.next(), priority)) {
+                m_priority = priority;
+            } else {
+                std::cerr << "Must specify priority with --priority flag.\n";
+                return 1;
+            }
+        } else if (arg == "--weight") {
+            if (m_command != CMD_SUBMIT) {
+                std::cerr << "The --weight flag is only valid for the submit command.\n";
+                return 1;
+            }
+            int64_t weight;
+            if (args.has_at_least(1) && parse_non_negative(args.next(), weight) && weight > 0) {
+                m_weight = weight;
+            } else {
+                std::cerr << "Must specify a positive weight with --weight flag.\n";
+                return 1;
+            }
         } else if (arg == "--worker-listen") {
             if (m_command != CMD_PROXY) {
                 std::cerr << "The --worker-listen flag is only valid for the proxy command.\n";
@@ -196,12 +660,40 @@ int Parameters::parse_arguments(int argc, char *argv[]) {
                 std::cerr << "Must specify listen endpoint with --controller-listen flag.\n";
                 return 1;
             }
+        } else if (arg == "--share") {
+            if (m_command != CMD_PROXY) {
+                std::cerr << "The --share flag is only valid for the proxy command.\n";
+                return 1;
+            }
+            if (!args.has_at_least(2)) {
+                std::cerr << "Must specify name and weight with --share flag.\n";
+                return 1;
+            }
+            std::string name = args.next();
+            ProxyShare share;
+            if (!parse_proxy_share(args.next(), share)) {
+                std::cerr << "Invalid share for " << name << ": must be WEIGHT[,MIN[,MAX]].\n";
+                return 1;
+            }
+            if (m_proxy_shares.find(name) != m_proxy_shares.end()) {
+                std::cerr << "Share specified twice: " << name << "\n";
+                return 1;
+            }
+            m_proxy_shares[name] = share;
         } else {
             std::cerr << "Unknown flag " << arg << "\n";
             return 1;
         }
     }
 
+    if (has_seed && m_frames.m_order != ORDER_RANDOM) {
+        std::cerr << "The --seed flag is only valid with --order random.\n";
+        return 1;
+    }
+    if (!has_seed) {
+        m_frames.m_seed = time(nullptr);
+    }
+
     // Parse non-flag parameters.
     if (m_command == CMD_WORKER) {
         if (args.has_exactly(1)) {
@@ -215,15 +707,67 @@ int Parameters::parse_arguments(int argc, char *argv[]) {
             std::cerr << "The proxy command takes no parameters.\n";
             return 1;
         }
+    } else if (m_command == CMD_CONTROLLER && !m_queue.empty()) {
+        // Jobs come with their own executable and flags.
+        if (!args.no_more()) {
+            std::cerr << "With --queue, jobs are given to the submit command.\n";
+            return 1;
+        }
+        if (m_calibration_frame != -1) {
+            std::cerr << "The --calibrate-frame flag can't be used with --queue.\n";
+            return 1;
+        }
+
+        set_controller_defaults();
     } else if (m_command == CMD_CONTROLLER) {
-        if (!args.has_at_least(2)) {
+        if (!args.has_at_least(m_manifest.empty() ? 2 : 1)) {
             std::cerr << "The controller command must specify the frames and the program to run.\n";
             return 1;
         }
 
-        // Parse frame range.
-        bool success = m_frames.parse(args.next());
-        if (!success) {
+        set_controller_defaults();
+
+        if (m_manifest.empty()) {
+            // Parse frame range.
+            bool success = m_frames.parse(args.next());
+            if (!success) {
+                return 1;
+            }
+            if (m_frames.m_order != ORDER_SEQUENTIAL && m_frames.m_set.has_files()) {
+                std::cerr << "Frame files can only be used with the sequential order.\n";
+                return 1;
+            }
+        } else {
+            // Tasks have no frame numbers.
+            std::vector<FileCopy> copies = m_in_copies;
+            copies.insert(copies.end(), m_out_copies.begin(), m_out_copies.end());
+            for (const FileCopy &fileCopy : copies) {
+                if (fileCopy.has_parameter()) {
+                    std::cerr << "Copies can't include frame numbers with a manifest: " <<
+                        fileCopy.m_source << " " << fileCopy.m_destination << "\n";
+                    return 1;
+                }
+            }
+            if (m_calibration_frame != -1) {
+                std::cerr << "The --calibrate-frame flag can't be used with a manifest.\n";
+                return 1;
+            }
+            if (!m_dimensions.empty() || !m_gather_command.empty() || !m_merge_command.empty()) {
+                std::cerr << "The --dim, --seeds, --gather, and --merge flags can't be used "
+                    "with a manifest.\n";
+                return 1;
+            }
+        }
+
+        // Calibration runs the executable on its own, without a server.
+        if (!m_server_key.empty() && m_calibration_frame != -1) {
+            std::cerr << "The --server flag can't be used with --calibrate-frame.\n";
+            return 1;
+        }
+
+        // The post command changes outputs after they'd have been sent.
+        if (m_early_out && !m_post_command.empty()) {
+            std::cerr << "The --early-out flag can't be used with --post.\n";
             return 1;
         }
 
@@ -236,6 +780,140 @@ int Parameters::parse_arguments(int argc, char *argv[]) {
 
         // Eat up the rest.
         args.fill_from_rest(m_arguments);
+
+        // Stages of each frame.
+        if (!stages_pathname.empty()) {
+            if (!m_manifest.empty() || !m_dimensions.empty()) {
+                std::cerr << "The --stages flag can't be used with --manifest, --dim, or --seeds.\n";
+                return 1;
+            }
+            m_stages.push_back(main_stage);
+            if (!load_stages(stages_pathname, m_stages)) {
+                return 1;
+            }
+        } else if (!main_stage.m_kept.empty()) {
+            std::cerr << "The --keep flag is only useful with --stages.\n";
+            return 1;
+        }
+
+        // The sink gets the one output of each frame.
+        if (!m_sink_command.empty()) {
+            int copy_count = 0;
+            for (const FileCopy &fileCopy : m_out_copies) {
+                if (fileCopy.has_parameter()) {
+                    copy_count++;
+                }
+            }
+            if (!m_manifest.empty() || copy_count != 1) {
+                std::cerr << "The --sink flag needs frames and exactly one per-frame --out copy.\n";
+                return 1;
+            }
+            if (get_tile_count() != (m_merge_command.empty() ? 1 : get_seed_count()) ||
+                    !m_gather_command.empty()) {
+
+                std::cerr << "The --sink flag can't be used with --dim, --gather, or "
+                    "--seeds without --merge.\n";
+                return 1;
+            }
+        }
+
+        // Seed passes are merged into each per-frame output.
+        if (!m_merge_command.empty()) {
+            if (get_seed_count() == 1) {
+                std::cerr << "The --merge flag needs more than one seed (--seeds).\n";
+                return 1;
+            }
+
+            std::vector<const FileCopy *> copies;
+            for (const FileCopy &fileCopy : m_out_copies) {
+                if (fileCopy.has_parameter()) {
+                    copies.push_back(&fileCopy);
+                }
+            }
+            if (copies.size() != 1) {
+                std::cerr << "The --merge flag needs exactly one per-frame --out copy.\n";
+                return 1;
+            }
+
+            // Passes stay on the workers, so their remote pathnames must be
+            // unique. The local pathname is the merged result.
+            std::vector<std::string> names = { FRAME_PARAMETER };
+            for (const Dimension &dimension : m_dimensions) {
+                names.push_back(dimension.m_name);
+            }
+            for (const std::string &name : names) {
+                std::map<std::string, int> values0 = get_parameter_values(0, 0);
+                std::map<std::string, int> values1 = values0;
+                values1[name] = 1;
+                bool source_varies = substitute_parameters(copies[0]->m_source, values0) !=
+                    substitute_parameters(copies[0]->m_source, values1);
+                bool destination_varies =
+                    substitute_parameters(copies[0]->m_destination, values0) !=
+                    substitute_parameters(copies[0]->m_destination, values1);
+
+                if (name == SEED_PARAMETER ? destination_varies || !source_varies :
+                        destination_varies && !source_varies) {
+
+                    std::cerr << "With --merge, the remote pathname of the --out copy must "
+                        "include %{seed} and every parameter of the local pathname, and the "
+                        "local pathname must not include %{seed}.\n";
+                    return 1;
+                }
+            }
+        }
+
+        // Catch misspelled dimension names. Commands run on the worker can
+        // also have the CPUs it runs them on.
+        if (m_manifest.empty()) {
+            std::map<std::string, int> values = get_parameter_values(0, 0);
+            std::map<std::string, int> worker_values = values;
+            worker_values[CPUS_PARAMETER] = 0;
+            std::vector<std::string> worker_strings = m_arguments;
+            worker_strings.insert(worker_strings.end(), m_merge_command.begin(), m_merge_command.end());
+            worker_strings.insert(worker_strings.end(), m_post_command.begin(), m_post_command.end());
+            std::vector<std::string> strings = m_gather_command;
+            strings.push_back(m_server_key);
+            for (const Stage &stage : m_stages) {
+                worker_strings.insert(worker_strings.end(),
+                        stage.m_arguments.begin(), stage.m_arguments.end());
+                strings.insert(strings.end(), stage.m_kept.begin(), stage.m_kept.end());
+                for (const FileCopy &fileCopy : stage.m_in_copies) {
+                    strings.push_back(fileCopy.m_source);
+                    strings.push_back(fileCopy.m_destination);
+                }
+                for (const FileCopy &fileCopy : stage.m_out_copies) {
+                    strings.push_back(fileCopy.m_source);
+                    strings.push_back(fileCopy.m_destination);
+                }
+            }
+            for (const FileCopy &fileCopy : m_in_copies) {
+                strings.push_back(fileCopy.m_source);
+                strings.push_back(fileCopy.m_destination);
+            }
+            for (const FileCopy &fileCopy : m_out_copies) {
+                strings.push_back(fileCopy.m_source);
+                strings.push_back(fileCopy.m_destination);
+            }
+            for (const std::string &str : strings) {
+                if (string_has_parameter(substitute_parameters(str, values))) {
+                    std::cerr << "Unknown parameter in: " << str << "\n";
+                    return 1;
+                }
+            }
+            for (const std::string &str : worker_strings) {
+                if (string_has_parameter(substitute_parameters(str, worker_values))) {
+                    std::cerr << "Unknown parameter in: " << str << "\n";
+                    return 1;
+                }
+            }
+        }
+    } else if (m_command == CMD_SUBMIT) {
+        if (!args.has_at_least(1)) {
+            std::cerr << "The submit command must specify the queue and the job.\n";
+            return 1;
+        }
+        m_queue = args.next();
+        args.fill_from_rest(m_job_arguments);
     } else if (m_command == CMD_UNITTEST) {
         if (!args.no_more()) {
             std::cerr << "The unittest command takes no parameters.\n";
@@ -248,3 +926,66 @@ int Parameters::parse_arguments(int argc, char *argv[]) {
     return 0;
 }
 
+void Parameters::set_controller_defaults() {
+    // Default calibration cache is in the home directory.
+    if (m_calibration_cache.empty()) {
+        const char *home = getenv("HOME");
+        if (home != nullptr) {
+            m_calibration_cache = std::string(home) + "/" + CALIBRATION_CACHE_FILENAME;
+        }
+    }
+
+    // Claim proxy workers as the user, by default.
+    if (m_proxy_name.empty()) {
+        const char *user = getenv("USER");
+        m_proxy_name = user != nullptr ? user : DEFAULT_PROXY_NAME;
+    }
+}
+
+int Parameters::parse_job(const std::vector<std::string> &arguments) {
+    std::vector<std::string> words = { "distray", "controller" };
+    words.insert(words.end(), arguments.begin(), arguments.end());
+
+    std::vector<char *> argv;
+    for (std::string &word : words) {
+        argv.push_back(&word[0]);
+    }
+    argv.push_back(nullptr);
+
+    return parse_arguments(words.size(), argv.data());
+}
+
+int Parameters::get_tile_count() const {
+    int count = 1;
+
+    for (const Dimension &dimension : m_dimensions) {
+        count *= dimension.m_count;
+    }
+
+    return count;
+}
+
+int Parameters::get_seed_count() const {
+    for (const Dimension &dimension : m_dimensions) {
+        if (dimension.m_name == SEED_PARAMETER) {
+            return dimension.m_count;
+        }
+    }
+
+    return 1;
+}
+
+std::map<std::string, int> Parameters::get_parameter_values(int frame, int tile) const {
+    std::map<std::string, int> values;
+
+    values[FRAME_PARAMETER] = frame;
+
+    // Last dimension varies fastest.
+    for (int i = m_dimensions.size() - 1; i >= 0; i--) {
+        const Dimension &dimension = m_dimensions[i];
+        values[dimension.m_name] = tile % dimension.m_count;
+        tile /= dimension.m_count;
+    }
+
+    return values;
+}
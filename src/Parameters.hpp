@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <vector>
+#include <map>
 
 #include "Frames.hpp"
 #include "util.hpp"
@@ -11,6 +12,27 @@
 static const int DEFAULT_WORKER_PORT = 1120;
 static const int DEFAULT_CONTROLLER_PORT = 1121;
 
+// Don't give frames to machines with less free memory than this.
+static const int DEFAULT_MIN_FREE_MEMORY_MB = 256;
+
+// Frames held in memory for the sink before they're written to disk.
+static const int DEFAULT_SINK_MEMORY_MB = 1024;
+
+// Memory for buffers of messages to and from workers.
+static const int DEFAULT_BUFFER_MEMORY_MB = 1024;
+
+// Frames that take this many times longer than most are moved to another worker.
+static const double DEFAULT_TIMEOUT_FACTOR = 3;
+
+// Weight of a submitted job among jobs of the same priority.
+static const int DEFAULT_JOB_WEIGHT = 1;
+
+// Name a controller claims proxy workers under if $USER isn't set.
+static const char DEFAULT_PROXY_NAME[] = "default";
+
+// Name of the calibration cache file in the home directory.
+static const char CALIBRATION_CACHE_FILENAME[] = ".distray_calibration";
+
 // Command that we're running.
 enum Command {
     CMD_UNSPECIFIED,
@@ -18,6 +40,7 @@ enum Command {
     CMD_PROXY,
     CMD_CONTROLLER,
     CMD_UNITTEST,
+    CMD_SUBMIT,
 };
 
 // A file copy (in or out).
@@ -40,6 +63,75 @@ struct FileCopy {
     }
 };
 
+// An extra axis of the job space, such as tiles across a frame. Each frame
+// is split into one task per combination of dimension values.
+struct Dimension {
+    // Name used in substitutions, like "tx" for "%{tx}".
+    std::string m_name;
+
+    // Values go from 0 to m_count - 1.
+    int m_count;
+
+    Dimension(const std::string &name, int count)
+        : m_name(name), m_count(count) {
+
+        // Nothing.
+    }
+};
+
+// The claim of controllers with a name on the workers of a proxy.
+struct ProxyShare {
+    // Names get workers in proportion to their weights.
+    int m_weight;
+
+    // Workers the name gets before names at or above their minimum, and
+    // the most it gets (-1 for no limit).
+    int m_min_workers;
+    int m_max_workers;
+
+    ProxyShare()
+        : m_weight(1), m_min_workers(0), m_max_workers(-1) {
+
+        // Nothing.
+    }
+};
+
+// A stage depends on another stage having finished a window of frames
+// around its own frame.
+struct Dependency {
+    // Index of the stage in Parameters::m_stages.
+    int m_stage;
+
+    // Window of frames, relative to the dependent's frame. Frames that
+    // aren't rendered are ignored.
+    int m_low;
+    int m_high;
+};
+
+// A step of each frame's processing, such as denoising or conversion, that
+// runs on a worker once the stages it depends on are done for that frame.
+struct Stage {
+    std::string m_name;
+    std::vector<Dependency> m_dependencies;
+
+    // Executable on the worker and its arguments, before substitution.
+    std::string m_executable;
+    std::vector<std::string> m_arguments;
+
+    // Copies done for each frame of this stage.
+    std::vector<FileCopy> m_in_copies;
+    std::vector<FileCopy> m_out_copies;
+
+    // Remote files left on the worker for stages that depend on this one.
+    std::vector<std::string> m_kept;
+};
+
+// Name of the stage for the executable on the command line.
+static const char MAIN_STAGE[] = "main";
+
+// Name of the dimension for independent sample passes of a frame.
+static const char SEED_PARAMETER[] = "seed";
+
 // All command-line parameters.
 class Parameters {
 public:
@@ -53,22 +145,135 @@ public:
     Endpoint m_worker_endpoint;
     Endpoint m_controller_endpoint;
 
+    // For CMD_PROXY: shares of controller names. Names not listed get the
+    // default share.
+    std::map<std::string, ProxyShare> m_proxy_shares;
+
+    // For CMD_CONTROLLER: name to claim proxy workers under.
+    std::string m_proxy_name;
+
     // For CMD_CONTROLLER.
     std::vector<Endpoint> m_proxy_endpoints;
     std::vector<FileCopy> m_in_copies;
     std::vector<FileCopy> m_out_copies;
     Frames m_frames;
+
+    // Extra dimensions of the job space, in order (the last varies fastest).
+    std::vector<Dimension> m_dimensions;
+
+    // Command to run on the worker after each task's executable, before
+    // copying out, already split into words. Empty for none.
+    std::vector<std::string> m_post_command;
+
+    // Command to run locally once all tasks of a frame are done, already
+    // split into words. Empty for none.
+    std::vector<std::string> m_gather_command;
+
+    // Command to run on a worker to merge two seed passes of a frame,
+    // already split into words. Empty for none.
+    std::vector<std::string> m_merge_command;
+
+    // Stages of each frame. The first is the command line's executable, and
+    // only its name and kept files are used. Empty unless there's a stages file.
+    std::vector<Stage> m_stages;
+
+    // Command to run locally with each frame's output piped to its standard
+    // input, in frame order, already split into words. Empty for none.
+    std::vector<std::string> m_sink_command;
+
+    // Bytes of frames the sink holds in memory while waiting for earlier frames.
+    int64_t m_sink_memory;
+
+    // Bytes of buffers for messages to and from workers.
+    int64_t m_buffer_memory;
+
+    // Frames that take this many times longer than most are moved to
+    // another worker, or never if 0.
+    double m_timeout_factor;
+
+    // If not empty, the executable stays running on each worker as a server
+    // while this key, with parameters substituted, stays the same, and gets
+    // its tasks on its standard input.
+    std::string m_server_key;
+
+    // Command to run locally once everything else is done, already split
+    // into words. Empty for none.
+    std::vector<std::string> m_final_command;
+
+    // Manifest of tasks to run instead of frames, or empty for frames.
+    std::string m_manifest;
+
+    // File to write the result of each task to, or empty for none.
+    std::string m_results;
+
     std::string m_executable;
     std::vector<std::string> m_arguments;
+    int64_t m_min_free_memory;
+
+    // Whether workers send per-frame outputs as soon as the executable
+    // closes them, instead of after it exits.
+    bool m_early_out;
+
+    // Whether to measure the speed of each worker. The frame is -1 for the
+    // built-in benchmark.
+    bool m_calibrate;
+    int m_calibration_frame;
+    std::string m_calibration_cache;
+
+    // Whether to give a task to every idle worker, instead of tuning how
+    // many tasks run at once on each machine.
+    bool m_fixed_slots;
+
+    // Number of tasks a worker runs at once, each with its own connection.
+    int m_slots;
+
+    // Whether each worker slot keeps to its own CPUs and NUMA node.
+    bool m_pin;
+
+    // Whether the worker reconnects when it can't connect or the job is done.
+    bool m_daemon;
+
+    // Unix socket of the controller's job queue, or empty to run one job.
+    // For CMD_CONTROLLER and CMD_SUBMIT.
+    std::string m_queue;
+
+    // For CMD_SUBMIT: the controller arguments of the job, its priority,
+    // and its weight among jobs of the same priority (see FairShare).
+    std::vector<std::string> m_job_arguments;
+    int m_priority;
+    int m_weight;
 
     Parameters()
-        : m_command(CMD_UNSPECIFIED) {
+        : m_command(CMD_UNSPECIFIED),
+            m_sink_memory(DEFAULT_SINK_MEMORY_MB*1024LL*1024),
+            m_buffer_memory(DEFAULT_BUFFER_MEMORY_MB*1024LL*1024),
+            m_timeout_factor(DEFAULT_TIMEOUT_FACTOR),
+            m_min_free_memory(DEFAULT_MIN_FREE_MEMORY_MB*1024LL*1024), m_early_out(false),
+            m_calibrate(false), m_calibration_frame(-1), m_fixed_slots(false), m_slots(1),
+            m_pin(false), m_daemon(false), m_priority(0), m_weight(DEFAULT_JOB_WEIGHT) {
 
         // Nothing.
     }
 
+    // Number of tasks each frame is split into. Always at least 1.
+    int get_tile_count() const;
+
+    // Number of seed passes each frame is split into. Always at least 1.
+    int get_seed_count() const;
+
+    // Values of all parameters for a tile (0 to get_tile_count() - 1) of a frame.
+    std::map<std::string, int> get_parameter_values(int frame, int tile) const;
+
     void usage() const;
     int parse_arguments(int argc, char *argv[]);
+
+    // Parse the controller arguments of a submitted job, flags first.
+    // Returns 0 on success, otherwise the program exit status.
+    int parse_job(const std::vector<std::string> &arguments);
+
+private:
+    // Fill in controller flags whose defaults come from the environment.
+    void set_controller_defaults();
 };
 
 #endif // PARAMETERS_HPP
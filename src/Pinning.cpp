@@ -0,0 +1,78 @@
+
+#include <iostream>
+#include <cstdio>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "Pinning.hpp"
+
+Placement place_slot(const std::vector<NumaNode> &nodes, int slot, int slot_count) {
+    Placement placement;
+    int node_count = nodes.size();
+
+    if (slot_count < node_count) {
+        // Whole nodes.
+        for (int i = slot*node_count/slot_count; i < (slot + 1)*node_count/slot_count; i++) {
+            placement.m_cpus.insert(placement.m_cpus.end(),
+                    nodes[i].m_cpus.begin(), nodes[i].m_cpus.end());
+            placement.m_nodes.push_back(nodes[i].m_id);
+        }
+        return placement;
+    }
+
+    // Round-robin across nodes, then a contiguous share of the node's CPUs.
+    // Slots share CPUs only if there are more slots than CPUs.
+    const NumaNode &node = nodes[slot % node_count];
+    int node_slot_count = (slot_count - slot % node_count + node_count - 1)/node_count;
+    int index = slot/node_count;
+    int cpu_count = node.m_cpus.size();
+    int begin = index*cpu_count/node_slot_count;
+    int end = (index + 1)*cpu_count/node_slot_count;
+    if (begin == end) {
+        placement.m_cpus.push_back(node.m_cpus[begin % cpu_count]);
+    } else {
+        placement.m_cpus.assign(node.m_cpus.begin() + begin, node.m_cpus.begin() + end);
+    }
+    placement.m_nodes.push_back(node.m_id);
+
+    return placement;
+}
+
+bool pin_to_placement(const Placement &placement) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : placement.m_cpus) {
+        CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        perror("sched_setaffinity");
+        return false;
+    }
+
+    // Prefer the node's memory rather than insisting on it, so that a
+    // frame that needs more than the node has doesn't fail.
+    if (placement.m_nodes.size() == 1) {
+        unsigned long mask[16] = { 0 };
+        int id = placement.m_nodes[0];
+        int bits = 8*sizeof(unsigned long);
+        if (id < 16*bits) {
+            mask[id/bits] |= 1UL << (id % bits);
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, 16*bits) == -1) {
+                perror("set_mempolicy");
+                return false;
+            }
+        }
+    }
+
+    return true;
+#else
+    std::cerr << "Pinning is only available on Linux.\n";
+    return false;
+#endif
+}
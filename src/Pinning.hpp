@@ -0,0 +1,24 @@
+#ifndef PINNING_HPP
+#define PINNING_HPP
+
+#include <vector>
+
+#include "sysinfo.hpp"
+
+// Where a worker slot runs: its CPUs, and its NUMA node IDs.
+struct Placement {
+    std::vector<int> m_cpus;
+    std::vector<int> m_nodes;
+};
+
+// Place slot (0 to slot_count - 1) on the machine's NUMA nodes, which must
+// not be empty. Slots are spread across nodes, and each gets its own share of
+// its node's CPUs. With fewer slots than nodes, each slot gets whole nodes.
+Placement place_slot(const std::vector<NumaNode> &nodes, int slot, int slot_count);
+
+// Keep this process and the processes it starts on the placement's CPUs,
+// and have them allocate memory on its node if it has just one. Returns
+// whether successful.
+bool pin_to_placement(const Placement &placement);
+
+#endif // PINNING_HPP
@@ -1,6 +1,8 @@
 
 #include "RemoteWorker.hpp"
 
+int RemoteWorker::s_next_id = 0;
+
 void RemoteWorker::dispatch() {
     do {
         // std::cout << "RemoteWorker: state = " << m_state << "\n";
@@ -15,11 +17,19 @@ void RemoteWorker::dispatch() {
             }
 
             case RECEIVE_WELCOME_RESPONSE: {
-                Drp::Response response;
-                receive_response(response, Drp::WELCOME);
-                m_hostname = response.welcome_response().hostname();
+                Drp::Response &response = receive_response(Drp::WELCOME);
+                const Drp::WelcomeResponse &welcome_response = response.welcome_response();
+                m_hostname = welcome_response.hostname();
+                m_core_count = welcome_response.core_count();
+                m_memory_size = welcome_response.memory_size();
+                m_numa_node_count = welcome_response.numa_node_count();
+                m_cpu_model = welcome_response.cpu_model();
                 std::cout << "hostname: " << m_hostname <<
-                    ", cores: " << response.welcome_response().core_count() << "\n";
+                    ", cores: " << m_core_count <<
+                    ", memory: " << m_memory_size/(1024*1024) << " MB" <<
+                    ", NUMA nodes: " << m_numa_node_count <<
+                    ", CPU: " << (m_cpu_model.empty() ? "unknown" : m_cpu_model) <<
+                    ", load: " << m_load_average << "\n";
                 // We're no longer unused as a proxy connection:
                 m_proxy_index = -1;
                 m_state_index = 0;
@@ -28,39 +38,126 @@ void RemoteWorker::dispatch() {
             }
 
             case SEND_COPY_IN_NON_FRAME_FILE: {
-                copy_file_in(-1, RECEIVE_COPY_IN_NON_FRAME_FILE, IDLE);
+                copy_file_in(m_job_in_copies, RECEIVE_COPY_IN_NON_FRAME_FILE, START_CALIBRATION,
+                        true);
                 break;
             }
 
             case RECEIVE_COPY_IN_NON_FRAME_FILE: {
-                Drp::Response response;
-                receive_response(response, Drp::COPY_IN);
+                Drp::Response &response = receive_response(Drp::COPY_IN);
                 if (!response.copy_in_response().success()) {
                     std::cerr << "Error: Failed to copy file.\n";
-                    exit(-1);
+                    fail(true);
+                    break;
                 }
                 m_state_index++;
                 m_state = SEND_COPY_IN_NON_FRAME_FILE;
                 break;
             }
 
+            case START_CALIBRATION: {
+                if (!m_parameters->m_calibrate) {
+                    m_state = IDLE;
+                    break;
+                }
+
+                m_calibration_seconds = m_calibration.get_seconds(m_hostname, get_benchmark());
+                if (m_calibration_seconds > 0) {
+                    std::cout << "Using cached calibration for " << m_hostname << ": " <<
+                        m_calibration_seconds << " seconds\n";
+                    m_state = IDLE;
+                } else if (m_parameters->m_calibration_frame == -1) {
+                    m_state = SEND_CALIBRATE_REQUEST;
+                } else {
+                    m_calibration_task = make_frame_task(*m_parameters,
+                            m_parameters->m_calibration_frame, 0);
+                    m_state_index = 0;
+                    m_state = SEND_COPY_IN_CALIBRATION_FILE;
+                }
+                break;
+            }
+
+            case SEND_COPY_IN_CALIBRATION_FILE: {
+                copy_file_in(m_calibration_task.m_in_copies, RECEIVE_COPY_IN_CALIBRATION_FILE,
+                        SEND_CALIBRATE_REQUEST, true);
+                break;
+            }
+
+            case RECEIVE_COPY_IN_CALIBRATION_FILE: {
+                Drp::Response &response = receive_response(Drp::COPY_IN);
+                if (!response.copy_in_response().success()) {
+                    std::cerr << "Error: Failed to copy file.\n";
+                    fail(true);
+                    break;
+                }
+                m_state_index++;
+                m_state = SEND_COPY_IN_CALIBRATION_FILE;
+                break;
+            }
+
+            case SEND_CALIBRATE_REQUEST: {
+                Drp::Request request;
+                request.set_request_type(Drp::CALIBRATE);
+                Drp::CalibrateRequest *calibrate_request = request.mutable_calibrate_request();
+                if (m_parameters->m_calibration_frame != -1) {
+                    fill_execute_request(*calibrate_request->mutable_execute_request(),
+                            m_calibration_task);
+                }
+                std::cout << "Calibrating " << m_hostname << "\n";
+                send_request(request, RECEIVE_CALIBRATE_RESPONSE);
+                break;
+            }
+
+            case RECEIVE_CALIBRATE_RESPONSE: {
+                Drp::Response &response = receive_response(Drp::CALIBRATE);
+                const Drp::CalibrateResponse &calibrate_response = response.calibrate_response();
+                if (calibrate_response.status() != 0 || calibrate_response.seconds() <= 0) {
+                    std::cerr << "Error: Failed to calibrate " << m_hostname << " (status " <<
+                        calibrate_response.status() << "), dropping it.\n";
+                    fail(false);
+                    break;
+                }
+                std::string benchmark = get_benchmark();
+                m_calibration_seconds = calibrate_response.seconds();
+                m_calibration.set_seconds(m_hostname, benchmark, m_calibration_seconds);
+                std::cout << "Calibrated " << m_hostname << ": " << m_calibration_seconds <<
+                    " seconds, speed factor " <<
+                    m_calibration.get_speed_factor(benchmark, m_calibration_seconds) << "\n";
+                m_state = IDLE;
+                break;
+            }
+
             case IDLE: {
                 // We're never dispatched in idle mode.
                 std::cerr << "Should not be in IDLE.\n";
                 exit(1);
             }
 
+            case SEND_STATUS_REQUEST: {
+                Drp::Request request;
+                request.set_request_type(Drp::STATUS);
+                send_request(request, RECEIVE_STATUS_RESPONSE);
+                break;
+            }
+
+            case RECEIVE_STATUS_RESPONSE: {
+                receive_response(Drp::STATUS);
+                m_state = IDLE;
+                break;
+            }
+
             case SEND_COPY_IN_FRAME_FILE: {
-                copy_file_in(m_frame, RECEIVE_COPY_IN_FRAME_FILE, SEND_EXECUTE_REQUEST);
+                copy_file_in(m_task.m_in_copies, RECEIVE_COPY_IN_FRAME_FILE, SEND_EXECUTE_REQUEST,
+                        false);
                 break;
             }
 
             case RECEIVE_COPY_IN_FRAME_FILE: {
-                Drp::Response response;
-                receive_response(response, Drp::COPY_IN);
+                Drp::Response &response = receive_response(Drp::COPY_IN);
                 if (!response.copy_in_response().success()) {
                     std::cerr << "Error: Failed to copy file.\n";
-                    exit(-1);
+                    fail(true);
+                    break;
                 }
                 m_state_index++;
                 m_state = SEND_COPY_IN_FRAME_FILE;
@@ -68,45 +165,138 @@ void RemoteWorker::dispatch() {
             }
 
             case SEND_EXECUTE_REQUEST: {
+                if (m_task.m_copy_only) {
+                    m_state = SEND_COPY_OUT_FRAME_FILE;
+                    m_state_index = 0;
+                    break;
+                }
+
                 Drp::Request request;
                 request.set_request_type(Drp::EXECUTE);
                 Drp::ExecuteRequest *execute_request = request.mutable_execute_request();
-                execute_request->set_executable(m_parameters.m_executable);
-                for (std::string argument : m_parameters.m_arguments) {
-                    execute_request->add_argument(substitute_parameter(argument, m_frame));
+                fill_execute_request(*execute_request, m_task);
+                if (m_parameters->m_early_out) {
+                    for (const FileCopy &fileCopy : m_task.m_out_copies) {
+                        execute_request->add_early_out_pathname(fileCopy.m_source);
+                    }
                 }
+                execute_request->set_heartbeat_interval(HEARTBEAT_INTERVAL_S);
                 send_request(request, RECEIVE_EXECUTE_RESPONSE);
                 break;
             }
 
             case RECEIVE_EXECUTE_RESPONSE: {
-                Drp::Response response;
-                receive_response(response, Drp::EXECUTE);
-                int status = response.execute_response().status();
-                if (status != 0) {
-                    std::cerr << "Error: Failed to execute program (status " << status << ").\n";
-                    exit(-1);
+                Drp::Response &response = receive_response(Drp::EXECUTE, true);
+                if (response.request_type() == Drp::HEARTBEAT) {
+                    m_task_cpu_seconds = response.heartbeat_response().cpu_seconds();
+                    break;
+                }
+                if (response.request_type() == Drp::COPY_OUT) {
+                    // An output sent while the executable is still running.
+                    handle_early_copy_out_response(response);
+                    break;
+                }
+                if (response.request_type() == Drp::COPY_IN) {
+                    handle_prefetch_response(response);
+                    send_while_executing();
+                    break;
+                }
+                if (response.request_type() == Drp::CANCEL) {
+                    // The EXECUTE response follows.
+                    m_cancel_sent = false;
+                    break;
+                }
+                m_task_status = response.execute_response().status();
+                m_task_cancelled = response.execute_response().cancelled();
+                m_task_usage = response.execute_response().usage();
+                State next_state;
+                if (m_task_cancelled) {
+                    // Someone else will do it.
+                    next_state = IDLE;
+                } else if (m_task_status != 0) {
+                    // Report the failure and let the controller decide what
+                    // to do. Outputs probably don't exist, so don't copy them.
+                    next_state = IDLE;
+                } else {
+                    next_state = SEND_COPY_OUT_FRAME_FILE;
+                    m_state_index = 0;
+                }
+                // Too late to cancel if we haven't asked yet.
+                m_cancelling = false;
+                stop_prefetch();
+                if (has_late_responses()) {
+                    m_after_late_state = next_state;
+                    m_state = RECEIVE_LATE_RESPONSES;
+                } else {
+                    m_state = next_state;
+                }
+                break;
+            }
+
+            case RECEIVE_LATE_RESPONSES: {
+                Drp::Response &response = receive_response(
+                        m_prefetch_sent ? Drp::COPY_IN : Drp::CANCEL, true);
+                if (response.request_type() == Drp::COPY_IN) {
+                    handle_prefetch_response(response);
+                    m_prefetch_copies.clear();
+                    m_prefetch_index = 0;
+                } else if (response.request_type() == Drp::CANCEL) {
+                    m_cancel_sent = false;
+                } else {
+                    std::cout << "Got response type " << response.request_type() <<
+                        " after the executable was done\n";
+                    exit(1);
+                }
+                if (!has_late_responses()) {
+                    m_state = m_after_late_state;
                 }
-                m_state = SEND_COPY_OUT_FRAME_FILE;
-                m_state_index = 0;
                 break;
             }
 
             case SEND_COPY_OUT_FRAME_FILE: {
-                copy_file_out(m_frame, RECEIVE_COPY_OUT_FRAME_FILE, IDLE);
+                // Skip files that were already sent while executing.
+                while (m_state_index < m_task.m_out_copies.size() &&
+                        m_early_copies.find(m_state_index) != m_early_copies.end()) {
+
+                    m_state_index++;
+                }
+                copy_file_out(m_task.m_out_copies, RECEIVE_COPY_OUT_FRAME_FILE,
+                        SEND_REMOVE_REQUEST);
                 break;
             }
 
             case RECEIVE_COPY_OUT_FRAME_FILE: {
-                Drp::Response response;
-                receive_response(response, Drp::COPY_OUT);
-                handle_copy_file_out_response(response, m_frame,
-                        m_parameters.m_out_copies[m_state_index]);
+                Drp::Response &response = receive_response(Drp::COPY_OUT);
+                handle_copy_file_out_response(response, m_state_index);
+                if (m_state == FAILED) {
+                    break;
+                }
                 m_state_index++;
                 m_state = SEND_COPY_OUT_FRAME_FILE;
                 break;
             }
 
+            case SEND_REMOVE_REQUEST: {
+                if (m_task.m_remove_pathnames.empty()) {
+                    m_state = IDLE;
+                    break;
+                }
+
+                Drp::Request request;
+                request.set_request_type(Drp::REMOVE);
+                for (const std::string &pathname : m_task.m_remove_pathnames) {
+                    request.mutable_remove_request()->add_pathname(pathname);
+                }
+                send_request(request, RECEIVE_REMOVE_RESPONSE);
+                break;
+            }
+
+            case RECEIVE_REMOVE_RESPONSE: {
+                receive_response(Drp::REMOVE);
+                m_state = IDLE;
+                break;
+            }
+
             case SEND_COPY_OUT_NON_FRAME_FILE: {
                 // XXX implement.
                 break;
@@ -121,77 +311,345 @@ void RemoteWorker::dispatch() {
                 // XXX implement.
                 break;
             }
+
+            case FAILED: {
+                // The controller drops us.
+                break;
+            }
         }
 
-        // List of states that need immediate action:
-    } while (m_state == SEND_WELCOME_REQUEST
+        // List of states that need immediate action, unless we're waiting
+        // for the disk:
+    } while (!m_waiting_for_disk && !m_waiting_for_memory && (m_state == SEND_WELCOME_REQUEST
+            || m_state == SEND_STATUS_REQUEST
             || m_state == SEND_COPY_IN_NON_FRAME_FILE
+            || m_state == START_CALIBRATION
+            || m_state == SEND_COPY_IN_CALIBRATION_FILE
+            || m_state == SEND_CALIBRATE_REQUEST
             || m_state == SEND_COPY_IN_FRAME_FILE
             || m_state == SEND_EXECUTE_REQUEST
             || m_state == SEND_COPY_OUT_FRAME_FILE
-            || m_state == SEND_COPY_OUT_NON_FRAME_FILE);
-}
+            || m_state == SEND_REMOVE_REQUEST
+            || m_state == SEND_COPY_OUT_NON_FRAME_FILE));
 
-void RemoteWorker::copy_file_in(int frame, State receive_state, State next_state) {
-    if (m_state_index < m_parameters.m_in_copies.size()) {
-        const FileCopy &fileCopy = m_parameters.m_in_copies[m_state_index];
-        if ((frame >= 0) == fileCopy.has_parameter()) {
-            // Send file.
-            Drp::Request request;
-            request.set_request_type(Drp::COPY_IN);
-            Drp::CopyInRequest *copy_in_request = request.mutable_copy_in_request();
-            std::string source_pathname = substitute_parameter(fileCopy.m_source, frame);
-            std::string destination_pathname = substitute_parameter(fileCopy.m_destination, frame);
-            std::cout << "Copying in " << source_pathname << " to " << destination_pathname << "\n";
-            copy_in_request->set_pathname(destination_pathname);
-            try {
-                copy_in_request->set_content(read_file(source_pathname));
-            } catch (std::runtime_error e) {
-                std::cerr << "Error reading file " << source_pathname << "\n";
-                exit(-1);
-            }
-            send_request(request, receive_state);
+    // See if we just finished a task.
+    if (m_state == IDLE && m_has_task) {
+        if (m_task_cancelled) {
+            m_cancelled_task = std::move(m_task);
+            m_has_cancelled_task = true;
         } else {
+            m_completed_task = std::move(m_task);
+            m_completed_status = m_task_status;
+            m_completed_seconds = get_task_elapsed();
+            m_completed_usage = m_task_usage;
+            m_has_completed_task = true;
+        }
+        m_has_task = false;
+    }
+
+    // Run the task we loaded the job for.
+    if (m_state == IDLE && m_has_pending_task) {
+        m_has_pending_task = false;
+        run_task(m_pending_task);
+    }
+}
+
+std::string RemoteWorker::get_benchmark() const {
+    if (m_parameters->m_calibration_frame == -1) {
+        return BUILTIN_BENCHMARK;
+    }
+
+    // Identify the frame by its full command line.
+    std::string benchmark = m_parameters->m_executable;
+    for (const std::string &argument :
+            make_frame_task(*m_parameters, m_parameters->m_calibration_frame, 0).m_arguments) {
+
+        benchmark += " " + argument;
+    }
+
+    return benchmark;
+}
+
+void RemoteWorker::fill_execute_request(Drp::ExecuteRequest &execute_request,
+        const Task &task) const {
+
+    execute_request.set_executable(task.m_executable.empty() ?
+            m_parameters->m_executable : task.m_executable);
+    for (const std::string &argument : task.m_arguments) {
+        execute_request.add_argument(argument);
+    }
+    if (!task.m_server_key.empty()) {
+        execute_request.set_server_key(task.m_server_key);
+    }
+
+    if (!task.m_post_command.empty()) {
+        Drp::ExecuteRequest *post_request = execute_request.mutable_post_request();
+        post_request->set_executable(task.m_post_command[0]);
+        for (int i = 1; i < task.m_post_command.size(); i++) {
+            post_request->add_argument(task.m_post_command[i]);
+        }
+    }
+}
+
+void RemoteWorker::copy_file_in(const std::vector<FileCopy> &copies,
+        State receive_state, State next_state, bool shared) {
+
+    if (m_state_index < copies.size()) {
+        const FileCopy &fileCopy = copies[m_state_index];
+        if (holds_input(fileCopy.m_source, fileCopy.m_destination)) {
+            // Already copied for an earlier task, such as a per-shot file.
+            std::cout << "Worker " << m_hostname << " already has " <<
+                fileCopy.m_destination << "\n";
             m_state_index++;
+            return;
+        }
+
+        // Every worker gets the same request.
+        if (shared) {
+            bool success;
+            SerializedMessage message = m_shared_inputs->get(fileCopy, success);
+            if (!success) {
+                fail(true);
+                return;
+            }
+            if (!message) {
+                m_waiting_for_disk = true;
+                return;
+            }
+            std::cout << "Copying in " << fileCopy.m_source << " to " <<
+                fileCopy.m_destination << "\n";
+            m_held_inputs[fileCopy.m_destination] = fileCopy.m_source;
+            send_request(message, receive_state);
+            return;
+        }
+
+        // Don't pile more files into memory while others are being sent.
+        if (m_reading.empty() && m_buffer_pool.is_exhausted()) {
+            m_waiting_for_memory = true;
+            return;
+        }
+
+        // Read it in the background, and come back here when it's done.
+        if (m_reading != fileCopy.m_source) {
+            m_disk_io.read(fileCopy.m_source);
+            m_reading = fileCopy.m_source;
         }
+        bool success;
+        std::string content;
+        if (!m_disk_io.take_read(fileCopy.m_source, success, content)) {
+            m_waiting_for_disk = true;
+            return;
+        }
+        m_reading.clear();
+        if (!success) {
+            std::cerr << "Error reading file " << fileCopy.m_source << "\n";
+            fail(true);
+            return;
+        }
+
+        // Send file.
+        Drp::Request request;
+        request.set_request_type(Drp::COPY_IN);
+        Drp::CopyInRequest *copy_in_request = request.mutable_copy_in_request();
+        std::cout << "Copying in " << fileCopy.m_source << " to " << fileCopy.m_destination << "\n";
+        copy_in_request->set_pathname(fileCopy.m_destination);
+        copy_in_request->set_content(std::move(content));
+        m_held_inputs[fileCopy.m_destination] = fileCopy.m_source;
+        send_request(request, receive_state);
     } else {
         m_state = next_state;
     }
 }
 
-void RemoteWorker::copy_file_out(int frame, State receive_state, State next_state) {
-    if (m_state_index < m_parameters.m_out_copies.size()) {
-        const FileCopy &fileCopy = m_parameters.m_out_copies[m_state_index];
-        if ((frame >= 0) == fileCopy.has_parameter()) {
-            // Ask for file.
+void RemoteWorker::prefetch(const Task &task) {
+    m_prefetched = true;
+    m_prefetch_copies.clear();
+    m_prefetch_index = 0;
+
+    for (const FileCopy &fileCopy : task.m_in_copies) {
+        // Skip files the executable might be using.
+        bool clashes = false;
+        for (const FileCopy &current : m_task.m_in_copies) {
+            clashes = clashes || current.m_destination == fileCopy.m_destination;
+        }
+        for (const FileCopy &current : m_task.m_out_copies) {
+            clashes = clashes || current.m_source == fileCopy.m_destination;
+        }
+
+        if (!clashes && !holds_input(fileCopy.m_source, fileCopy.m_destination)) {
+            m_prefetch_copies.push_back(fileCopy);
+        }
+    }
+
+    send_while_executing();
+}
+
+void RemoteWorker::cancel_task() {
+    m_cancelling = true;
+    stop_prefetch();
+    send_while_executing();
+}
+
+void RemoteWorker::send_while_executing() {
+    if (m_outgoing_buffer.need_send()) {
+        return;
+    }
+
+    if (m_cancelling) {
+        if (!m_cancel_sent) {
             Drp::Request request;
-            request.set_request_type(Drp::COPY_OUT);
-            Drp::CopyOutRequest *copy_out_request = request.mutable_copy_out_request();
-            std::string source_pathname = substitute_parameter(fileCopy.m_source, frame);
-            std::string destination_pathname = substitute_parameter(fileCopy.m_destination, frame);
-            std::cout << "Copying out " << source_pathname << " to " << destination_pathname << "\n";
-            copy_out_request->set_pathname(source_pathname);
-            send_request(request, receive_state);
-        } else {
-            m_state_index++;
+            request.set_request_type(Drp::CANCEL);
+            request.mutable_cancel_request();
+            m_outgoing_buffer.set_message(request);
+            m_cancel_sent = true;
+        }
+        return;
+    }
+
+    if (m_prefetch_sent || m_waiting_for_disk || m_waiting_for_memory) {
+        return;
+    }
+
+    while (m_prefetch_index < m_prefetch_copies.size()) {
+        const FileCopy &fileCopy = m_prefetch_copies[m_prefetch_index];
+
+        // Like copy_file_in(), but without leaving this state.
+        if (m_reading.empty() && m_buffer_pool.is_exhausted()) {
+            m_waiting_for_memory = true;
+            return;
         }
+        if (m_reading != fileCopy.m_source) {
+            m_disk_io.read(fileCopy.m_source);
+            m_reading = fileCopy.m_source;
+        }
+        bool success;
+        std::string content;
+        if (!m_disk_io.take_read(fileCopy.m_source, success, content)) {
+            m_waiting_for_disk = true;
+            return;
+        }
+        m_reading.clear();
+        if (!success) {
+            // It'll be reported if the task is run.
+            m_prefetch_index++;
+            continue;
+        }
+
+        Drp::Request request;
+        request.set_request_type(Drp::COPY_IN);
+        Drp::CopyInRequest *copy_in_request = request.mutable_copy_in_request();
+        std::cout << "Prefetching " << fileCopy.m_source << " to " <<
+            fileCopy.m_destination << " on " << m_hostname << "\n";
+        copy_in_request->set_pathname(fileCopy.m_destination);
+        copy_in_request->set_content(std::move(content));
+        m_held_inputs[fileCopy.m_destination] = fileCopy.m_source;
+
+        // Not send_request(), we're still receiving the execute's messages.
+        m_outgoing_buffer.set_message(request);
+        m_prefetch_sent = true;
+        return;
+    }
+}
+
+void RemoteWorker::handle_prefetch_response(const Drp::Response &response) {
+    const FileCopy &fileCopy = m_prefetch_copies[m_prefetch_index];
+    if (!response.copy_in_response().success()) {
+        std::cerr << "Warning: Failed to prefetch " << fileCopy.m_source << ".\n";
+        m_held_inputs.erase(fileCopy.m_destination);
+    }
+    m_prefetch_sent = false;
+    m_prefetch_index++;
+}
+
+void RemoteWorker::stop_prefetch() {
+    if (!m_reading.empty()) {
+        m_disk_io.cancel_read(m_reading);
+        m_reading.clear();
+    }
+    m_waiting_for_disk = false;
+    m_waiting_for_memory = false;
+
+    // Keep the copy whose response we're waiting for.
+    if (m_prefetch_sent) {
+        m_prefetch_copies.erase(m_prefetch_copies.begin() + m_prefetch_index + 1,
+                m_prefetch_copies.end());
+    } else {
+        m_prefetch_copies.clear();
+        m_prefetch_index = 0;
+    }
+}
+
+void RemoteWorker::copy_file_out(const std::vector<FileCopy> &copies,
+        State receive_state, State next_state) {
+
+    if (m_state_index < copies.size()) {
+        const FileCopy &fileCopy = copies[m_state_index];
+
+        // Ask for file.
+        Drp::Request request;
+        request.set_request_type(Drp::COPY_OUT);
+        Drp::CopyOutRequest *copy_out_request = request.mutable_copy_out_request();
+        std::cout << "Copying out " << fileCopy.m_source << " to " << fileCopy.m_destination << "\n";
+        copy_out_request->set_pathname(fileCopy.m_source);
+        send_request(request, receive_state);
     } else {
+        // Files must be on disk before anyone hears that the task is done.
+        while (!m_writes.empty()) {
+            bool success;
+            if (!m_disk_io.take_write(m_writes.back(), success)) {
+                m_waiting_for_disk = true;
+                return;
+            }
+            m_writes.pop_back();
+            if (!success) {
+                std::cerr << "Error: Failed to copy file.\n";
+                fail(true);
+                return;
+            }
+        }
+
         m_state = next_state;
     }
 }
 
-void RemoteWorker::handle_copy_file_out_response(const Drp::Response &response, int frame,
-        const FileCopy &fileCopy) {
+void RemoteWorker::handle_early_copy_out_response(Drp::Response &response) {
+    const std::string &pathname = response.copy_out_response().pathname();
 
+    // Maybe it was a temporary file that's gone. Copy it out afterward as usual.
     if (!response.copy_out_response().success()) {
-        std::cerr << "Error: Failed to copy file.\n";
-        exit(-1);
+        return;
     }
 
-    bool success = write_file(substitute_parameter(fileCopy.m_destination, frame),
-            response.copy_out_response().content());
-    if (!success) {
+    for (int i = 0; i < m_task.m_out_copies.size(); i++) {
+        const FileCopy &fileCopy = m_task.m_out_copies[i];
+        if (fileCopy.m_source == pathname) {
+            std::cout << "Copying out early " << fileCopy.m_source << " to " <<
+                fileCopy.m_destination << "\n";
+            handle_copy_file_out_response(response, i);
+            m_early_copies.insert(i);
+            return;
+        }
+    }
+
+    std::cerr << "Error: Worker sent unexpected file " << pathname << ".\n";
+    exit(-1);
+}
+
+void RemoteWorker::handle_copy_file_out_response(Drp::Response &response, int index) {
+    if (!response.copy_out_response().success()) {
         std::cerr << "Error: Failed to copy file.\n";
-        exit(-1);
+        fail(true);
+        return;
+    }
+
+    // Hold on to the sink's copy for the controller.
+    if (index == m_task.m_sink_copy) {
+        m_task.m_sink_content = std::move(*response.mutable_copy_out_response()->mutable_content());
+        return;
     }
+
+    // Write it in the background while we get the next one.
+    const FileCopy &fileCopy = m_task.m_out_copies[index];
+    m_writes.push_back(m_disk_io.write(fileCopy.m_destination,
+                std::move(*response.mutable_copy_out_response()->mutable_content())));
 }
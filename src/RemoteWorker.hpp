@@ -2,11 +2,41 @@
 #define REMOTE_WORKER_HPP
 
 #include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <set>
 
 #include "Drp.pb.h"
 #include "Parameters.hpp"
+#include "Calibration.hpp"
+#include "DiskIo.hpp"
+#include "BufferPool.hpp"
+#include "SharedInputs.hpp"
+#include "Task.hpp"
 #include "OutgoingBuffer.hpp"
 #include "IncomingBuffer.hpp"
+#include "MessageArena.hpp"
+
+// How often to ask idle workers for their load, in seconds.
+static const int STATUS_INTERVAL_S = 5;
+
+// How often a worker running an executable tells us it's still going, in seconds.
+static const int HEARTBEAT_INTERVAL_S = 5;
+
+// A worker that we're waiting for and haven't heard from in this many
+// seconds is considered dead.
+static const int HEARTBEAT_TIMEOUT_S = 30;
+
+// Slowest rate, in bytes per second, at which a healthy worker writes the
+// files we send it. It can't answer while it writes, so we wait longer for
+// big files.
+static const int MIN_WRITE_BYTES_PER_S = 1024*1024;
+
+// A machine whose load average is this many times its core count is busy
+// with someone else's work, since our own renderer accounts for about one.
+static const float OVERLOAD_FACTOR = 2.0;
 
 // Represents a remote worker. Stores our state for it.
 class RemoteWorker {
@@ -20,29 +50,55 @@ public:
         SEND_COPY_IN_NON_FRAME_FILE,
         RECEIVE_COPY_IN_NON_FRAME_FILE,
 
+        // Measure the speed of the machine, unless it's cached.
+        START_CALIBRATION,
+        SEND_COPY_IN_CALIBRATION_FILE,
+        RECEIVE_COPY_IN_CALIBRATION_FILE,
+        SEND_CALIBRATE_REQUEST,
+        RECEIVE_CALIBRATE_RESPONSE,
+
         // Waiting for assignment.
         IDLE,
 
+        // Refreshing the load report of an idle worker.
+        SEND_STATUS_REQUEST,
+        RECEIVE_STATUS_RESPONSE,
+
         // Copy in frame files.
         SEND_COPY_IN_FRAME_FILE,
         RECEIVE_COPY_IN_FRAME_FILE,
 
-        // Sending an execute command.
+        // Sending an execute command. The worker handles other requests
+        // while it runs, such as copying in another task's files.
         SEND_EXECUTE_REQUEST,
         RECEIVE_EXECUTE_RESPONSE,
 
+        // Executable is done, waiting for the responses to requests sent
+        // while it ran.
+        RECEIVE_LATE_RESPONSES,
+
         // Copy out frame files.
         SEND_COPY_OUT_FRAME_FILE,
         RECEIVE_COPY_OUT_FRAME_FILE,
 
+        // Delete files the task used up.
+        SEND_REMOVE_REQUEST,
+        RECEIVE_REMOVE_RESPONSE,
+
         // Copy in non-frame files.
         SEND_COPY_OUT_NON_FRAME_FILE,
         RECEIVE_COPY_OUT_NON_FRAME_FILE,
 
         // Finished with this worker.
         DONE,
+
+        // Gave up after an error. The controller drops the worker.
+        FAILED,
     };
 
+    // Unique identifier of this worker, for tasks that must run on it.
+    int m_id;
+
     // Networking file descriptor.
     int m_fd;
 
@@ -53,11 +109,114 @@ public:
     // next index to do (e.g., the next index in m_in_copies).
     int m_state_index;
 
-    // User parameters.
-    const Parameters &m_parameters;
+    // Parameters of the job we're working for.
+    const Parameters *m_parameters;
+
+    // Per-host speed measurements.
+    Calibration &m_calibration;
+
+    // Reads and writes our files in the background.
+    DiskIo &m_disk_io;
+
+    // Requests for the files every worker of the job gets.
+    SharedInputs *m_shared_inputs;
+
+    // File we're waiting for m_disk_io to read, or empty for none.
+    std::string m_reading;
+
+    // Writes of out copies that m_disk_io hasn't finished.
+    std::vector<int> m_writes;
+
+    // Whether we can't go on until m_disk_io finishes a read or write.
+    bool m_waiting_for_disk;
+
+    // Where message buffers come from.
+    BufferPool &m_buffer_pool;
+
+    // Whether we can't send a file until m_buffer_pool has room.
+    bool m_waiting_for_memory;
+
+    // Copies done once for the job, when the worker connects or switches to it.
+    std::vector<FileCopy> m_job_in_copies;
+
+    // Whatever task we're working on, if m_has_task is true.
+    Task m_task;
+    bool m_has_task;
+
+    // Task to run once we've switched to its job, if m_has_pending_task is true.
+    Task m_pending_task;
+    bool m_has_pending_task;
+
+    // Exit status of m_task's executable.
+    int m_task_status;
+
+    // Resources used by m_task's executable, empty if it didn't run.
+    Drp::ResourceUsage m_task_usage;
+
+    // Indices of m_task's out copies that the worker sent while executing.
+    std::set<int> m_early_copies;
+
+    // When we started working on m_task.
+    std::chrono::steady_clock::time_point m_task_start;
+
+    // CPU seconds m_task's executable has used, from its last heartbeat.
+    double m_task_cpu_seconds;
+
+    // When we last heard from the worker.
+    std::chrono::steady_clock::time_point m_last_heard;
+
+    // When the worker should be done writing the files we sent it, if it
+    // writes them at MIN_WRITE_BYTES_PER_S.
+    std::chrono::steady_clock::time_point m_busy_until;
+
+    // Input files of another task sent while m_task's executable runs, and
+    // the index of the next one to send.
+    std::vector<FileCopy> m_prefetch_copies;
+    int m_prefetch_index;
+
+    // Whether we've sent a prefetch copy and are waiting for its response.
+    bool m_prefetch_sent;
+
+    // Whether we've prefetched for m_task's executable already.
+    bool m_prefetched;
+
+    // Whether we want to stop m_task's executable, and whether we've sent
+    // the CANCEL request and are waiting for its response.
+    bool m_cancelling;
+    bool m_cancel_sent;
+
+    // Whether m_task's executable was stopped by a CANCEL request.
+    bool m_task_cancelled;
+
+    // Whether we're FAILED because of the job, such as a missing input
+    // file, rather than because of the worker.
+    bool m_job_error;
+
+    // State to go to once the late responses come in.
+    State m_after_late_state;
+
+    // Frame of the last task we were given, or -1 for none.
+    int m_last_frame;
+
+    // Input files this worker already has, from remote pathname to the local
+    // pathname it was copied from.
+    std::map<std::string, std::string> m_held_inputs;
+
+    // Last task we finished that the controller hasn't taken yet, if
+    // m_has_completed_task is true.
+    Task m_completed_task;
+    bool m_has_completed_task;
+    int m_completed_status;
+    double m_completed_seconds;
+    Drp::ResourceUsage m_completed_usage;
+
+    // Last task we cancelled that the controller hasn't taken yet, if
+    // m_has_cancelled_task is true.
+    Task m_cancelled_task;
+    bool m_has_cancelled_task;
 
-    // Whatever frame we're working on, or -1 for none.
-    int m_frame;
+    // Frame we run to calibrate the machine.
+    Task m_calibration_task;
 
     // Index of proxy we're blocked for, or -1 for none.
     int m_proxy_index;
@@ -66,19 +225,111 @@ public:
     OutgoingBuffer m_outgoing_buffer;
     IncomingBuffer m_incoming_buffer;
 
+    // Where the last response was decoded.
+    MessageArena m_arena;
+
     // Hostname of this remote machine. Empty if no one has connected yet.
     std::string m_hostname;
 
-    RemoteWorker(int fd, const Parameters &parameters)
-        : m_fd(fd), m_state(SEND_WELCOME_REQUEST), m_state_index(0), m_parameters(parameters),
-            m_frame(-1), m_proxy_index(-1), m_outgoing_buffer(fd), m_incoming_buffer(fd) {
+    // Hardware of this remote machine, from the welcome response. Zero if unknown.
+    int m_core_count;
+    int64_t m_memory_size;
+    int m_numa_node_count;
+    std::string m_cpu_model;
+
+    // Most recent load of this remote machine. Free memory is zero if unknown.
+    float m_load_average;
+    int64_t m_free_memory;
+    std::chrono::steady_clock::time_point m_last_report;
+
+    // Seconds this machine takes to run the calibration benchmark, or 0 if
+    // not calibrated.
+    double m_calibration_seconds;
+
+    RemoteWorker(int fd, const Parameters &parameters, Calibration &calibration, DiskIo &disk_io,
+            SharedInputs &shared_inputs, BufferPool &buffer_pool)
+        : m_id(s_next_id++), m_fd(fd), m_state(SEND_WELCOME_REQUEST), m_state_index(0), m_parameters(&parameters),
+            m_calibration(calibration), m_disk_io(disk_io), m_shared_inputs(&shared_inputs),
+            m_waiting_for_disk(false), m_buffer_pool(buffer_pool), m_waiting_for_memory(false),
+            m_has_task(false), m_has_pending_task(false), m_task_status(0), m_task_cpu_seconds(0),
+            m_prefetch_index(0), m_prefetch_sent(false), m_prefetched(false),
+            m_cancelling(false), m_cancel_sent(false), m_task_cancelled(false), m_job_error(false),
+            m_after_late_state(IDLE), m_last_frame(-1),
+            m_has_completed_task(false), m_completed_status(0), m_completed_seconds(0),
+            m_has_cancelled_task(false),
+            m_proxy_index(-1), m_outgoing_buffer(fd, buffer_pool),
+            m_incoming_buffer(fd, buffer_pool),
+            m_core_count(0), m_memory_size(0), m_numa_node_count(0),
+            m_load_average(0), m_free_memory(0), m_calibration_seconds(0) {
+
+        m_last_heard = std::chrono::steady_clock::now();
+        m_busy_until = m_last_heard;
+        set_job_in_copies();
+    }
+
+    virtual ~RemoteWorker() {
+        close(m_fd);
+        if (!m_reading.empty()) {
+            m_disk_io.cancel_read(m_reading);
+        }
+        for (int id : m_writes) {
+            m_disk_io.cancel_write(id);
+        }
+    }
+
+    int get_id() const {
+        return m_id;
+    }
+
+    // Whether we were assigned a task to work on.
+    bool has_task() const {
+        return m_has_task;
+    }
+
+    // The task we were assigned to work on. Only valid if has_task() is true.
+    const Task &get_task() const {
+        return m_task;
+    }
 
-        // Nothing.
+    // Whether we're switching to another job to run a task.
+    bool has_pending_task() const {
+        return m_has_pending_task;
     }
 
-    // The frame we were assigned to work on.
-    int get_frame() const {
-        return m_frame;
+    // The task we'll run once we've switched jobs. Only valid if
+    // has_pending_task() is true.
+    const Task &get_pending_task() const {
+        return m_pending_task;
+    }
+
+    // Switch an idle worker to another job: copy in the job's non-frame
+    // files, calibrate if the job asks for it, then run the task. Files from
+    // earlier jobs may have changed, so they're all copied again.
+    void load_job(const Parameters &parameters, SharedInputs &shared_inputs, const Task &task) {
+        if (!is_idle()) {
+            std::cerr << "Error: Switched jobs on a non-idle worker.\n";
+            exit(1);
+        }
+
+        m_parameters = &parameters;
+        m_shared_inputs = &shared_inputs;
+        set_job_in_copies();
+        m_held_inputs.clear();
+        m_last_frame = -1;
+        m_calibration_seconds = 0;
+        m_pending_task = task;
+        m_has_pending_task = true;
+        m_state = SEND_COPY_IN_NON_FRAME_FILE;
+        m_state_index = 0;
+        dispatch();
+    }
+
+    // Forget the job of an idle worker, whose files are still on the worker,
+    // for when the job goes away.
+    void unload_job(const Parameters &parameters, SharedInputs &shared_inputs) {
+        m_parameters = &parameters;
+        m_shared_inputs = &shared_inputs;
+        set_job_in_copies();
     }
 
     // Get the hostname. Might be empty if we've not gotten a welcome response.
@@ -86,6 +337,16 @@ public:
         return m_hostname;
     }
 
+    // Number of cores of the remote machine, or 0 if unknown.
+    int core_count() const {
+        return m_core_count;
+    }
+
+    // Memory size of the remote machine in bytes, or 0 if unknown.
+    int64_t memory_size() const {
+        return m_memory_size;
+    }
+
     // Set the index of the proxy (in the m_proxy_endpoints list) we're blocked for.
     void set_proxy_index(int proxy_index) {
         m_proxy_index = proxy_index;
@@ -101,13 +362,28 @@ public:
         pollfd.fd = m_fd;
         pollfd.events =
             (m_outgoing_buffer.need_send() ? POLLOUT : 0) |
-            (m_incoming_buffer.need_receive() ? POLLIN : 0);
+            (m_incoming_buffer.need_receive() && !m_incoming_buffer.is_deferred() ? POLLIN : 0);
         pollfd.revents = 0;
     }
 
     // Send what we can.
     bool send() {
-        return m_outgoing_buffer.send();
+        size_t size = m_outgoing_buffer.get_size();
+        bool success = m_outgoing_buffer.send();
+        m_last_heard = std::chrono::steady_clock::now();
+
+        // The worker handles the message once it's all there.
+        if (success && size > 0 && !m_outgoing_buffer.need_send()) {
+            m_busy_until = std::max(m_busy_until, m_last_heard) +
+                std::chrono::milliseconds(size*1000/MIN_WRITE_BYTES_PER_S);
+        }
+
+        // Send the next prefetch copy once the line is clear.
+        if (success && m_state == RECEIVE_EXECUTE_RESPONSE) {
+            send_while_executing();
+        }
+
+        return success;
     }
 
     // Receive as many bytes as we can. Returns whether successful. If not, sets errno.
@@ -116,6 +392,7 @@ public:
         if (!success) {
             return success;
         }
+        m_last_heard = std::chrono::steady_clock::now();
 
         if (!m_incoming_buffer.need_receive()) {
             // We're done, decode it.
@@ -130,55 +407,337 @@ public:
         dispatch();
     }
 
+    // Whether we're waiting for a file to be read or written.
+    bool is_waiting_for_disk() const {
+        return m_waiting_for_disk;
+    }
+
+    // Carry on after the DiskIo object finished reading or writing something.
+    void disk_io_done() {
+        m_waiting_for_disk = false;
+        if (m_state == RECEIVE_EXECUTE_RESPONSE) {
+            send_while_executing();
+        } else {
+            dispatch();
+        }
+    }
+
+    // Carry on if we were waiting for room in the buffer pool and there is some.
+    void retry_deferred() {
+        m_incoming_buffer.retry();
+        if (m_waiting_for_memory && !m_buffer_pool.is_exhausted()) {
+            m_waiting_for_memory = false;
+            if (m_state == RECEIVE_EXECUTE_RESPONSE) {
+                send_while_executing();
+            } else {
+                dispatch();
+            }
+        }
+    }
+
     bool is_idle() {
         return m_state == IDLE;
     }
 
-    void run_frame(int frame) {
+    // Relative rendering capacity of this machine, for choosing among idle
+    // workers. Measured speed if calibrated, otherwise nominal core count.
+    double capacity() const {
+        if (m_calibration_seconds > 0) {
+            return 1/m_calibration_seconds;
+        }
+
+        return m_core_count > 0 ? m_core_count : 1;
+    }
+
+    // Number of these input files that this worker already has.
+    int count_held_inputs(const std::vector<FileCopy> &inputs) const {
+        int count = 0;
+
+        for (const FileCopy &input : inputs) {
+            if (holds_input(input.m_source, input.m_destination)) {
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    // Whether the worker already has this input file.
+    bool holds_input(const std::string &source, const std::string &destination) const {
+        std::map<std::string, std::string>::const_iterator itr = m_held_inputs.find(destination);
+        return itr != m_held_inputs.end() && itr->second == source;
+    }
+
+    // Whether the frame directly follows the last one we were given. Always
+    // false if the user asked for a non-sequential order.
+    bool is_next_frame(int frame) const {
+        return m_parameters->m_frames.m_order == ORDER_SEQUENTIAL && frame != -1 &&
+            m_last_frame != -1 && frame == m_last_frame + m_parameters->m_frames.get_step();
+    }
+
+    // Whether we have measured the speed of this machine.
+    bool is_calibrated() const {
+        return m_calibration_seconds > 0;
+    }
+
+    // Estimated seconds for this machine to render a frame, given the work
+    // of a frame in units of calibration benchmark runs.
+    double estimate_frame_seconds(double work) const {
+        return work*m_calibration_seconds;
+    }
+
+    // Work of a frame that took this machine the given seconds, in units of
+    // calibration benchmark runs.
+    double get_frame_work(double seconds) const {
+        return seconds/m_calibration_seconds;
+    }
+
+    // CPU seconds used by the current task's executable, as of its last
+    // heartbeat, or 0 if unknown.
+    double get_task_cpu_seconds() const {
+        return m_task_cpu_seconds;
+    }
+
+    // Seconds since we last heard from the worker, or asked it something,
+    // not counting the time it may need to write the files we sent it.
+    double get_silence() const {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() -
+            std::max(m_last_heard, m_busy_until);
+        return elapsed.count();
+    }
+
+    // Whether we gave up on the worker after an error, and whether that was
+    // the job's fault rather than the worker's. Either way the controller
+    // should drop the worker, since we may be in the middle of an exchange.
+    bool has_failed() const {
+        return m_state == FAILED;
+    }
+    bool is_job_error() const {
+        return m_job_error;
+    }
+
+    // Whether we're waiting for the worker and haven't heard from it for
+    // too long. Welcomes and calibrations can take any amount of time.
+    bool is_unresponsive() const {
+        bool waiting = m_state == RECEIVE_COPY_IN_NON_FRAME_FILE ||
+            m_state == RECEIVE_COPY_IN_CALIBRATION_FILE ||
+            m_state == RECEIVE_STATUS_RESPONSE ||
+            m_state == RECEIVE_COPY_IN_FRAME_FILE ||
+            m_state == RECEIVE_EXECUTE_RESPONSE ||
+            m_state == RECEIVE_LATE_RESPONSES ||
+            m_state == RECEIVE_COPY_OUT_FRAME_FILE ||
+            m_state == RECEIVE_REMOVE_RESPONSE;
+
+        return waiting && get_silence() > HEARTBEAT_TIMEOUT_S;
+    }
+
+    // Whether the current task's executable is running and could be cancelled.
+    bool can_cancel() const {
+        return m_state == RECEIVE_EXECUTE_RESPONSE && !m_cancelling;
+    }
+
+    // Stop the current task's executable. The task is then available from
+    // take_cancelled_task(), unless it finishes first.
+    void cancel_task();
+
+    // If we've cancelled a task since the last call, returns true and fills it.
+    bool take_cancelled_task(Task &task) {
+        if (!m_has_cancelled_task) {
+            return false;
+        }
+
+        task = std::move(m_cancelled_task);
+        m_has_cancelled_task = false;
+        return true;
+    }
+
+    // Whether the worker is running an executable and we could send it the
+    // inputs of another task meanwhile.
+    bool can_prefetch() const {
+        return m_state == RECEIVE_EXECUTE_RESPONSE && !m_prefetched;
+    }
+
+    // Send the worker the inputs of a task it will probably get next, while
+    // it runs the current task's executable. Inputs that would overwrite
+    // the current task's files are skipped.
+    void prefetch(const Task &task);
+
+    // Seconds since we started the current task.
+    double get_task_elapsed() const {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_task_start;
+        return elapsed.count();
+    }
+
+    // If we've finished a task since the last call, returns true and fills
+    // the task, the exit status of its executable, how long it took, and
+    // the resources its executable used.
+    bool take_completed_task(Task &task, int &status, double &seconds,
+            Drp::ResourceUsage &usage) {
+
+        if (!m_has_completed_task) {
+            return false;
+        }
+
+        task = std::move(m_completed_task);
+        status = m_completed_status;
+        seconds = m_completed_seconds;
+        usage = m_completed_usage;
+        m_has_completed_task = false;
+        return true;
+    }
+
+    // Whether the machine is too loaded or too short on memory to be given a frame.
+    bool is_overcommitted() const {
+        return (m_free_memory > 0 && m_free_memory < m_parameters->m_min_free_memory) ||
+            (m_core_count > 0 && m_load_average > OVERLOAD_FACTOR*m_core_count);
+    }
+
+    // Whether our load report is stale enough to ask for a new one.
+    bool needs_status() const {
+        return m_state == IDLE &&
+            std::chrono::steady_clock::now() - m_last_report >
+                std::chrono::seconds(STATUS_INTERVAL_S);
+    }
+
+    // Ask an idle worker for a fresh load report.
+    void request_status() {
+        m_state = SEND_STATUS_REQUEST;
+        dispatch();
+    }
+
+    void run_task(const Task &task) {
         if (!is_idle()) {
-            std::cerr << "Error: Gave a frame to a non-idle worker.\n";
+            std::cerr << "Error: Gave a task to a non-idle worker.\n";
             exit(1);
         }
 
-        std::cout << "Starting frame " << frame << " on " << m_hostname << "\n";
+        if (task.m_frame == -1) {
+            std::cout << "Starting task " << task.m_id << " on " << m_hostname << "\n";
+        } else {
+            std::cout << "Starting frame " << task.m_id << " on " << m_hostname << "\n";
+        }
 
-        m_frame = frame;
+        m_task = task;
+        m_has_task = true;
+        m_task_status = 0;
+        m_task_usage.Clear();
+        m_early_copies.clear();
+        m_task_cpu_seconds = 0;
+        m_prefetched = false;
+        m_cancelling = false;
+        m_cancel_sent = false;
+        m_task_cancelled = false;
+        m_last_frame = task.m_frame;
+        m_task_start = std::chrono::steady_clock::now();
         m_state = SEND_COPY_IN_FRAME_FILE;
         m_state_index = 0;
         dispatch();
     }
 
 private:
+    // Identifier of the next worker to be created.
+    static int s_next_id;
+
+    // Copies done once for the job, from its parameters.
+    void set_job_in_copies() {
+        m_job_in_copies.clear();
+        for (const FileCopy &fileCopy : m_parameters->m_in_copies) {
+            if (!fileCopy.has_parameter()) {
+                m_job_in_copies.push_back(fileCopy);
+            }
+        }
+    }
+
     // Move the state machine forward.
     void dispatch();
 
-    // Send a file. Frame is -1 for non-frame files.
-    void copy_file_in(int frame, State receive_state, State next_state);
-    void copy_file_out(int frame, State receive_state, State next_state);
-    void handle_copy_file_out_response(const Drp::Response &response, int frame,
-            const FileCopy &fileCopy);
+    // Give up after an error, which was already reported. See has_failed().
+    void fail(bool job_error) {
+        m_state = FAILED;
+        m_job_error = job_error;
+    }
+
+    // Name of the benchmark we calibrate with, for the cache.
+    std::string get_benchmark() const;
+
+    // Fill the request to run the executable for a task.
+    void fill_execute_request(Drp::ExecuteRequest &execute_request, const Task &task) const;
+
+    // Send or ask for the file at m_state_index in the list of copies. Shared
+    // copies are the same for every worker.
+    void copy_file_in(const std::vector<FileCopy> &copies, State receive_state, State next_state,
+            bool shared);
+    void copy_file_out(const std::vector<FileCopy> &copies, State receive_state, State next_state);
+
+    // Write the out copy at the index in m_task's copies, or keep it for the sink.
+    void handle_copy_file_out_response(Drp::Response &response, int index);
+
+    // Send the CANCEL request or the next prefetch copy, if the line is clear.
+    void send_while_executing();
+
+    // Note that the worker got the prefetch copy at m_prefetch_index.
+    void handle_prefetch_response(const Drp::Response &response);
+
+    // Stop prefetching, keeping the copy whose response is on its way, if any.
+    void stop_prefetch();
+
+    // Whether we're waiting for responses to requests sent while executing.
+    bool has_late_responses() const {
+        return m_prefetch_sent || m_cancel_sent;
+    }
+
+    // Write an out copy that the worker sent while executing.
+    void handle_early_copy_out_response(Drp::Response &response);
 
     void send_request(const Drp::Request &request, State next_state) {
         m_incoming_buffer.reset();
         m_outgoing_buffer.set_message(request);
         m_state = next_state;
+        m_last_heard = std::chrono::steady_clock::now();
     }
 
-    void receive_response(Drp::Response &response, Drp::RequestType expected_request_type) {
+    void send_request(const SerializedMessage &request, State next_state) {
+        m_incoming_buffer.reset();
+        m_outgoing_buffer.set_message(request);
+        m_state = next_state;
+        m_last_heard = std::chrono::steady_clock::now();
+    }
+
+    // Decode the response we received. It lives until the next call. If
+    // executing is true, also accepts the messages the worker sends while it
+    // runs an executable: heartbeats, outputs sent early (COPY_OUT responses
+    // with a pathname), and responses to prefetch copies and cancels.
+    Drp::Response &receive_response(Drp::RequestType expected_request_type,
+            bool executing = false) {
+        m_arena.reset();
+        Drp::Response &response = m_arena.create<Drp::Response>();
         bool success = m_incoming_buffer.get_message(response);
         if (!success) {
             std::cout << "Can't decode buffer into message.\n";
             exit(1);
         }
 
-        if (response.request_type() != expected_request_type) {
+        Drp::RequestType type = response.request_type();
+        if (type != expected_request_type && !(executing && (type == Drp::HEARTBEAT ||
+                        type == Drp::COPY_IN || type == Drp::CANCEL ||
+                        (type == Drp::COPY_OUT && response.copy_out_response().has_pathname())))) {
+
             std::cout << "Got response type " << response.request_type() <<
                 ", expected " << expected_request_type << "\n";
             exit(1);
         }
 
+        m_last_heard = std::chrono::steady_clock::now();
+        if (response.has_load_report()) {
+            m_load_average = response.load_report().load_average();
+            m_free_memory = response.load_report().free_memory();
+            m_last_report = std::chrono::steady_clock::now();
+        }
+
         // Reset for next time.
         m_incoming_buffer.reset();
+
+        return response;
     }
 };
 
@@ -0,0 +1,44 @@
+
+#include <iostream>
+
+#include "SharedInputs.hpp"
+#include "Drp.pb.h"
+
+SerializedMessage SharedInputs::get(const FileCopy &fileCopy, bool &success) {
+    std::pair<std::string, std::string> key(fileCopy.m_source, fileCopy.m_destination);
+    std::map<std::pair<std::string, std::string>, Entry>::iterator itr = m_entries.find(key);
+
+    success = true;
+    if (itr == m_entries.end()) {
+        m_entries[key] = Entry { nullptr, false };
+        m_disk_io.read(fileCopy.m_source);
+        return nullptr;
+    }
+
+    Entry &entry = itr->second;
+    if (entry.m_failed) {
+        std::cerr << "Error reading file " << fileCopy.m_source << "\n";
+        success = false;
+        return nullptr;
+    }
+    if (!entry.m_message) {
+        std::string content;
+        if (!m_disk_io.take_read(fileCopy.m_source, success, content)) {
+            return nullptr;
+        }
+        if (!success) {
+            std::cerr << "Error reading file " << fileCopy.m_source << "\n";
+            entry.m_failed = true;
+            return nullptr;
+        }
+
+        Drp::Request request;
+        request.set_request_type(Drp::COPY_IN);
+        Drp::CopyInRequest *copy_in_request = request.mutable_copy_in_request();
+        copy_in_request->set_pathname(fileCopy.m_destination);
+        copy_in_request->set_content(std::move(content));
+        entry.m_message = OutgoingBuffer::serialize(request, nullptr);
+    }
+
+    return entry.m_message;
+}
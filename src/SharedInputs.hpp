@@ -0,0 +1,42 @@
+#ifndef SHARED_INPUTS_HPP
+#define SHARED_INPUTS_HPP
+
+#include <map>
+#include <utility>
+
+#include "Parameters.hpp"
+#include "DiskIo.hpp"
+#include "OutgoingBuffer.hpp"
+
+// Copy-in requests for the files that every worker gets, such as the
+// non-frame inputs and the calibration frame's inputs. Each is read and
+// serialized once per job, and the same bytes are sent to every worker.
+class SharedInputs {
+    // A request being read or ready to send.
+    struct Entry {
+        // Null until the file has been read.
+        SerializedMessage m_message;
+
+        // Whether the file couldn't be read.
+        bool m_failed;
+    };
+
+    DiskIo &m_disk_io;
+
+    // By local and remote pathname.
+    std::map<std::pair<std::string, std::string>, Entry> m_entries;
+
+public:
+    SharedInputs(DiskIo &disk_io)
+        : m_disk_io(disk_io) {
+
+        // Nothing.
+    }
+
+    // Get the copy-in request for the file. Returns null if the file is
+    // still being read, in which case call again once the DiskIo object has
+    // finished something. Sets success to false if the file can't be read.
+    SerializedMessage get(const FileCopy &fileCopy, bool &success);
+};
+
+#endif // SHARED_INPUTS_HPP
@@ -0,0 +1,189 @@
+
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "Sink.hpp"
+#include "util.hpp"
+
+// Pipe the frames in the order they were specified, whatever order they're
+// rendered in.
+static Frames sequential(const Frames &frames) {
+    Frames copy = frames;
+    copy.m_order = ORDER_SEQUENTIAL;
+    return copy;
+}
+
+Sink::Sink(const Parameters &parameters)
+    : m_parameters(parameters), m_frames(sequential(parameters.m_frames)),
+        m_frame_source(m_frames), m_next_frame(-1), m_memory_used(0), m_pid(-1),
+        m_fd(-1), m_written(0), m_failed(false), m_error(false) {
+
+    if (!m_frame_source.next(m_next_frame)) {
+        m_next_frame = -1;
+    }
+}
+
+bool Sink::start() {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return false;
+    }
+
+    // Find out about a command that stops reading from write(), not a signal.
+    signal(SIGPIPE, SIG_IGN);
+
+    m_pid = start_local_command(m_parameters.m_sink_command, fds[0]);
+    close(fds[0]);
+    if (m_pid == -1) {
+        close(fds[1]);
+        return false;
+    }
+
+    m_fd = fds[1];
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+
+    return true;
+}
+
+void Sink::frame_done(Task &task) {
+    if (task.m_sink_copy == -1) {
+        return;
+    }
+
+    // Keep it on disk if the command is gone, or until it's needed if
+    // we're out of memory.
+    const std::string &pathname = task.m_out_copies[task.m_sink_copy].m_destination;
+    int64_t size = task.m_sink_content.size();
+    if (m_failed || (task.m_frame != m_next_frame &&
+                m_memory_used + size > m_parameters.m_sink_memory)) {
+
+        if (!write_file(pathname, task.m_sink_content)) {
+            std::cerr << "Error: Failed to write " << pathname << ".\n";
+            m_error = true;
+            fail();
+            return;
+        }
+        if (m_failed) {
+            return;
+        }
+        m_pending[task.m_frame] = Pending { "", pathname, true };
+    } else {
+        m_pending[task.m_frame] = Pending { std::move(task.m_sink_content), pathname, false };
+        m_memory_used += size;
+    }
+
+    advance();
+}
+
+void Sink::send() {
+    while (need_send()) {
+        ssize_t sent = write(m_fd, m_buffer.data() + m_written, m_buffer.size() - m_written);
+        if (sent == -1) {
+            if (errno != EAGAIN) {
+                perror("sink");
+                fail();
+            }
+            return;
+        }
+
+        m_written += sent;
+        if (m_written == m_buffer.size()) {
+            m_buffer.clear();
+            m_written = 0;
+            advance();
+        }
+    }
+}
+
+bool Sink::finish() {
+    if (m_fd != -1) {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    if (!m_failed && m_next_frame != -1) {
+        std::cerr << "Error: Sink never got frame " << m_next_frame << ".\n";
+        fail();
+    }
+
+    return !m_failed;
+}
+
+bool Sink::reap() {
+    if (m_pid == -1) {
+        return true;
+    }
+
+    int status;
+    pid_t pid = waitpid(m_pid, &status, WNOHANG);
+    if (pid == 0) {
+        return false;
+    }
+    if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Error: Sink command failed.\n";
+        fail();
+    }
+    m_pid = -1;
+
+    return true;
+}
+
+void Sink::advance() {
+    // Loop for frames with no content.
+    while (m_buffer.empty() && m_next_frame != -1) {
+        std::map<int, Pending>::iterator itr = m_pending.find(m_next_frame);
+        if (itr == m_pending.end()) {
+            return;
+        }
+
+        Pending &pending = itr->second;
+        m_buffer_pathname = pending.m_pathname;
+        if (!pending.m_on_disk) {
+            m_buffer = std::move(pending.m_content);
+            m_memory_used -= m_buffer.size();
+        } else {
+            try {
+                m_buffer = read_file(pending.m_pathname);
+            } catch (std::runtime_error &e) {
+                std::cerr << "Error reading file " << pending.m_pathname << "\n";
+                m_pending.erase(itr);
+                m_error = true;
+                fail();
+                return;
+            }
+            unlink(pending.m_pathname.c_str());
+        }
+        m_pending.erase(itr);
+
+        std::cout << "Sinking frame " << m_next_frame << "\n";
+        if (!m_frame_source.next(m_next_frame)) {
+            m_next_frame = -1;
+        }
+    }
+}
+
+void Sink::fail() {
+    m_failed = true;
+    if (m_fd != -1) {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    if (!m_buffer.empty() && !write_file(m_buffer_pathname, m_buffer)) {
+        std::cerr << "Error: Failed to write " << m_buffer_pathname << ".\n";
+    }
+    m_buffer.clear();
+
+    for (const std::pair<const int, Pending> &entry : m_pending) {
+        const Pending &pending = entry.second;
+        if (!pending.m_on_disk && !write_file(pending.m_pathname, pending.m_content)) {
+            std::cerr << "Error: Failed to write " << pending.m_pathname << ".\n";
+        }
+    }
+    m_pending.clear();
+    m_memory_used = 0;
+}
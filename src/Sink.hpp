@@ -0,0 +1,110 @@
+#ifndef SINK_HPP
+#define SINK_HPP
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+#include "Parameters.hpp"
+#include "Frames.hpp"
+#include "Task.hpp"
+
+// Pipes the output of each frame into the standard input of the user's sink
+// command, such as a video encoder, in the order of the frame specification.
+// Frames that arrive before earlier ones are held in memory up to a budget,
+// then in their local file, which is deleted once it's piped.
+class Sink {
+    // A frame waiting for earlier frames.
+    struct Pending {
+        // Content, if held in memory.
+        std::string m_content;
+
+        // Local file of the frame, and whether the content is there instead.
+        std::string m_pathname;
+        bool m_on_disk;
+    };
+
+    const Parameters &m_parameters;
+
+    // Frames in the order of the frame specification.
+    Frames m_frames;
+    FrameSource m_frame_source;
+
+    // Next frame to pipe, or -1 when all have been.
+    int m_next_frame;
+
+    // Frames that have arrived but aren't piped yet.
+    std::map<int, Pending> m_pending;
+
+    // Bytes of frames held in memory.
+    int64_t m_memory_used;
+
+    // The command and the write end of its standard input.
+    pid_t m_pid;
+    int m_fd;
+
+    // Frame being piped, its local file, and how much of it has been piped.
+    std::string m_buffer;
+    std::string m_buffer_pathname;
+    size_t m_written;
+
+    // Whether the command failed or stopped reading.
+    bool m_failed;
+
+    // Whether we couldn't write or read a frame's local file, so that the
+    // job can't go on.
+    bool m_error;
+
+public:
+    Sink(const Parameters &parameters);
+
+    // Start the command. Returns whether successful.
+    bool start();
+
+    // Record a finished frame task, taking its content for the sink.
+    void frame_done(Task &task);
+
+    // Whether there's content ready to pipe to the command.
+    bool need_send() const {
+        return m_fd != -1 && !m_buffer.empty();
+    }
+
+    // Whether a frame's local file couldn't be written or read.
+    bool has_error() const {
+        return m_error;
+    }
+
+    // File descriptor of the command's standard input, to poll for writing.
+    int get_fd() const {
+        return m_fd;
+    }
+
+    // Pipe what we can without blocking.
+    void send();
+
+    // Close the command's standard input so that it can finish. Returns
+    // whether all frames were piped.
+    bool finish();
+
+    // Whether the command hasn't been reaped yet.
+    bool is_running() const {
+        return m_pid != -1;
+    }
+
+    // Reap the command without blocking. Returns whether it has exited.
+    bool reap();
+
+    // Whether the command failed or stopped reading, or a frame was missing.
+    bool has_failed() const {
+        return m_failed;
+    }
+
+private:
+    // Move the next frame into the buffer if it has arrived.
+    void advance();
+
+    // Give up on the command, writing the frames we have to their local files.
+    void fail();
+};
+
+#endif // SINK_HPP
@@ -0,0 +1,108 @@
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "SlotTuner.hpp"
+
+int choose_slot_count(int slot_count, int core_count, int64_t memory_size,
+        double cores_per_task, int64_t rss_kb_per_task) {
+
+    int count = slot_count;
+
+    if (core_count > 0 && cores_per_task > 0) {
+        count = std::min(count, (int) (core_count/cores_per_task));
+    }
+    if (memory_size > 0 && rss_kb_per_task > 0) {
+        count = std::min(count, (int) (SLOT_MEMORY_FRACTION*memory_size/(rss_kb_per_task*1024)));
+    }
+
+    return std::max(count, 1);
+}
+
+double SlotTuner::get_throughput(int active) const {
+    std::map<int, Level>::const_iterator itr = m_levels.find(active);
+    if (itr == m_levels.end() || itr->second.m_seconds <= 0) {
+        return 0;
+    }
+
+    return active*3600*itr->second.m_task_count/itr->second.m_seconds;
+}
+
+std::string SlotTuner::add(const Drp::ResourceUsage &usage, int slot_count, int core_count,
+        int64_t memory_size) {
+
+    double seconds = usage.wall_seconds();
+    if (seconds <= 0) {
+        return "";
+    }
+
+    m_samples.push_back(Sample {
+        (usage.user_seconds() + usage.system_seconds())/seconds, usage.max_rss_kb() });
+    if (m_samples.size() > SLOT_SAMPLE_WINDOW) {
+        m_samples.pop_front();
+    }
+    Level &level = m_levels[m_active];
+    level.m_task_count++;
+    level.m_seconds += seconds;
+
+    if (++m_new_samples < SLOT_DECISION_INTERVAL) {
+        return "";
+    }
+    m_new_samples = 0;
+
+    // Average cores and largest memory of recent tasks.
+    double cores = 0;
+    int64_t max_rss_kb = 0;
+    for (const Sample &sample : m_samples) {
+        cores += sample.m_cores;
+        max_rss_kb = std::max(max_rss_kb, sample.m_max_rss_kb);
+    }
+    cores /= m_samples.size();
+
+    std::ostringstream reason;
+    reason << std::fixed << std::setprecision(1);
+    reason << "tasks use " << cores << " cores";
+    if (core_count > 0) {
+        reason << " of " << core_count;
+    }
+    reason << " and " << max_rss_kb/1024 << " MB";
+    if (memory_size > 0) {
+        reason << " of " << memory_size/1024/1024;
+    }
+
+    // Grow slowly, to see whether each step pays off.
+    int target = std::min(choose_slot_count(slot_count, core_count, memory_size, cores, max_rss_kb),
+            2*m_active);
+
+    // Stay below slot counts that were no faster than the largest measured
+    // count below them, which is usually half as many.
+    double throughput = get_throughput(m_active);
+    int fewer = 0;
+    for (const std::pair<const int, Level> &entry : m_levels) {
+        if (entry.first < m_active && get_throughput(entry.first) > 0) {
+            fewer = entry.first;
+        }
+    }
+    double fewer_throughput = get_throughput(fewer);
+    if (throughput > 0 && fewer_throughput > 0) {
+        if (throughput < fewer_throughput*(1 - MIN_SLOT_GAIN)) {
+            m_ceiling = std::min(m_ceiling, fewer);
+        } else if (throughput < fewer_throughput*(1 + MIN_SLOT_GAIN)) {
+            m_ceiling = std::min(m_ceiling, m_active);
+        }
+        reason << ", " << throughput << " tasks/hour with " << m_active << " vs. " <<
+            fewer_throughput << " with " << fewer;
+    }
+    target = std::max(std::min(target, m_ceiling), 1);
+
+    if (target == m_active) {
+        return "";
+    }
+
+    std::ostringstream decision;
+    decision << m_active << " -> " << target << " of " << slot_count << " (" << reason.str() << ")";
+    m_active = target;
+
+    return decision.str();
+}
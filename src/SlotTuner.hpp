@@ -0,0 +1,86 @@
+#ifndef SLOT_TUNER_HPP
+#define SLOT_TUNER_HPP
+
+#include <deque>
+#include <map>
+#include <string>
+#include <climits>
+#include <cstdint>
+
+#include "Drp.pb.h"
+
+// Number of recent tasks on a machine that its slot count is based on.
+static const int SLOT_SAMPLE_WINDOW = 20;
+
+// Number of tasks that must finish on a machine between decisions.
+static const int SLOT_DECISION_INTERVAL = 3;
+
+// Fraction of a machine's memory that its tasks may use together.
+static const double SLOT_MEMORY_FRACTION = 0.8;
+
+// Another slot must raise a machine's throughput by this fraction to be kept.
+static const double MIN_SLOT_GAIN = 0.05;
+
+// Number of slots to use on a machine with this many (at least 1), given
+// its core count and memory size in bytes (0 if unknown), and the cores and
+// memory in kilobytes that each task uses (0 if unknown).
+int choose_slot_count(int slot_count, int core_count, int64_t memory_size,
+        double cores_per_task, int64_t rss_kb_per_task);
+
+// Decides how many of a machine's slots (its connections to us) run tasks
+// at once, from the resources that its tasks use. Starts with one slot,
+// adds slots while there are cores and memory for them and they raise the
+// machine's throughput, and drops slots that lower it.
+class SlotTuner {
+    // Resources used by a finished task.
+    struct Sample {
+        double m_cores;
+        int64_t m_max_rss_kb;
+    };
+
+    // Tasks finished while some number of slots were active.
+    struct Level {
+        int m_task_count;
+        double m_seconds;
+    };
+
+    // Most recent tasks, oldest first.
+    std::deque<Sample> m_samples;
+
+    // Tasks finished since the last decision.
+    int m_new_samples;
+
+    // Number of slots that may run tasks.
+    int m_active;
+
+    // Number of slots found to be no better than the largest measured
+    // number below it.
+    int m_ceiling;
+
+    // Finished tasks, by number of active slots.
+    std::map<int, Level> m_levels;
+
+public:
+    SlotTuner()
+        : m_new_samples(0), m_active(1), m_ceiling(INT_MAX) {
+
+        // Nothing.
+    }
+
+    // Number of slots that may run tasks at once.
+    int get_active() const {
+        return m_active;
+    }
+
+    // Tasks per hour with this many active slots, or 0 if not measured.
+    double get_throughput(int active) const;
+
+    // Add the usage of a task that finished on the machine, which has this
+    // many slots, cores, and bytes of memory (0 if unknown). If that
+    // changes the number of active slots, returns why, otherwise returns
+    // an empty string.
+    std::string add(const Drp::ResourceUsage &usage, int slot_count, int core_count,
+            int64_t memory_size);
+};
+
+#endif // SLOT_TUNER_HPP
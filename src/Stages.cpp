@@ -0,0 +1,163 @@
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+#include "Stages.hpp"
+
+// Parse a dependency like "render" or "render[-1:1]". Returns whether successful.
+static bool parse_dependency(const std::string &str, const std::vector<Stage> &stages,
+        Dependency &dependency) {
+
+    std::string name = str;
+    dependency.m_low = 0;
+    dependency.m_high = 0;
+
+    std::string::size_type bracket = str.find('[');
+    if (bracket != std::string::npos) {
+        name = str.substr(0, bracket);
+
+        const char *s = str.c_str() + bracket + 1;
+        char *end;
+        dependency.m_low = strtol(s, &end, 10);
+        if (end == s || *end != ':') {
+            return false;
+        }
+        s = end + 1;
+        dependency.m_high = strtol(s, &end, 10);
+        if (end == s || strcmp(end, "]") != 0 || dependency.m_low > dependency.m_high) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < stages.size(); i++) {
+        if (stages[i].m_name == name) {
+            dependency.m_stage = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool parse_stage_line(const std::string &line, const std::vector<Stage> &stages, Stage &stage) {
+    std::vector<std::string> words;
+    if (!split_words(line, words)) {
+        std::cerr << "Unterminated quote in stage: " << line << "\n";
+        return false;
+    }
+    if (words.size() < 2) {
+        std::cerr << "Missing stage name or dependencies: " << line << "\n";
+        return false;
+    }
+
+    stage.m_name = words[0];
+    for (const Stage &other : stages) {
+        if (other.m_name == stage.m_name) {
+            std::cerr << "Stage specified twice: " << stage.m_name << "\n";
+            return false;
+        }
+    }
+
+    // Dependencies on earlier stages only, so there are no cycles.
+    std::string::size_type begin = 0;
+    while (begin <= words[1].size()) {
+        std::string::size_type comma = words[1].find(',', begin);
+        if (comma == std::string::npos) {
+            comma = words[1].size();
+        }
+
+        Dependency dependency;
+        if (!parse_dependency(words[1].substr(begin, comma - begin), stages, dependency)) {
+            std::cerr << "Invalid dependency of stage " << stage.m_name << " (must be an "
+                "earlier stage): " << words[1].substr(begin, comma - begin) << "\n";
+            return false;
+        }
+        stage.m_dependencies.push_back(dependency);
+
+        begin = comma + 1;
+    }
+
+    int i = 2;
+    while (i < words.size() && words[i].compare(0, 2, "--") == 0) {
+        const std::string &flag = words[i++];
+
+        if (flag == "--") {
+            break;
+        } else if (flag == "--in" || flag == "--out") {
+            if (i + 2 > words.size()) {
+                std::cerr << "Must specify two pathnames with " << flag <<
+                    " in stage: " << line << "\n";
+                return false;
+            }
+            FileCopy fileCopy(words[i], words[i + 1]);
+            i += 2;
+
+            const std::string &remote_pathname = flag == "--in" ?
+                fileCopy.m_destination : fileCopy.m_source;
+            if (!is_pathname_local(remote_pathname)) {
+                std::cerr << "Remote pathname must be local with " << flag << ": "
+                    << remote_pathname << "\n";
+                return false;
+            }
+
+            (flag == "--in" ? stage.m_in_copies : stage.m_out_copies).push_back(fileCopy);
+        } else if (flag == "--keep") {
+            if (i + 1 > words.size()) {
+                std::cerr << "Must specify pathname with --keep in stage: " << line << "\n";
+                return false;
+            }
+            if (!is_pathname_local(words[i]) || !string_has_parameter(words[i])) {
+                std::cerr << "Kept pathname must be local and include the frame number: " <<
+                    words[i] << "\n";
+                return false;
+            }
+            stage.m_kept.push_back(words[i++]);
+        } else {
+            std::cerr << "Unknown flag " << flag << " in stage: " << line << "\n";
+            return false;
+        }
+    }
+
+    if (i == words.size()) {
+        std::cerr << "Missing executable in stage: " << line << "\n";
+        return false;
+    }
+    stage.m_executable = words[i++];
+    if (!is_pathname_local(stage.m_executable)) {
+        std::cerr << "Executable must be local: " << stage.m_executable << "\n";
+        return false;
+    }
+    stage.m_arguments.assign(words.begin() + i, words.end());
+
+    return true;
+}
+
+bool load_stages(const std::string &pathname, std::vector<Stage> &stages) {
+    std::ifstream f(pathname);
+    if (!f) {
+        std::cerr << "Can't open stages file " << pathname << "\n";
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(f, line)) {
+        line_number++;
+
+        // Skip blank lines and comments.
+        std::string::size_type begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') {
+            continue;
+        }
+
+        Stage stage;
+        if (!parse_stage_line(line, stages, stage)) {
+            std::cerr << "In line " << line_number << " of stages file " << pathname << "\n";
+            return false;
+        }
+        stages.push_back(stage);
+    }
+
+    return true;
+}
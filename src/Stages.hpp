@@ -0,0 +1,23 @@
+#ifndef STAGES_HPP
+#define STAGES_HPP
+
+#include "Parameters.hpp"
+
+// Load the stages of a job from a file, after the stages already in the
+// list. Each line is a stage:
+//
+//     NAME DEPENDENCIES [--in LOCAL REMOTE]... [--out REMOTE LOCAL]...
+//         [--keep REMOTE]... [--] EXEC [ARGUMENT]...
+//
+// DEPENDENCIES is a comma-separated list of earlier stages, each optionally
+// with a window of frames like "render[-1:1]". Blank lines and lines
+// starting with # are skipped. Returns whether successful. If not, also
+// prints error to standard error.
+bool load_stages(const std::string &pathname, std::vector<Stage> &stages);
+
+// Parse one line of a stages file. Dependencies can only be on the stages
+// in the list. Returns whether successful. If not, also prints error to
+// standard error.
+bool parse_stage_line(const std::string &line, const std::vector<Stage> &stages, Stage &stage);
+
+#endif // STAGES_HPP
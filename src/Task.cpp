@@ -0,0 +1,89 @@
+
+#include "Task.hpp"
+#include "util.hpp"
+
+Task make_frame_task(const Parameters &parameters, int frame, int tile) {
+    Task task;
+    std::map<std::string, int> values = parameters.get_parameter_values(frame, tile);
+
+    // Identify tiles like "50:tx=1,ty=2".
+    task.m_id = std::to_string(frame);
+    for (int i = 0; i < parameters.m_dimensions.size(); i++) {
+        const std::string &name = parameters.m_dimensions[i].m_name;
+        task.m_id += (i == 0 ? ":" : ",") + name + "=" + std::to_string(values[name]);
+    }
+    task.m_frame = frame;
+    task.m_tile = tile;
+
+    for (const std::string &argument : parameters.m_arguments) {
+        task.m_arguments.push_back(substitute_parameters(argument, values));
+    }
+
+    if (!parameters.m_server_key.empty()) {
+        task.m_server_key = substitute_parameters(parameters.m_server_key, values);
+    }
+
+    for (const std::string &word : parameters.m_post_command) {
+        task.m_post_command.push_back(substitute_parameters(word, values));
+    }
+
+    for (const FileCopy &fileCopy : parameters.m_in_copies) {
+        if (fileCopy.has_parameter()) {
+            task.m_in_copies.push_back(FileCopy(substitute_parameters(fileCopy.m_source, values),
+                    substitute_parameters(fileCopy.m_destination, values)));
+        }
+    }
+
+    // Partial results of seed passes stay on the worker to be merged there.
+    for (const FileCopy &fileCopy : parameters.m_out_copies) {
+        if (fileCopy.has_parameter() && parameters.m_merge_command.empty()) {
+            task.m_out_copies.push_back(FileCopy(substitute_parameters(fileCopy.m_source, values),
+                    substitute_parameters(fileCopy.m_destination, values)));
+        }
+    }
+    if (!parameters.m_sink_command.empty() && !task.m_out_copies.empty()) {
+        task.m_sink_copy = 0;
+    }
+
+    return task;
+}
+
+Task make_stage_task(const Parameters &parameters, int stage_index, int frame) {
+    const Stage &stage = parameters.m_stages[stage_index];
+    Task task;
+
+    task.m_id = stage.m_name + ":" + std::to_string(frame);
+    task.m_frame = frame;
+    task.m_stage = stage_index;
+    task.m_executable = substitute_parameter(stage.m_executable, frame);
+
+    for (const std::string &argument : stage.m_arguments) {
+        task.m_arguments.push_back(substitute_parameter(argument, frame));
+    }
+
+    for (const FileCopy &fileCopy : stage.m_in_copies) {
+        task.m_in_copies.push_back(FileCopy(substitute_parameter(fileCopy.m_source, frame),
+                substitute_parameter(fileCopy.m_destination, frame)));
+    }
+
+    for (const FileCopy &fileCopy : stage.m_out_copies) {
+        task.m_out_copies.push_back(FileCopy(substitute_parameter(fileCopy.m_source, frame),
+                substitute_parameter(fileCopy.m_destination, frame)));
+    }
+
+    return task;
+}
+
+bool FrameTaskSource::next(Task &task) {
+    // Move to the next frame once all its tiles are done.
+    if (m_frame == -1 || m_tile == m_tile_count) {
+        if (!m_frame_source.next(m_frame)) {
+            return false;
+        }
+        m_tile = 0;
+    }
+
+    task = make_frame_task(m_parameters, m_frame, m_tile++);
+
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <string>
+#include <vector>
+
+#include "Parameters.hpp"
+#include "Frames.hpp"
+
+// One run of the executable on a worker, with the copies that go with it.
+// Parameters have already been substituted.
+struct Task {
+    // Identifier for reporting: the frame number, or the ID from the manifest.
+    std::string m_id;
+
+    // Frame number, or -1 if the task isn't a frame.
+    int m_frame;
+
+    // Index of the stage in Parameters::m_stages. Always 0 without stages.
+    int m_stage;
+
+    // Tile of the frame (see Parameters::get_tile_count()), or -1 if the
+    // task isn't a tile, such as a merge step.
+    int m_tile;
+
+    // Executable to run instead of the job's, or empty for the job's.
+    std::string m_executable;
+
+    // Whether to only do the copies, without running anything.
+    bool m_copy_only;
+
+    // Arguments to the executable.
+    std::vector<std::string> m_arguments;
+
+    // Key of the server that runs the job's executable (see
+    // Parameters::m_server_key), or empty to run it as a process of its own.
+    std::string m_server_key;
+
+    // Command to run on the worker after the executable, before copying
+    // out, or empty for none.
+    std::vector<std::string> m_post_command;
+
+    // Copies done for this task only.
+    std::vector<FileCopy> m_in_copies;
+    std::vector<FileCopy> m_out_copies;
+
+    // Index of the out copy that goes to the sink (see Sink) instead of its
+    // local file, or -1 for none.
+    int m_sink_copy;
+
+    // Content of that out copy, once it's copied out.
+    std::string m_sink_content;
+
+    // Worker (and its host) that was cancelled for taking too long on the
+    // task, or -1 and empty. They only get the task again if there are no
+    // other workers (or none on other hosts).
+    int m_avoid_worker_id;
+    std::string m_avoid_host;
+
+    // Remote files to delete once the task has succeeded and its files are
+    // copied out.
+    std::vector<std::string> m_remove_pathnames;
+
+    Task()
+        : m_frame(-1), m_stage(0), m_tile(-1), m_copy_only(false), m_sink_copy(-1),
+            m_avoid_worker_id(-1) {
+
+        // Nothing.
+    }
+};
+
+// Make the task for a tile (0 to get_tile_count() - 1) of a frame, from the
+// parameters and the per-frame copies.
+Task make_frame_task(const Parameters &parameters, int frame, int tile);
+
+// Make the task for a later stage (not the first) of a frame.
+Task make_stage_task(const Parameters &parameters, int stage, int frame);
+
+// Produces tasks one at a time, as they're needed.
+class TaskSource {
+public:
+    virtual ~TaskSource() {
+        // Nothing.
+    }
+
+    // Get the next task. Returns false when there are no more.
+    virtual bool next(Task &task) = 0;
+};
+
+// Produces a task for each tile of each frame of the frame specification.
+// All tiles of a frame are produced together.
+class FrameTaskSource : public TaskSource {
+    const Parameters &m_parameters;
+    FrameSource m_frame_source;
+    int m_frame;
+    int m_tile;
+    int m_tile_count;
+
+public:
+    FrameTaskSource(const Parameters &parameters)
+        : m_parameters(parameters), m_frame_source(parameters.m_frames),
+            m_frame(-1), m_tile(0), m_tile_count(parameters.get_tile_count()) {
+
+        // Nothing.
+    }
+
+    virtual bool next(Task &task);
+};
+
+#endif // TASK_HPP
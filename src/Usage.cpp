@@ -0,0 +1,52 @@
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "Usage.hpp"
+
+// Print one line of the report.
+static void print_totals(std::ostream &out, const std::string &name, const UsageTotals &totals) {
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    line << "    " << name << ": " << totals.m_task_count << " tasks, " <<
+        totals.m_user_seconds << " user + " << totals.m_system_seconds << " system seconds in " <<
+        totals.m_wall_seconds << " seconds (" << totals.get_busy_cores() << " cores busy), peak " <<
+        totals.m_max_rss_kb/1024 << " MB, " << totals.m_in_blocks << " blocks in, " <<
+        totals.m_out_blocks << " out, " << totals.m_voluntary_switches << " voluntary and " <<
+        totals.m_involuntary_switches << " involuntary context switches\n";
+    out << line.str();
+}
+
+void UsageTotals::add(const Drp::ResourceUsage &usage) {
+    m_task_count++;
+    m_user_seconds += usage.user_seconds();
+    m_system_seconds += usage.system_seconds();
+    m_wall_seconds += usage.wall_seconds();
+    m_max_rss_kb = std::max(m_max_rss_kb, (int64_t) usage.max_rss_kb());
+    m_in_blocks += usage.in_blocks();
+    m_out_blocks += usage.out_blocks();
+    m_voluntary_switches += usage.voluntary_switches();
+    m_involuntary_switches += usage.involuntary_switches();
+}
+
+void UsageReport::add(const std::string &hostname, const Drp::ResourceUsage &usage) {
+    m_hosts[hostname].add(usage);
+    m_job.add(usage);
+}
+
+void UsageReport::print(std::ostream &out) const {
+    if (m_job.m_task_count == 0) {
+        return;
+    }
+
+    out << "Resource usage:\n";
+    for (const std::pair<const std::string, UsageTotals> &host : m_hosts) {
+        print_totals(out, host.first, host.second);
+    }
+    print_totals(out, "total", m_job);
+}
+
+bool is_memory_hungry(const Drp::ResourceUsage &usage, int64_t memory_size) {
+    return memory_size > 0 && usage.max_rss_kb()*1024 > HIGH_MEMORY_FRACTION*memory_size;
+}
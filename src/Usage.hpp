@@ -0,0 +1,65 @@
+#ifndef USAGE_HPP
+#define USAGE_HPP
+
+#include <map>
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+#include "Drp.pb.h"
+
+// A task whose processes peaked at more than this fraction of their
+// machine's memory is reported, since a bigger one might run out.
+static const double HIGH_MEMORY_FRACTION = 0.5;
+
+// Resources used by a number of tasks.
+struct UsageTotals {
+    int m_task_count;
+    double m_user_seconds;
+    double m_system_seconds;
+    double m_wall_seconds;
+
+    // Largest of the tasks' peak resident set sizes, in kilobytes.
+    int64_t m_max_rss_kb;
+
+    int64_t m_in_blocks;
+    int64_t m_out_blocks;
+    int64_t m_voluntary_switches;
+    int64_t m_involuntary_switches;
+
+    UsageTotals()
+        : m_task_count(0), m_user_seconds(0), m_system_seconds(0), m_wall_seconds(0),
+            m_max_rss_kb(0), m_in_blocks(0), m_out_blocks(0),
+            m_voluntary_switches(0), m_involuntary_switches(0) {
+
+        // Nothing.
+    }
+
+    // Add the usage of one task.
+    void add(const Drp::ResourceUsage &usage);
+
+    // Average number of cores the tasks kept busy while they ran, or 0 if unknown.
+    double get_busy_cores() const {
+        return m_wall_seconds > 0 ? (m_user_seconds + m_system_seconds)/m_wall_seconds : 0;
+    }
+};
+
+// Resources used by the tasks of a job, per host and in total.
+class UsageReport {
+    std::map<std::string, UsageTotals> m_hosts;
+    UsageTotals m_job;
+
+public:
+    // Add the usage of a task that ran on the host.
+    void add(const std::string &hostname, const Drp::ResourceUsage &usage);
+
+    // Print a line per host and one for the whole job. Prints nothing if no
+    // task reported its usage.
+    void print(std::ostream &out) const;
+};
+
+// Whether the usage's peak memory is a large enough part of the machine's
+// memory size (in bytes, 0 if unknown) to warn about.
+bool is_memory_hungry(const Drp::ResourceUsage &usage, int64_t memory_size);
+
+#endif // USAGE_HPP
@@ -2,27 +2,282 @@
 #include <netinet/in.h>
 #include <poll.h>
 #include <set>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <climits>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "controller.hpp"
 #include "Drp.pb.h"
 #include "RemoteWorker.hpp"
 #include "Parameters.hpp"
+#include "Task.hpp"
+#include "Job.hpp"
+#include "DiskIo.hpp"
+#include "SharedInputs.hpp"
+#include "BufferPool.hpp"
+#include "IncomingBuffer.hpp"
+#include "Usage.hpp"
+#include "SlotTuner.hpp"
+#include "FairShare.hpp"
+
+// How often to check on gather and final commands while they run, in milliseconds.
+static const int GATHER_POLL_MS = 100;
+
+// Number of tasks at the front of the queue whose inputs are read ahead.
+static const int READ_AHEAD_TASK_COUNT = 2;
+
+// A submit command that connected to the queue, whose request is still
+// coming in.
+struct SubmitClient {
+    int m_fd;
+    IncomingBuffer m_incoming_buffer;
+
+    SubmitClient(int fd, BufferPool &pool)
+        : m_fd(fd), m_incoming_buffer(fd, pool) {
+
+        // Nothing.
+    }
+};
+
+// The job the worker is working for, or null if none.
+static Job *get_worker_job(const std::map<int, Job *> &worker_jobs,
+        const RemoteWorker *remote_worker) {
+
+    std::map<int, Job *>::const_iterator itr = worker_jobs.find(remote_worker->get_id());
+    return itr == worker_jobs.end() ? nullptr : itr->second;
+}
+
+// The workers working for the job.
+static std::vector<RemoteWorker *> get_job_workers(const std::vector<RemoteWorker *> &remote_workers,
+        const std::map<int, Job *> &worker_jobs, const Job *job) {
+
+    std::vector<RemoteWorker *> job_workers;
+    for (RemoteWorker *remote_worker : remote_workers) {
+        if (get_worker_job(worker_jobs, remote_worker) == job) {
+            job_workers.push_back(remote_worker);
+        }
+    }
+
+    return job_workers;
+}
+
+// Returns the idle worker with the most capacity, or null if none is idle.
+// Prefers workers that already work for the job, so that they needn't switch.
+// Skips workers whose machines are already committed to other work, or, if
+// there are slot tuners, already run as many tasks as their tuner allows,
+// and the workers in refused_workers.
+static RemoteWorker *get_idle_worker(const std::vector<RemoteWorker *> &remote_workers,
+        std::map<std::string, SlotTuner> *slot_tuners, const std::map<int, Job *> &worker_jobs,
+        const Job *job, const std::set<RemoteWorker *> &refused_workers) {
+
+    // Tasks running on each machine.
+    std::map<std::string, int> running;
+    if (slot_tuners != nullptr) {
+        for (RemoteWorker *remote_worker : remote_workers) {
+            if (remote_worker->has_task() || remote_worker->has_pending_task()) {
+                running[remote_worker->hostname()]++;
+            }
+        }
+    }
+
+    RemoteWorker *best = nullptr;
+    bool best_on_job = false;
 
-// Returns any idle worker, or null if none is idle.
-static RemoteWorker *get_idle_worker(const std::vector<RemoteWorker *> &remote_workers) {
     for (RemoteWorker *remote_worker : remote_workers) {
-        if (remote_worker->is_idle()) {
-            return remote_worker;
+        bool on_job = get_worker_job(worker_jobs, remote_worker) == job;
+        if (remote_worker->is_idle() && !remote_worker->is_overcommitted() &&
+                refused_workers.find(remote_worker) == refused_workers.end() &&
+                (slot_tuners == nullptr || running[remote_worker->hostname()] <
+                    (*slot_tuners)[remote_worker->hostname()].get_active()) &&
+                (best == nullptr || (on_job && !best_on_job) || (on_job == best_on_job &&
+                    remote_worker->capacity() > best->capacity()))) {
+
+            best = remote_worker;
+            best_on_job = on_job;
         }
     }
 
-    return nullptr;
+    return best;
 }
 
-// Returns true iff any worker is non-idle. Returns false if all workers are idle.
-static bool any_worker_working(const std::vector<RemoteWorker *> &remote_workers) {
+// Whether the remaining frames are better left for busy workers that would
+// finish them sooner than this idle one could. This only kicks in at the tail
+// of the job, and only once we know how long frames take. The work per frame
+// is in units of calibration benchmark runs.
+static bool should_hold_frame(const std::vector<RemoteWorker *> &remote_workers,
+        const RemoteWorker *idle_worker, int frames_left, double work_per_frame) {
+
+    if (work_per_frame <= 0 || !idle_worker->is_calibrated()) {
+        return false;
+    }
+
+    double idle_seconds = idle_worker->estimate_frame_seconds(work_per_frame);
+
+    // Count busy workers that could finish their frame and then another one
+    // before the idle worker could finish one.
+    int faster_count = 0;
     for (RemoteWorker *remote_worker : remote_workers) {
-        if (!remote_worker->is_idle()) {
+        if (remote_worker->has_task() && remote_worker->is_calibrated()) {
+            double seconds = remote_worker->estimate_frame_seconds(work_per_frame);
+            double remaining = std::max(0.0, seconds - remote_worker->get_task_elapsed());
+            if (remaining + seconds < idle_seconds) {
+                faster_count++;
+            }
+        }
+    }
+
+    return frames_left <= faster_count;
+}
+
+// Remove and return the queued task that best suits the worker: one whose
+// inputs the worker already has, a seed pass of a frame whose other passes
+// it holds (so they merge there instead of being relayed), or one whose
+// frame directly follows its last frame. Tasks whose inputs other workers
+// already have are avoided, so that groups of tasks spread across workers.
+// Only looks at the first few tasks of the queue so that tasks aren't
+// starved. Skips tasks that the worker or its host was cancelled on, unless
+// there's no other worker or host. Returns false if there's no task for
+// the worker.
+static bool take_task(std::deque<Task> &tasks, const Merge &merge,
+        const RemoteWorker *remote_worker, const std::vector<RemoteWorker *> &remote_workers,
+        Task &task) {
+
+    const std::string &hostname = remote_worker->hostname();
+    bool has_other_worker = remote_workers.size() > 1;
+    bool has_other_host = false;
+    for (RemoteWorker *other_worker : remote_workers) {
+        if (other_worker->hostname() != hostname) {
+            has_other_host = true;
+            break;
+        }
+    }
+
+    int best_index = -1;
+    int best_score = 0;
+
+    int window = std::min<int>(tasks.size(), LOCALITY_WINDOW);
+    for (int i = 0; i < window; i++) {
+        if ((has_other_host && tasks[i].m_avoid_host == hostname) ||
+                (has_other_worker && tasks[i].m_avoid_worker_id == remote_worker->get_id())) {
+
+            continue;
+        }
+
+        const std::vector<FileCopy> &inputs = tasks[i].m_in_copies;
+        int score = 2*remote_worker->count_held_inputs(inputs);
+        score += 2*merge.count_partials(tasks[i], remote_worker->get_id());
+        if (remote_worker->is_next_frame(tasks[i].m_frame)) {
+            score += 1;
+        }
+        if (!inputs.empty()) {
+            for (RemoteWorker *other_worker : remote_workers) {
+                if (other_worker != remote_worker) {
+                    score -= other_worker->count_held_inputs(inputs);
+                }
+            }
+        }
+
+        if (best_index == -1 || score > best_score) {
+            best_index = i;
+            best_score = score;
+        }
+    }
+
+    if (best_index == -1) {
+        return false;
+    }
+
+    task = tasks[best_index];
+    tasks.erase(tasks.begin() + best_index);
+
+    return true;
+}
+
+// Send each worker that's running an executable the inputs of a queued task
+// that no other worker has, so that it has them when it's done. take_task()
+// then prefers the worker for that task.
+static void prefetch_tasks(const std::deque<Task> &tasks,
+        const std::vector<RemoteWorker *> &remote_workers) {
+
+    for (RemoteWorker *remote_worker : remote_workers) {
+        if (!remote_worker->can_prefetch()) {
+            continue;
+        }
+
+        int window = std::min<int>(tasks.size(), LOCALITY_WINDOW);
+        for (int i = 0; i < window; i++) {
+            const std::vector<FileCopy> &inputs = tasks[i].m_in_copies;
+            if (inputs.empty() || remote_worker->count_held_inputs(inputs) == inputs.size()) {
+                continue;
+            }
+
+            bool held_elsewhere = false;
+            for (RemoteWorker *other_worker : remote_workers) {
+                if (other_worker != remote_worker && other_worker->count_held_inputs(inputs) > 0) {
+                    held_elsewhere = true;
+                    break;
+                }
+            }
+
+            if (!held_elsewhere) {
+                remote_worker->prefetch(tasks[i]);
+                break;
+            }
+        }
+    }
+}
+
+// Report a finished task to the user and to the results file, if any.
+static void report_task(const Task &task, int status, const RemoteWorker &remote_worker,
+        double seconds, const Drp::ResourceUsage &usage, std::ofstream &results) {
+
+    const std::string &hostname = remote_worker.hostname();
+    if (status != 0) {
+        std::cout << "Task " << task.m_id << " failed on " << hostname <<
+            " (status " << status << ").\n";
+    }
+    if (is_memory_hungry(usage, remote_worker.memory_size())) {
+        std::cout << "Warning: Task " << task.m_id << " used " << usage.max_rss_kb()/1024 <<
+            " MB on " << hostname << ", over half of its memory.\n";
+    }
+
+    if (results.is_open()) {
+        results << task.m_id << "\t" << status << "\t" << hostname << "\t" << seconds <<
+            "\t" << usage.user_seconds() + usage.system_seconds() << "\t" <<
+            usage.max_rss_kb() << "\n";
+        results.flush();
+    }
+}
+
+// Let the slot tuner of the worker's host know about a task it finished,
+// and log its decision, if any.
+static void tune_slots(std::map<std::string, SlotTuner> &slot_tuners,
+        const std::vector<RemoteWorker *> &remote_workers, const RemoteWorker &remote_worker,
+        const Drp::ResourceUsage &usage) {
+
+    const std::string &hostname = remote_worker.hostname();
+    int slot_count = std::count_if(remote_workers.begin(), remote_workers.end(),
+            [&hostname](const RemoteWorker *other) { return other->hostname() == hostname; });
+
+    std::string decision = slot_tuners[hostname].add(usage, slot_count,
+            remote_worker.core_count(), remote_worker.memory_size());
+    if (!decision.empty()) {
+        std::cout << "Slots on " << hostname << ": " << decision << "\n";
+    }
+}
+
+// Returns true iff any worker of the job is non-idle. Proxy connections
+// still waiting for a worker don't count, since the proxy may keep them
+// waiting for as long as other controllers use its workers.
+static bool any_worker_working(const std::vector<RemoteWorker *> &remote_workers,
+        const std::map<int, Job *> &worker_jobs, const Job *job) {
+
+    for (RemoteWorker *remote_worker : remote_workers) {
+        if (!remote_worker->is_idle() && remote_worker->get_proxy_index() == -1 &&
+                get_worker_job(worker_jobs, remote_worker) == job) {
             return true;
         }
     }
@@ -30,25 +285,153 @@ static bool any_worker_working(const std::vector<RemoteWorker *> &remote_workers
     return false;
 }
 
-// Remove the remote worker from our list.
+// Number of workers running the job's tasks or switching to the job to run one.
+static int count_running(const std::vector<RemoteWorker *> &remote_workers,
+        const std::map<int, Job *> &worker_jobs, const Job *job) {
+
+    int count = 0;
+    for (RemoteWorker *remote_worker : remote_workers) {
+        if ((remote_worker->has_task() || remote_worker->has_pending_task()) &&
+                get_worker_job(worker_jobs, remote_worker) == job) {
+
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Run the job's task on the idle worker, first switching the worker to the
+// job if it works for another one or for none.
+static void run_job_task(RemoteWorker *remote_worker, Job &job, const Task &task,
+        std::map<int, Job *> &worker_jobs) {
+
+    if (get_worker_job(worker_jobs, remote_worker) == &job) {
+        remote_worker->run_task(task);
+        return;
+    }
+
+    std::cout << "Switching " << remote_worker->hostname() << " to job " << job.m_id << "\n";
+    worker_jobs[remote_worker->get_id()] = &job;
+    remote_worker->load_job(job.m_parameters, job.m_shared_inputs, task);
+}
+
+// Remove the remote worker from our list. A worker that failed because of
+// its job fails the job.
 static void kill_worker(std::vector<RemoteWorker *> &remote_workers,
-        std::deque<int> &frames, int index) {
+        std::map<int, Job *> &worker_jobs, const std::vector<Job *> &jobs, int index) {
 
     RemoteWorker *remote_worker = remote_workers[index];
+    Job *job = get_worker_job(worker_jobs, remote_worker);
+    if (remote_worker->is_job_error() && job != nullptr && !job->m_failed) {
+        job->fail();
+    }
 
-    int frame = remote_worker->get_frame();
-    if (frame == -1) {
+    if (remote_worker->hostname().empty()) {
         std::cout << "Warning: Pending connection disconnected. Proxy must have died.\n";
+    } else if (remote_worker->has_failed()) {
+        std::cout << "Dropping worker from " << remote_worker->hostname() << ".\n";
+    } else if (!remote_worker->has_task() && !remote_worker->has_pending_task()) {
+        std::cout << "Idle worker from " << remote_worker->hostname() << " is dead.\n";
     } else {
+        const Task &task = remote_worker->has_task() ?
+            remote_worker->get_task() : remote_worker->get_pending_task();
         std::cout << "Worker from " << remote_worker->hostname() <<
-            " working on frame " << frame << " is dead.\n";
-        frames.push_front(frame);
+            " working on " << (task.m_frame == -1 ? "task " : "frame ") << task.m_id <<
+            " is dead.\n";
     }
 
+    // Merge steps and pinned stages are redone by the merge or graph,
+    // from whatever inputs survived.
+    if (remote_worker->has_task() || remote_worker->has_pending_task()) {
+        const Task &task = remote_worker->has_task() ?
+            remote_worker->get_task() : remote_worker->get_pending_task();
+        if (!job->m_failed && !job->m_merge.is_step(task) && !job->m_graph.is_pinned(task)) {
+            job->m_tasks.push_front(task);
+        }
+    }
+    for (Job *other_job : jobs) {
+        other_job->m_merge.worker_died(remote_worker->get_id(), other_job->m_tasks);
+        other_job->m_graph.worker_died(remote_worker->get_id(), other_job->m_tasks);
+    }
+
+    worker_jobs.erase(remote_worker->get_id());
     remote_workers.erase(remote_workers.begin() + index);
     delete remote_worker;
 }
 
+// Tell the submit command how a job went, if it's still there.
+static void send_submit_response(int fd, int status) {
+    Drp::SubmitResponse response;
+    response.set_status(status);
+
+    std::vector<uint8_t> buffer;
+    if (send_message(fd, response, buffer) == -1) {
+        std::cout << "Warning: Submit command went away.\n";
+    }
+}
+
+// Take a job from the request of a submit command. Flags that concern the
+// workers come from the queue's parameters. Returns null if it can't be run,
+// after telling the submit command.
+static Job *receive_job(int fd, const Drp::SubmitRequest &request,
+        const Parameters &queue_parameters, int id, DiskIo &disk_io) {
+
+    // Local pathnames are relative to our directory, and that's the only
+    // one we can use while other jobs run.
+    char directory[PATH_MAX];
+    if (getcwd(directory, sizeof(directory)) == nullptr || request.directory() != directory) {
+        std::cerr << "Error: Job from " << request.directory() <<
+            " must be submitted from " << directory << ".\n";
+        send_submit_response(fd, 1);
+        close(fd);
+        return nullptr;
+    }
+
+    std::vector<std::string> arguments(request.argument().begin(), request.argument().end());
+    Parameters parameters;
+    int status = parameters.parse_job(arguments);
+    if (status == 0 && !parameters.m_queue.empty()) {
+        std::cerr << "Error: Submitted jobs can't have a queue of their own.\n";
+        status = 1;
+    }
+    if (status == 0 && parameters.m_calibration_frame != -1) {
+        std::cerr << "Error: Submitted jobs can't have --calibrate-frame.\n";
+        status = 1;
+    }
+    if (status != 0) {
+        send_submit_response(fd, status);
+        close(fd);
+        return nullptr;
+    }
+
+    // Workers calibrate as the queue says, since they keep it across jobs.
+    parameters.m_calibrate = queue_parameters.m_calibrate;
+
+    Job *job = new Job(id, parameters, disk_io);
+    job->m_client_fd = fd;
+    if (request.priority() > 0) {
+        job->m_priority = request.priority();
+    }
+    if (request.weight() > 0) {
+        job->m_weight = request.weight();
+    }
+    if (!job->start()) {
+        send_submit_response(fd, 1);
+        delete job;
+        return nullptr;
+    }
+
+    std::cout << "Job " << job->m_id << " submitted (priority " << job->m_priority <<
+        ", weight " << job->m_weight << "):";
+    for (const std::string &argument : arguments) {
+        std::cout << " " << argument;
+    }
+    std::cout << "\n";
+
+    return job;
+}
+
 // Start the controller. Returns program exit code.
 int start_controller(Parameters &parameters) {
     // Resolve endpoints.
@@ -69,14 +452,57 @@ int start_controller(Parameters &parameters) {
         return -1;
     }
 
-    // Get all frames.
-    std::deque<int> frames = parameters.m_frames.get_all();
+    // Worker speeds from previous runs.
+    Calibration calibration(parameters.m_calibration_cache);
+    calibration.load();
+
+    // Reads and writes files for the workers in the background.
+    DiskIo disk_io;
+
+    // Files that workers working for no job get: none.
+    SharedInputs idle_inputs(disk_io);
+
+    // Memory for messages to and from workers.
+    BufferPool buffer_pool(parameters.m_buffer_memory);
+
+    // How many tasks to run at once on each host, by hostname.
+    std::map<std::string, SlotTuner> slot_tuners;
 
-    // Our list of remote workers.
+    // Jobs being run, in the order they came, and the identifier of the next one.
+    std::vector<Job *> jobs;
+    int next_job_id = 1;
+
+    // Jobs come from the command line, or from submit commands on the queue.
+    int queue_fd = -1;
+    std::vector<SubmitClient *> submit_clients;
+    if (parameters.m_queue.empty()) {
+        Job *job = new Job(next_job_id++, parameters, disk_io);
+        if (!job->start()) {
+            return -1;
+        }
+        jobs.push_back(job);
+    } else {
+        queue_fd = create_unix_server_socket(parameters.m_queue);
+        if (queue_fd == -1) {
+            return -1;
+        }
+        std::cout << "Waiting for jobs on " << parameters.m_queue << "\n";
+    }
+
+    // Exit status of the last job done.
+    int status = 0;
+
+    // Our list of remote workers, and the job each one works for. Workers
+    // that have never been given a task of the queue work for none.
     std::vector<RemoteWorker *> remote_workers;
+    std::map<int, Job *> worker_jobs;
+
+    // Keep going as long as there are jobs, or forever with a queue.
+    while (!jobs.empty() || queue_fd != -1) {
+        for (Job *job : jobs) {
+            job->fill_tasks();
+        }
 
-    // Keep going as long as there are frames to be done or workers working on frames.
-    while (!frames.empty() || any_worker_working(remote_workers)) {
         // Create blocking (non-connected) connections to proxies, if necessary.
         std::set<int> proxy_indices;
 
@@ -93,6 +519,13 @@ int start_controller(Parameters &parameters) {
             }
         }
 
+        // New workers work for the only job, if we're not a queue.
+        Job *first_job = queue_fd == -1 ? jobs[0] : nullptr;
+        const Parameters &worker_parameters = first_job == nullptr ?
+            parameters : first_job->m_parameters;
+        SharedInputs &worker_inputs = first_job == nullptr ?
+            idle_inputs : first_job->m_shared_inputs;
+
         // Whatever's left, create a connection for.
         for (int proxy_index : proxy_indices) {
             // Start a worker connection for each proxy.
@@ -101,34 +534,134 @@ int start_controller(Parameters &parameters) {
                 return -1;
             }
 
-            RemoteWorker *remote_worker = new RemoteWorker(proxy_fd, parameters);
+            // Tell the proxy whose share the worker counts against.
+            Drp::ProxyHello hello;
+            hello.set_name(parameters.m_proxy_name);
+            std::vector<uint8_t> buffer;
+            if (send_message(proxy_fd, hello, buffer) == -1) {
+                perror("send_message");
+                return -1;
+            }
+
+            RemoteWorker *remote_worker = new RemoteWorker(proxy_fd, worker_parameters,
+                    calibration, disk_io, worker_inputs, buffer_pool);
             remote_worker->set_proxy_index(proxy_index);
+            if (first_job != nullptr) {
+                worker_jobs[remote_worker->get_id()] = first_job;
+            }
             remote_worker->start();
             remote_workers.push_back(remote_worker);
         }
 
-        // Poll entry for every worker, plus our listening socket.
+        // Poll entry for every worker, plus our listening socket, plus
+        // finished disk reads and writes, plus the sinks that have something
+        // to write, plus the queue.
         std::vector<struct pollfd> pollfds(1 + remote_workers.size());
+        int disk_io_index = pollfds.size();
+        pollfds.push_back(pollfd { disk_io.get_fd(), POLLIN, 0 });
+        std::vector<int> sink_indices;
+        bool local_commands = false;
+        for (Job *job : jobs) {
+            sink_indices.push_back(-1);
+            if (job->m_sink.need_send()) {
+                sink_indices.back() = pollfds.size();
+                pollfds.push_back(pollfd { job->m_sink.get_fd(), POLLOUT, 0 });
+            }
+            local_commands |= job->m_gather.is_busy() || job->m_final_pid != -1 ||
+                (job->m_finished && job->m_sink.is_running());
+        }
+        int queue_index = -1;
+        if (queue_fd != -1) {
+            queue_index = pollfds.size();
+            pollfds.push_back(pollfd { queue_fd, POLLIN, 0 });
+        }
+        int submit_index = pollfds.size();
+        for (SubmitClient *submit_client : submit_clients) {
+            IncomingBuffer &incoming_buffer = submit_client->m_incoming_buffer;
+            pollfds.push_back(pollfd { submit_client->m_fd,
+                    (short) (incoming_buffer.retry() ? POLLIN : 0), 0 });
+        }
 
         // Listening socket.
         pollfds[0].fd = sock_fd;
         pollfds[0].events = POLLIN;
         pollfds[0].revents = 0;
 
-        // Worker sockets.
+        // Worker sockets. Workers that waited for buffers may now have some.
         for (int i = 0; i < remote_workers.size(); i++) {
+            remote_workers[i]->retry_deferred();
             remote_workers[i]->fill_pollfd(pollfds[i + 1]);
         }
 
-        // Wait for event on any file descriptor.
-        int result = poll(pollfds.data(), pollfds.size(), -1);
+        // Wait for event on any file descriptor. Wake up periodically to
+        // refresh the load of idle workers and to check on local commands.
+        int result = poll(pollfds.data(), pollfds.size(),
+                local_commands ? GATHER_POLL_MS : STATUS_INTERVAL_S*1000);
         if (result == -1) {
             perror("poll");
             return -1;
         }
 
+        // Let workers carry on with the files they were waiting for.
+        if (pollfds[disk_io_index].revents != 0) {
+            disk_io.collect();
+            for (RemoteWorker *remote_worker : remote_workers) {
+                if (remote_worker->is_waiting_for_disk()) {
+                    remote_worker->disk_io_done();
+                }
+            }
+        }
+
+        for (int i = 0; i < jobs.size(); i++) {
+            if (sink_indices[i] != -1 && pollfds[sink_indices[i]].revents != 0) {
+                jobs[i]->m_sink.send();
+            }
+        }
+
+        // New jobs, once their submit command's request is all in. A slow
+        // submit command mustn't hold up the workers.
+        for (int i = submit_clients.size() - 1; i >= 0; i--) {
+            SubmitClient *submit_client = submit_clients[i];
+            IncomingBuffer &incoming_buffer = submit_client->m_incoming_buffer;
+            if (pollfds[submit_index + i].revents == 0) {
+                continue;
+            }
+
+            Drp::SubmitRequest request;
+            if (!incoming_buffer.receive()) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    continue;
+                }
+                perror("receive");
+                close(submit_client->m_fd);
+            } else if (incoming_buffer.need_receive()) {
+                continue;
+            } else if (!incoming_buffer.get_message(request)) {
+                std::cerr << "Error: Can't parse submitted job.\n";
+                close(submit_client->m_fd);
+            } else {
+                Job *job = receive_job(submit_client->m_fd, request, parameters,
+                        next_job_id++, disk_io);
+                if (job != nullptr) {
+                    jobs.push_back(job);
+                }
+            }
+            submit_clients.erase(submit_clients.begin() + i);
+            delete submit_client;
+        }
+        if (queue_index != -1 && pollfds[queue_index].revents != 0) {
+            // The response at the end of the job is small enough to send
+            // on the non-blocking socket.
+            int client_fd = accept4(queue_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (client_fd == -1) {
+                perror("accept");
+            } else {
+                submit_clients.push_back(new SubmitClient(client_fd, buffer_pool));
+            }
+        }
+
         // Go backward so we can delete dead workers.
-        for (int i = pollfds.size() - 1; i >= 0; i--) {
+        for (int i = remote_workers.size(); i >= 0; i--) {
             // printf("%d: %x\n", i, pollfds[i].revents);
             short revents = pollfds[i].revents;
 
@@ -139,24 +672,30 @@ int start_controller(Parameters &parameters) {
                     struct sockaddr_in remote_addr;
                     socklen_t remote_addr_len = sizeof(remote_addr);
                     int connfd = accept(sock_fd, (struct sockaddr *) &remote_addr, &remote_addr_len);
-                    if (result == -1) {
+                    if (connfd == -1) {
+                        // Such as a worker that gave up before we got to it.
                         perror("accept");
-                        return -1;
-                    }
+                    } else {
+                        set_keepalive(connfd);
 
-                    RemoteWorker *remote_worker = new RemoteWorker(connfd, parameters);
-                    remote_workers.push_back(remote_worker);
-                    remote_worker->start();
+                        RemoteWorker *remote_worker = new RemoteWorker(connfd, worker_parameters,
+                                calibration, disk_io, worker_inputs, buffer_pool);
+                        remote_workers.push_back(remote_worker);
+                        if (first_job != nullptr) {
+                            worker_jobs[remote_worker->get_id()] = first_job;
+                        }
+                        remote_worker->start();
+                    }
                 } else {
+                    // Any error means the worker is gone, such as a keepalive
+                    // timeout on a machine that lost power.
                     success = remote_workers[i - 1]->receive();
                     if (!success) {
-                        if (errno == ECONNRESET) {
-                            // Other side disconnected.
-                            kill_worker(remote_workers, frames, i - 1);
-                        } else {
+                        if (errno != ECONNRESET) {
                             perror("worker receive");
-                            return -1;
                         }
+                        kill_worker(remote_workers, worker_jobs, jobs, i - 1);
+                        continue;
                     }
                 }
             }
@@ -168,26 +707,244 @@ int start_controller(Parameters &parameters) {
                     success = remote_workers[i - 1]->send();
                     if (!success) {
                         perror("worker send");
-                        return -1;
+                        kill_worker(remote_workers, worker_jobs, jobs, i - 1);
+                        continue;
                     }
                 }
             }
             if ((revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
                 // Socket is dead, kill the worker.
                 if (i > 0) {
-                    kill_worker(remote_workers, frames, i - 1);
+                    kill_worker(remote_workers, worker_jobs, jobs, i - 1);
+                }
+            }
+        }
+
+        // Report finished tasks, and learn how long they take on calibrated workers.
+        for (RemoteWorker *remote_worker : remote_workers) {
+            Job *job = get_worker_job(worker_jobs, remote_worker);
+            Task task;
+            int task_status;
+            double seconds;
+            Drp::ResourceUsage usage;
+            if (remote_worker->take_completed_task(task, task_status, seconds, usage)) {
+                report_task(task, task_status, *remote_worker, seconds, usage, job->m_results);
+                if (usage.has_wall_seconds()) {
+                    job->m_usage_report.add(remote_worker->hostname(), usage);
+                }
+
+                // Only tasks of a manifest may fail.
+                if (task_status != 0 && job->m_parameters.m_manifest.empty()) {
+                    std::cerr << "Error: Failed to execute program (status " <<
+                        task_status << ").\n";
+                    if (queue_fd == -1) {
+                        return -1;
+                    }
+                    job->fail();
                 }
+
+                // Steps that merge or move results, rather than the job's own tasks.
+                bool is_step = job->m_merge.is_step(task) || job->m_graph.is_relay(task) ||
+                    job->m_graph.is_removal(task);
+                if (task_status == 0 && !job->m_failed) {
+                    bool output_done = job->m_parameters.m_merge_command.empty() ?
+                        !is_step && task.m_stage == 0 :
+                        job->m_merge.task_done(task, remote_worker->get_id(), job->m_tasks);
+                    job->m_graph.task_done(task, remote_worker->get_id(), job->m_tasks);
+                    if (output_done) {
+                        job->m_gather.task_done(task);
+                        job->m_sink.frame_done(task);
+                    }
+                }
+
+                if (task_status == 0 && !is_step && task.m_stage == 0) {
+                    job->m_frame_times.add(seconds);
+                    if (!parameters.m_fixed_slots) {
+                        tune_slots(slot_tuners, remote_workers, *remote_worker, usage);
+                    }
+                    if (remote_worker->is_calibrated()) {
+                        job->m_total_work += remote_worker->get_frame_work(seconds);
+                        job->m_work_count++;
+                    }
+                }
+            }
+
+            // Tasks cancelled for taking too long go to the front of the queue,
+            // for another host.
+            if (remote_worker->take_cancelled_task(task) && !job->m_failed) {
+                task.m_avoid_worker_id = remote_worker->get_id();
+                task.m_avoid_host = remote_worker->hostname();
+                job->m_tasks.push_front(task);
+            }
+        }
+
+        // Give up on workers that stopped talking, such as machines that lost
+        // power, and on the frames of living workers that take far longer
+        // than frames usually do. Each task is only cancelled once, in case
+        // it's just a long one.
+        for (int i = remote_workers.size() - 1; i >= 0; i--) {
+            RemoteWorker *remote_worker = remote_workers[i];
+            if (remote_worker->is_unresponsive()) {
+                std::cout << "Worker from " << remote_worker->hostname() <<
+                    " stopped responding.\n";
+                kill_worker(remote_workers, worker_jobs, jobs, i);
+                continue;
+            }
+            if (remote_worker->has_failed()) {
+                // The error was already reported.
+                if (remote_worker->is_job_error() && queue_fd == -1) {
+                    return -1;
+                }
+                kill_worker(remote_workers, worker_jobs, jobs, i);
+                continue;
+            }
+
+            Job *job = get_worker_job(worker_jobs, remote_worker);
+            double timeout = job == nullptr ? 0 : job->m_frame_times.get_timeout();
+            if (timeout > 0 && remote_worker->can_cancel() &&
+                    remote_worker->get_task_elapsed() > timeout) {
+
+                const Task &task = remote_worker->get_task();
+                if (task.m_stage == 0 && !job->m_merge.is_step(task) &&
+                        job->m_timed_out_ids.insert(task.m_id).second) {
+
+                    std::cout << "Task " << task.m_id << " on " << remote_worker->hostname() <<
+                        " is taking over " << (int) timeout << " seconds, moving it.\n";
+                    remote_worker->cancel_task();
+                }
+            }
+        }
+
+        // Wrap up jobs that are done, and say goodbye to them once their
+        // final commands are done too.
+        for (int i = jobs.size() - 1; i >= 0; i--) {
+            Job *job = jobs[i];
+            job->m_gather.reap();
+            if (job->m_sink.has_error() && !job->m_failed) {
+                if (queue_fd == -1) {
+                    return -1;
+                }
+                job->fail();
+            }
+            if (job->m_failed) {
+                // Merges and stages may have queued more.
+                job->m_tasks.clear();
+            }
+
+            if (!job->m_finished) {
+                if (job->has_work_left() || any_worker_working(remote_workers, worker_jobs, job)) {
+                    continue;
+                }
+                job->finish();
+            }
+            if (!job->is_done()) {
+                continue;
+            }
+
+            status = job->m_status;
+            if (queue_fd != -1) {
+                std::cout << "Job " << job->m_id << " is done (status " << status << ").\n";
+            }
+            if (job->m_client_fd != -1) {
+                send_submit_response(job->m_client_fd, status);
+            }
+
+            // Its workers keep its files but can't point to it anymore.
+            for (RemoteWorker *remote_worker : get_job_workers(remote_workers, worker_jobs, job)) {
+                remote_worker->unload_job(parameters, idle_inputs);
+                worker_jobs.erase(remote_worker->get_id());
             }
+            jobs.erase(jobs.begin() + i);
+            delete job;
         }
 
-        // Hand out frames to any available worker.
-        RemoteWorker *remote_worker;
-        while (!frames.empty() && (remote_worker = get_idle_worker(remote_workers)) != nullptr) {
-            int frame = frames.front();
-            frames.pop_front();
-            remote_worker->run_frame(frame);
+        // Merge steps and later stages go to the worker with their inputs,
+        // however busy it is.
+        for (RemoteWorker *pinned_worker : remote_workers) {
+            Task task;
+            int id = pinned_worker->get_id();
+            for (Job *job : jobs) {
+                if (pinned_worker->is_idle() && !job->m_failed &&
+                        (job->m_merge.take_pinned_task(id, task) ||
+                         job->m_graph.take_pinned_task(id, task))) {
+
+                    run_job_task(pinned_worker, *job, task, worker_jobs);
+                }
+            }
+        }
+
+        // Hand out tasks to any available worker. Jobs take turns as their
+        // priorities and weights say. A job that holds its last frames for
+        // faster workers sits out the rest of the turns, as does one whose
+        // tasks no idle worker may take.
+        std::set<Job *> holding_jobs;
+        std::map<Job *, std::set<RemoteWorker *>> refused_workers;
+        for (;;) {
+            std::vector<Share> shares;
+            for (Job *job : jobs) {
+                bool wants_worker = !job->m_failed && job->fill_tasks() &&
+                    holding_jobs.find(job) == holding_jobs.end();
+                shares.push_back(Share { job->m_priority, (double) job->m_weight,
+                        count_running(remote_workers, worker_jobs, job), 0, -1, wants_worker });
+            }
+            int index = choose_share(shares);
+            if (index == -1) {
+                break;
+            }
+            Job &job = *jobs[index];
+
+            RemoteWorker *remote_worker = get_idle_worker(remote_workers,
+                    parameters.m_fixed_slots ? nullptr : &slot_tuners, worker_jobs, &job,
+                    refused_workers[&job]);
+            if (remote_worker == nullptr) {
+                if (refused_workers[&job].empty()) {
+                    break;
+                }
+                holding_jobs.insert(&job);
+                continue;
+            }
+
+            // We only know how many tasks are left once the source is empty.
+            if (job.m_task_source_done &&
+                    should_hold_frame(get_job_workers(remote_workers, worker_jobs, &job),
+                        remote_worker, job.m_tasks.size(), job.get_work_per_frame())) {
+
+                holding_jobs.insert(&job);
+                continue;
+            }
+
+            Task task;
+            if (!take_task(job.m_tasks, job.m_merge, remote_worker, remote_workers, task)) {
+                refused_workers[&job].insert(remote_worker);
+                continue;
+            }
+            run_job_task(remote_worker, job, task, worker_jobs);
+        }
+
+        bool tasks_waiting = false;
+        for (Job *job : jobs) {
+            // Send busy workers the inputs of the tasks they'll probably get next.
+            prefetch_tasks(job->m_tasks, get_job_workers(remote_workers, worker_jobs, job));
+
+            // Read the inputs of the next tasks before a worker asks for them.
+            for (int i = 0; i < job->m_tasks.size() && i < READ_AHEAD_TASK_COUNT; i++) {
+                for (const FileCopy &fileCopy : job->m_tasks[i].m_in_copies) {
+                    disk_io.read_ahead(fileCopy.m_source);
+                }
+            }
+
+            tasks_waiting |= !job->m_tasks.empty();
+        }
+
+        // Ask idle workers we couldn't use how they're doing now.
+        if (tasks_waiting) {
+            for (RemoteWorker *idle_worker : remote_workers) {
+                if (idle_worker->needs_status()) {
+                    idle_worker->request_status();
+                }
+            }
         }
     }
 
-    return 0;
+    return status;
 }
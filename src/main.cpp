@@ -6,6 +6,7 @@
 #include "proxy.hpp"
 #include "controller.hpp"
 #include "unittest.hpp"
+#include "submit.hpp"
 
 int main(int argc, char **argv) {
     // Parse command-line parameters.
@@ -33,6 +34,10 @@ int main(int argc, char **argv) {
             status = start_unittests(parameters);
             break;
 
+        case CMD_SUBMIT:
+            status = start_submit(parameters);
+            break;
+
         case CMD_UNSPECIFIED:
             throw std::logic_error("can't get here");
     }
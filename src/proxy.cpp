@@ -2,12 +2,15 @@
 #include <cstring>
 #include <vector>
 #include <set>
+#include <algorithm>
 #include <unistd.h>
 #include <poll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
 #include "proxy.hpp"
+#include "Drp.pb.h"
+#include "FairShare.hpp"
 
 static const int TMP_BUFFER_SIZE = 128*1024;
 
@@ -65,6 +68,27 @@ public:
         return true;
     }
 
+    // Remove a whole message from the front of the buffer. Returns 1 if
+    // successful, 0 if it hasn't all arrived yet, and -1 if it's invalid.
+    int take_message(google::protobuf::Message &message) {
+        uint32_t header;
+        if (m_buffer.size() < sizeof(header)) {
+            return 0;
+        }
+        memcpy(&header, &m_buffer[0], sizeof(header));
+        uint32_t size = ntohl(header);
+        if (m_buffer.size() < sizeof(header) + size) {
+            return 0;
+        }
+
+        if (!message.ParseFromArray(&m_buffer[sizeof(header)], size)) {
+            return -1;
+        }
+        m_buffer.erase(0, sizeof(header) + size);
+
+        return 1;
+    }
+
 private:
     // Add the received data to the buffer.
     void add(uint8_t *data, int size) {
@@ -84,9 +108,14 @@ class Connection {
     Buffer m_w2c;
     Buffer m_c2w;
 
+    // Name the controller claims workers under, from its hello, and
+    // whether that has arrived. Controllers only get workers after it.
+    std::string m_name;
+    bool m_has_hello;
+
 public:
     Connection()
-        : m_worker_fd(-1), m_controller_fd(-1) {
+        : m_worker_fd(-1), m_controller_fd(-1), m_has_hello(false) {
 
         // Nothing.
     }
@@ -107,6 +136,20 @@ public:
         return m_controller_fd;
     }
 
+    const std::string &get_name() const {
+        return m_name;
+    }
+
+    // Whether this is a controller that introduced itself and waits for a worker.
+    bool is_waiting_controller() const {
+        return m_worker_fd == -1 && m_controller_fd != -1 && m_has_hello;
+    }
+
+    // Whether this is a controller working with a worker.
+    bool is_paired() const {
+        return m_worker_fd != -1 && m_controller_fd != -1;
+    }
+
     // Add entries to the list of pollfds for each file descriptor we're
     // interested in.
     void add_pollfds(std::vector<struct pollfd> &pollfds) const {
@@ -133,7 +176,7 @@ public:
         if (fd == m_worker_fd) {
             return m_w2c.receive(fd);
         } else if (fd == m_controller_fd) {
-            return m_c2w.receive(fd);
+            return m_c2w.receive(fd) && (m_has_hello || take_hello());
         } else {
             std::cerr << "Fatal: Was passed fd " << fd << " that we don't know about.\n";
             exit(-1);
@@ -153,6 +196,25 @@ public:
     }
 
 private:
+    // Take the controller's hello from the front of its data if it has
+    // arrived. Returns whether successful. If not, sets errno.
+    bool take_hello() {
+        Drp::ProxyHello hello;
+        int result = m_c2w.take_message(hello);
+        if (result == -1) {
+            std::cerr << "Warning: Invalid hello from controller.\n";
+            // Close the connection.
+            errno = ECONNRESET;
+            return false;
+        }
+        if (result == 1) {
+            m_name = hello.name();
+            m_has_hello = true;
+        }
+
+        return true;
+    }
+
     // Add entry to the list of pollfds if we're interested in this file
     // descriptor. The buffer is the outgoing buffer for this file descriptor.
     void add_pollfd(std::vector<struct pollfd> &pollfds, int fd, const Buffer &buffer) const {
@@ -245,6 +307,57 @@ static void close_connection(std::vector<Connection *> &connections, Connection
     log_connections(connections);
 }
 
+// Give waiting workers to waiting controllers. Each worker goes to the name
+// that the shares say should get the next one, and within the name to the
+// controller that's been waiting longest.
+static void pair_workers(std::vector<Connection *> &connections,
+        const std::map<std::string, ProxyShare> &proxy_shares) {
+
+    Connection *worker;
+    while ((worker = find(connections, -2, -1)) != nullptr) {
+        // Names with a controller waiting, and their shares.
+        std::vector<std::string> names;
+        std::vector<Share> shares;
+        for (Connection *connection : connections) {
+            const std::string &name = connection->get_name();
+            if (connection->is_waiting_controller() &&
+                    std::find(names.begin(), names.end(), name) == names.end()) {
+
+                std::map<std::string, ProxyShare>::const_iterator itr = proxy_shares.find(name);
+                ProxyShare proxy_share = itr == proxy_shares.end() ? ProxyShare() : itr->second;
+                int running = std::count_if(connections.begin(), connections.end(),
+                        [&name](const Connection *other) {
+                            return other->is_paired() && other->get_name() == name;
+                        });
+
+                names.push_back(name);
+                shares.push_back(Share { 0, (double) proxy_share.m_weight, running,
+                        proxy_share.m_min_workers, proxy_share.m_max_workers, true });
+            }
+        }
+
+        int index = choose_share(shares);
+        if (index == -1) {
+            // Nobody can have the worker for now.
+            return;
+        }
+
+        for (Connection *connection : connections) {
+            if (connection->is_waiting_controller() && connection->get_name() == names[index]) {
+                // Workers don't speak first, so there's nothing in the
+                // worker's connection to keep.
+                connection->set_worker_fd(worker->get_worker_fd());
+                break;
+            }
+        }
+        connections.erase(std::find(connections.begin(), connections.end(), worker));
+        delete worker;
+
+        printf("Worker to %s (%d running)\n", names[index].c_str(), shares[index].m_running + 1);
+        log_connections(connections);
+    }
+}
+
 // Serve up our proxy. Returns program exit code.
 int start_proxy(Parameters &parameters) {
     g_tmp_buffer = new uint8_t[TMP_BUFFER_SIZE];
@@ -328,40 +441,21 @@ int start_proxy(Parameters &parameters) {
                     socklen_t remote_addr_len = sizeof(remote_addr);
                     int conn_fd = accept(pollfds[i].fd,
                             (struct sockaddr *) &remote_addr, &remote_addr_len);
-                    if (result == -1) {
+                    if (conn_fd == -1) {
+                        // Such as a peer that gave up before we got to it.
                         perror("accept");
-                        return -1;
+                        continue;
                     }
+                    set_keepalive(conn_fd);
 
-                    // Find an existing connection if possible.
-                    Connection *connection;
-
+                    // Wait for pair_workers() to match it up.
+                    Connection *connection = new Connection();
                     if (i == 0) {
-                        // Connection from worker. Look for existing connection
-                        // with only a controller.
-                        connection = find(connections, -1, -2);
-                        if (connection != nullptr) {
-                            connection->set_worker_fd(conn_fd);
-                        }
+                        connection->set_worker_fd(conn_fd);
                     } else {
-                        // Connection from controller. Look for existing connection
-                        // with only a worker.
-                        connection = find(connections, -2, -1);
-                        if (connection != nullptr) {
-                            connection->set_controller_fd(conn_fd);
-                        }
-                    }
-
-                    if (connection == nullptr) {
-                        // Didn't find existing connection. Create a new one.
-                        connection = new Connection();
-                        if (i == 0) {
-                            connection->set_worker_fd(conn_fd);
-                        } else {
-                            connection->set_controller_fd(conn_fd);
-                        }
-                        connections.push_back(connection);
+                        connection->set_controller_fd(conn_fd);
                     }
+                    connections.push_back(connection);
 
                     log_connections(connections);
                 } else {
@@ -372,16 +466,15 @@ int start_proxy(Parameters &parameters) {
                         std::cerr << "Fatal: Did not find incoming fd " << fd << "\n";
                         exit(-1);
                     } else {
+                        // Any error means the other side is gone, such as a
+                        // keepalive timeout on a machine that lost power.
                         success = connection->receive(fd);
                         if (!success) {
-                            if (errno == ECONNRESET) {
-                                // Other side disconnected.
-                                close_connection(connections, connection, deleted_fds);
-                                skip_rest = true;
-                            } else {
+                            if (errno != ECONNRESET) {
                                 perror("connection receive");
-                                return -1;
                             }
+                            close_connection(connections, connection, deleted_fds);
+                            skip_rest = true;
                         }
                     }
                 }
@@ -401,7 +494,8 @@ int start_proxy(Parameters &parameters) {
                         success = connection->send(fd);
                         if (!success) {
                             perror("connection send");
-                            return -1;
+                            close_connection(connections, connection, deleted_fds);
+                            skip_rest = true;
                         }
                     }
                 }
@@ -421,6 +515,8 @@ int start_proxy(Parameters &parameters) {
                 }
             }
         }
+
+        pair_workers(connections, parameters.m_proxy_shares);
     }
 
     delete[] g_tmp_buffer;
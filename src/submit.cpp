@@ -0,0 +1,53 @@
+
+#include <unistd.h>
+#include <climits>
+
+#include "submit.hpp"
+#include "Drp.pb.h"
+
+// Submit a job to the controller's queue and wait for it. Returns program
+// exit code: the job's, or our own if we couldn't submit it.
+int start_submit(Parameters &parameters) {
+    // Catch mistakes here rather than in the controller's output.
+    Parameters job;
+    int status = job.parse_job(parameters.m_job_arguments);
+    if (status != 0) {
+        return status;
+    }
+
+    char directory[PATH_MAX];
+    if (getcwd(directory, sizeof(directory)) == nullptr) {
+        perror("getcwd");
+        return -1;
+    }
+
+    Drp::SubmitRequest request;
+    for (const std::string &argument : parameters.m_job_arguments) {
+        request.add_argument(argument);
+    }
+    request.set_directory(directory);
+    request.set_priority(parameters.m_priority);
+    request.set_weight(parameters.m_weight);
+
+    int sock_fd = create_unix_client_socket(parameters.m_queue);
+    if (sock_fd == -1) {
+        return -1;
+    }
+
+    std::vector<uint8_t> buffer;
+    Drp::SubmitResponse response;
+    if (send_message(sock_fd, request, buffer) == -1 ||
+            receive_message(sock_fd, response, buffer) == -1) {
+
+        std::cerr << "Lost the controller before the job was done.\n";
+        close(sock_fd);
+        return -1;
+    }
+    close(sock_fd);
+
+    if (response.status() != 0) {
+        std::cerr << "Job failed (status " << response.status() << ").\n";
+    }
+
+    return response.status();
+}
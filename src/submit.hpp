@@ -0,0 +1,8 @@
+#ifndef SUBMIT_HPP
+#define SUBMIT_HPP
+
+#include "Parameters.hpp"
+
+int start_submit(Parameters &parameters);
+
+#endif // SUBMIT_HPP
@@ -0,0 +1,230 @@
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+
+#include "sysinfo.hpp"
+#include "util.hpp"
+
+#ifdef __linux__
+// Look up a "Key: value kB" line in /proc/meminfo. Returns bytes, or 0 if
+// the key isn't found.
+static int64_t read_meminfo(const std::string &key) {
+    std::ifstream f("/proc/meminfo");
+    std::string line;
+
+    while (std::getline(f, line)) {
+        if (line.compare(0, key.size(), key) == 0 && line[key.size()] == ':') {
+            return strtoll(line.c_str() + key.size() + 1, nullptr, 10)*1024;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+int64_t get_memory_size() {
+#if defined(__linux__)
+    return read_meminfo("MemTotal");
+#elif defined(__APPLE__)
+    int64_t memory_size;
+    size_t size = sizeof(memory_size);
+    if (sysctlbyname("hw.memsize", &memory_size, &size, nullptr, 0) == -1) {
+        return 0;
+    }
+    return memory_size;
+#else
+    return 0;
+#endif
+}
+
+int64_t get_free_memory() {
+#if defined(__linux__)
+    // MemAvailable accounts for reclaimable page cache, which MemFree doesn't.
+    return read_meminfo("MemAvailable");
+#else
+    return 0;
+#endif
+}
+
+int get_numa_node_count() {
+    int count = 0;
+
+#ifdef __linux__
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir != nullptr) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            // Entries are "node0", "node1", etc., mixed with other files.
+            if (strncmp(entry->d_name, "node", 4) == 0 &&
+                    entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+
+                count++;
+            }
+        }
+        closedir(dir);
+    }
+#endif
+
+    return count == 0 ? 1 : count;
+}
+
+std::vector<int> get_allowed_cpus() {
+    std::vector<int> cpus;
+
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+
+    return cpus;
+}
+
+std::vector<NumaNode> get_numa_nodes() {
+    std::vector<NumaNode> nodes;
+    std::vector<int> allowed = get_allowed_cpus();
+    if (allowed.empty()) {
+        return nodes;
+    }
+
+#ifdef __linux__
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir != nullptr) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strncmp(entry->d_name, "node", 4) != 0 ||
+                    entry->d_name[4] < '0' || entry->d_name[4] > '9') {
+
+                continue;
+            }
+
+            std::ifstream f(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            std::string line;
+            std::vector<int> cpus;
+            if (!std::getline(f, line) || !parse_cpu_list(line, cpus)) {
+                continue;
+            }
+
+            NumaNode node;
+            node.m_id = atoi(entry->d_name + 4);
+            std::sort(cpus.begin(), cpus.end());
+            std::set_intersection(cpus.begin(), cpus.end(), allowed.begin(), allowed.end(),
+                    std::back_inserter(node.m_cpus));
+            if (!node.m_cpus.empty()) {
+                nodes.push_back(node);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end(),
+            [](const NumaNode &a, const NumaNode &b) { return a.m_id < b.m_id; });
+#endif
+
+    if (nodes.empty()) {
+        nodes.push_back(NumaNode { 0, allowed });
+    }
+
+    return nodes;
+}
+
+std::string get_cpu_model() {
+#if defined(__linux__)
+    std::ifstream f("/proc/cpuinfo");
+    std::string line;
+
+    while (std::getline(f, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            std::string::size_type colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::string::size_type begin = line.find_first_not_of(" \t", colon + 1);
+                return begin == std::string::npos ? "" : line.substr(begin);
+            }
+        }
+    }
+
+    return "";
+#elif defined(__APPLE__)
+    char model[256];
+    size_t size = sizeof(model);
+    if (sysctlbyname("machdep.cpu.brand_string", model, &size, nullptr, 0) == -1) {
+        return "";
+    }
+    return model;
+#else
+    return "";
+#endif
+}
+
+float get_load_average() {
+    double load[1];
+
+    return getloadavg(load, 1) == 1 ? load[0] : 0;
+}
+
+double get_process_cpu_seconds(int pid) {
+#if defined(__linux__)
+    std::ifstream f("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(f, line)) {
+        return 0;
+    }
+
+    // The command name is in parentheses and may contain spaces. The fields
+    // after it start with the state (field 3), and the times are fields 14
+    // to 17: user, system, and the same for waited-for children.
+    std::string::size_type paren = line.rfind(')');
+    if (paren == std::string::npos) {
+        return 0;
+    }
+    std::istringstream fields(line.substr(paren + 1));
+    std::string field;
+    int64_t ticks = 0;
+    for (int i = 3; i <= 17 && fields >> field; i++) {
+        if (i >= 14) {
+            ticks += strtoll(field.c_str(), nullptr, 10);
+        }
+    }
+
+    return (double) ticks/sysconf(_SC_CLK_TCK);
+#else
+    return 0;
+#endif
+}
+
+int64_t get_process_peak_memory_kb(int pid) {
+#if defined(__linux__)
+    std::ifstream f("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+
+    while (std::getline(f, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return strtoll(line.c_str() + 6, nullptr, 10);
+        }
+    }
+
+    return 0;
+#else
+    return 0;
+#endif
+}
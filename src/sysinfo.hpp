@@ -0,0 +1,44 @@
+#ifndef SYSINFO_HPP
+#define SYSINFO_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Total physical memory in bytes, or 0 if unknown.
+int64_t get_memory_size();
+
+// Memory available to new processes in bytes, or 0 if unknown.
+int64_t get_free_memory();
+
+// Number of NUMA nodes. Always at least 1.
+int get_numa_node_count();
+
+// A NUMA node and the CPUs on it that we may run on.
+struct NumaNode {
+    int m_id;
+    std::vector<int> m_cpus;
+};
+
+// CPUs that we may run on, sorted. Empty if unknown.
+std::vector<int> get_allowed_cpus();
+
+// NUMA nodes with CPUs that we may run on, by increasing ID. A single node
+// with all allowed CPUs if the machine doesn't report its nodes, and empty
+// if the CPUs are unknown.
+std::vector<NumaNode> get_numa_nodes();
+
+// Human-readable CPU model, or empty if unknown.
+std::string get_cpu_model();
+
+// One-minute load average, or 0 if unknown.
+float get_load_average();
+
+// CPU seconds used so far by the process and its finished children, or 0
+// if unknown.
+double get_process_cpu_seconds(int pid);
+
+// Peak resident set size of the process in kilobytes, or 0 if unknown.
+int64_t get_process_peak_memory_kb(int pid);
+
+#endif // SYSINFO_HPP
@@ -1,9 +1,24 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <climits>
+#include <poll.h>
+#include <unistd.h>
 
 #include "unittest.hpp"
 #include "util.hpp"
+#include "Frames.hpp"
+#include "Manifest.hpp"
+#include "Stages.hpp"
+#include "BufferPool.hpp"
+#include "DiskIo.hpp"
+#include "FrameTimes.hpp"
+#include "Usage.hpp"
+#include "SlotTuner.hpp"
+#include "Pinning.hpp"
+#include "FairShare.hpp"
 
 // Color escapes.
 static const char *PASS = "\033[32m";
@@ -25,6 +40,14 @@ static std::vector<PathnameHasParameter> m_has_parameter = {
     { "image-%f.png", false },
     { "image-%d%d.png", true },
     { "image-% 3d.png", false },
+    { "shot-%/24d.scene", true },
+    { "shot-%03/24d.scene", true },
+    { "shot-%/d.scene", false },
+    { "shot-%/0d.scene", false },
+    { "tile-%{tx}.exr", true },
+    { "tile-%02{tx}.exr", true },
+    { "tile-%{}.exr", false },
+    { "tile-%{tx.exr", false },
 };
 
 static bool test_has_parameter() {
@@ -65,6 +88,12 @@ static std::vector<SubstituteParameter> m_substitute_parameter {
     { "%5d", 123, "%5d" },
     { "%g", 123, "%g" },
     { "%%", 123, "%%" },
+    { "%/24d", 50, "2" },
+    { "shot%03/24d/frame%04d", 50, "shot002/frame0050" },
+    { "%/0d", 50, "%/0d" },
+    { "%{frame}", 123, "123" },
+    { "%05{frame}", 123, "00123" },
+    { "%{tx}", 123, "%{tx}" },
 };
 
 static bool test_substitute_parameter() {
@@ -89,6 +118,44 @@ std::string substitute_parameter(const std::string &str, int value);
 
 // ------------------------------------------------------------------------------------------
 
+struct SubstituteParameters {
+    std::string m_str;
+    std::string m_expected;
+};
+
+static std::vector<SubstituteParameters> m_substitute_parameters {
+    { "frame%04d-%{tx}-%{ty}.exr", "frame0050-1-2.exr" },
+    { "%02{tx}%02{ty}", "0102" },
+    { "%{tx}%d%{tx}", "1501" },
+    { "%{tz}-%{tx}", "%{tz}-1" },
+    { "%{neg}", "%{neg}" },
+};
+
+static bool test_substitute_parameters() {
+    std::cerr << "test_substitute_parameters:\n";
+
+    std::map<std::string, int> values = {
+        { "frame", 50 }, { "tx", 1 }, { "ty", 2 }, { "neg", -1 },
+    };
+
+    for (SubstituteParameters &p : m_substitute_parameters) {
+        std::cerr << "    " << p.m_str << ": ";
+
+        std::string actual = substitute_parameters(p.m_str, values);
+        if (actual == p.m_expected) {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        } else {
+            std::cerr << FAIL << "FAIL (" << actual << " instead of "
+                << p.m_expected << ")" << NEUTRAL << "\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
 struct IsPathnameLocal {
     std::string m_str;
     bool m_expected;
@@ -220,14 +287,758 @@ static bool test_do_dns_lookup() {
 
 // ------------------------------------------------------------------------------------------
 
+struct IndexOrderTest {
+    FrameOrder m_order;
+    int m_count;
+    // Expected first indices.
+    std::vector<int64_t> m_expected;
+};
+
+static std::vector<IndexOrderTest> m_index_order = {
+    { ORDER_SEQUENTIAL, 5, { 0, 1, 2, 3, 4 } },
+    { ORDER_REVERSE, 5, { 4, 3, 2, 1, 0 } },
+    { ORDER_REFINE, 8, { 0, 4, 2, 6, 1, 5, 3, 7 } },
+    { ORDER_REFINE, 2000, { 0, 1024, 512, 1536, 256, 1280, 768, 1792 } },
+    { ORDER_REFINE, 1, { 0 } },
+    { ORDER_RANDOM, 1000, {} },
+    { ORDER_RANDOM, 7, {} },
+    { ORDER_SEQUENTIAL, 0, {} },
+};
+
+static bool test_index_order() {
+    std::cerr << "test_index_order:\n";
+
+    for (IndexOrderTest &p : m_index_order) {
+        std::cerr << "    " << p.m_order << " of " << p.m_count << ": ";
+
+        // Must visit every index exactly once, starting with the expected ones.
+        std::vector<bool> seen(p.m_count);
+        std::vector<int64_t> actual;
+        IndexOrder order(p.m_order, p.m_count, 1234);
+        int64_t index;
+        bool pass = true;
+        while (order.next(index)) {
+            if (index < 0 || index >= p.m_count || seen[index]) {
+                pass = false;
+                break;
+            }
+            seen[index] = true;
+            actual.push_back(index);
+        }
+        pass = pass && actual.size() == p.m_count;
+        for (int i = 0; pass && i < p.m_expected.size(); i++) {
+            pass = actual[i] == p.m_expected[i];
+        }
+
+        if (pass) {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        } else {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct ParseFrames {
+    std::string m_spec;
+    std::string m_exclude;
+    bool m_success;
+    std::deque<int> m_expected;
+};
+
+static std::vector<ParseFrames> m_parse_frames = {
+    // Legacy format.
+    { "5", "", true, { 5 } },
+    { "1,4", "", true, { 1, 2, 3, 4 } },
+    { "4,1", "", true, { 4, 3, 2, 1 } },
+    { "0,10,5", "", true, { 0, 5, 10 } },
+    // Lists of items.
+    { "1-3,7,10-20:5", "", true, { 1, 2, 3, 7, 10, 15, 20 } },
+    { "3-1", "", true, { 3, 2, 1 } },
+    { "1,2,3,4", "", true, { 1, 2, 3, 4 } },
+    { "1-10", "2-9:2,5", true, { 1, 3, 7, 9, 10 } },
+    // Overlapping items.
+    { "1-5,3", "", true, { 1, 2, 3, 4, 5 } },
+    { "1-5,3-7", "", true, { 1, 2, 3, 4, 5, 6, 7 } },
+    { "1-9:2,9-1:3", "", true, { 1, 3, 5, 7, 9, 6 } },
+    // Errors.
+    { "1-", "", false, {} },
+    { "1,2,x", "", false, {} },
+    { "@", "", false, {} },
+    { "@/nonexistent/frames.txt", "", false, {} },
+    { "1,5,0", "", false, {} },
+};
+
+static bool test_parse_frames() {
+    std::cerr << "test_parse_frames:\n";
+
+    for (ParseFrames &p : m_parse_frames) {
+        std::cerr << "    " << p.m_spec << " excluding " << p.m_exclude << ": ";
+
+        Frames frames;
+        bool success = frames.parse(p.m_spec) &&
+            (p.m_exclude.empty() || frames.m_exclusions.parse(p.m_exclude, false));
+        if (success != p.m_success || (success && frames.get_all() != p.m_expected)) {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct FrameRunsInsert {
+    std::vector<int> m_frames;
+    // Whether each frame was new.
+    std::vector<bool> m_expected;
+    std::vector<int> m_contained;
+    std::vector<int> m_not_contained;
+};
+
+static std::vector<FrameRunsInsert> m_frame_runs_insert = {
+    { { 1, 2, 3 }, { true, true, true }, { 1, 2, 3 }, { 0, 4 } },
+    { { 3, 2, 1, 2 }, { true, true, true, false }, { 1, 2, 3 }, { 0, 4 } },
+    { { 1, 3, 2, 3 }, { true, true, true, false }, { 1, 2, 3 }, { 0, 4 } },
+    { { 10, 1, 5, 10, 1 }, { true, true, true, false, false }, { 1, 5, 10 }, { 2, 6, 9, 11 } },
+    { { 5, 7, 6, 4, 8 }, { true, true, true, true, true }, { 4, 5, 6, 7, 8 }, { 3, 9 } },
+    { { -1, 0, INT_MAX, INT_MIN }, { true, true, true, true }, { -1, 0, INT_MAX, INT_MIN }, { 1 } },
+};
+
+static bool test_frame_runs_insert() {
+    std::cerr << "test_frame_runs_insert:\n";
+
+    for (FrameRunsInsert &p : m_frame_runs_insert) {
+        std::cerr << "    " << p.m_frames.size() << " frames starting with " <<
+            p.m_frames[0] << ": ";
+
+        FrameRuns frame_runs;
+        bool success = true;
+        for (int i = 0; i < p.m_frames.size(); i++) {
+            success &= frame_runs.insert(p.m_frames[i]) == p.m_expected[i];
+        }
+        for (int frame : p.m_contained) {
+            success &= frame_runs.contains(frame);
+        }
+        for (int frame : p.m_not_contained) {
+            success &= !frame_runs.contains(frame);
+        }
+
+        if (!success) {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct SplitWords {
+    std::string m_line;
+    bool m_success;
+    std::vector<std::string> m_expected;
+};
+
+static std::vector<SplitWords> m_split_words = {
+    { "", true, {} },
+    { "  a  bc\td ", true, { "a", "bc", "d" } },
+    { "a 'b c' \"d e\"", true, { "a", "b c", "d e" } },
+    { "a'b'\"c\"", true, { "abc" } },
+    { "'' \"\"", true, { "", "" } },
+    { "a\\ b \"c\\\"d\" 'e\\f'", true, { "a b", "c\"d", "e\\f" } },
+    { "a 'b", false, {} },
+    { "a \"b", false, {} },
+};
+
+static bool test_split_words() {
+    std::cerr << "test_split_words:\n";
+
+    for (SplitWords &p : m_split_words) {
+        std::cerr << "    " << p.m_line << ": ";
+
+        std::vector<std::string> words;
+        bool success = split_words(p.m_line, words);
+        if (success != p.m_success || (success && words != p.m_expected)) {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct ParseManifestLine {
+    std::string m_line;
+    bool m_success;
+    std::string m_id;
+    std::vector<std::string> m_arguments;
+    int m_in_count;
+    int m_out_count;
+};
+
+static std::vector<ParseManifestLine> m_parse_manifest_line = {
+    { "t1", true, "t1", { "-q" }, 0, 0 },
+    { "t1 a 'b c'", true, "t1", { "-q", "a", "b c" }, 0, 0 },
+    { "t1 --in x.rib in.rib --out out.png x.png in.rib out.png", true, "t1",
+        { "-q", "in.rib", "out.png" }, 1, 1 },
+    { "t1 -- --in", true, "t1", { "-q", "--in" }, 0, 0 },
+    { "t1 --in x.rib", false, "", {}, 0, 0 },
+    { "t1 --in x.rib /tmp/in.rib", false, "", {}, 0, 0 },
+    { "t1 --out ../out.png out.png", false, "", {}, 0, 0 },
+    { "t1 --bogus", false, "", {}, 0, 0 },
+    { "t1 'a", false, "", {}, 0, 0 },
+};
+
+static bool test_parse_manifest_line() {
+    std::cerr << "test_parse_manifest_line:\n";
+
+    for (ParseManifestLine &p : m_parse_manifest_line) {
+        std::cerr << "    " << p.m_line << ": ";
+
+        Task task;
+        bool success = parse_manifest_line(p.m_line, { "-q" }, task);
+        if (success != p.m_success || (success && (task.m_id != p.m_id ||
+                        task.m_arguments != p.m_arguments ||
+                        task.m_in_copies.size() != p.m_in_count ||
+                        task.m_out_copies.size() != p.m_out_count))) {
+
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct ParseStageLine {
+    std::string m_line;
+    bool m_success;
+    int m_dependency_count;
+    int m_low;
+    int m_high;
+    std::string m_executable;
+    int m_kept_count;
+};
+
+static std::vector<ParseStageLine> m_parse_stage_line = {
+    { "post main ./post.sh %d", true, 1, 0, 0, "./post.sh", 0 },
+    { "post main[-1:1] --in x.txt x.txt --out o%d.txt o%d.txt -- ./post.sh",
+        true, 1, -1, 1, "./post.sh", 0 },
+    { "post main,denoise --keep p%d.exr ./post.sh", true, 2, 0, 0, "./post.sh", 1 },
+    { "post main[1:-1] ./post.sh", false, 0, 0, 0, "", 0 },
+    { "post main[0] ./post.sh", false, 0, 0, 0, "", 0 },
+    { "post encode ./post.sh", false, 0, 0, 0, "", 0 },
+    { "post post ./post.sh", false, 0, 0, 0, "", 0 },
+    { "main main ./post.sh", false, 0, 0, 0, "", 0 },
+    { "post main --keep p.exr ./post.sh", false, 0, 0, 0, "", 0 },
+    { "post main --keep /tmp/p%d.exr ./post.sh", false, 0, 0, 0, "", 0 },
+    { "post main --in x.txt", false, 0, 0, 0, "", 0 },
+    { "post main --", false, 0, 0, 0, "", 0 },
+    { "post main /usr/bin/post", false, 0, 0, 0, "", 0 },
+    { "post", false, 0, 0, 0, "", 0 },
+};
+
+static bool test_parse_stage_line() {
+    std::cerr << "test_parse_stage_line:\n";
+
+    std::vector<Stage> stages(2);
+    stages[0].m_name = "main";
+    stages[1].m_name = "denoise";
+
+    for (ParseStageLine &p : m_parse_stage_line) {
+        std::cerr << "    " << p.m_line << ": ";
+
+        Stage stage;
+        bool success = parse_stage_line(p.m_line, stages, stage);
+        if (success != p.m_success || (success && (
+                        stage.m_dependencies.size() != p.m_dependency_count ||
+                        stage.m_dependencies[0].m_stage != 0 ||
+                        stage.m_dependencies[0].m_low != p.m_low ||
+                        stage.m_dependencies[0].m_high != p.m_high ||
+                        stage.m_executable != p.m_executable ||
+                        stage.m_kept.size() != p.m_kept_count))) {
+
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct AcquireBuffers {
+    // Budget of the pool.
+    size_t m_budget;
+
+    // Sizes acquired in order (deferrable), none released.
+    std::vector<size_t> m_sizes;
+
+    // Number of those that got a buffer.
+    int m_acquired_count;
+};
+
+static std::vector<AcquireBuffers> m_acquire_buffers = {
+    { 16384, { 100, 4096, 5000 }, 3 },
+    { 16384, { 5000, 5000, 5000 }, 2 },
+    { 16384, { 100000 }, 1 },
+    { 16384, { 100000, 1 }, 1 },
+    { 0, { 1, 1 }, 1 },
+};
+
+static bool test_acquire_buffers() {
+    std::cerr << "test_acquire_buffers:\n";
+
+    for (AcquireBuffers &p : m_acquire_buffers) {
+        std::cerr << "    " << p.m_budget << ", " << p.m_sizes.size() << " sizes: ";
+
+        BufferPool pool(p.m_budget);
+        std::vector<Buffer> buffers;
+        int acquired_count = 0;
+        for (size_t size : p.m_sizes) {
+            Buffer buffer = pool.acquire(size, true);
+            if (buffer.m_data != nullptr) {
+                if (buffer.m_capacity < size) {
+                    acquired_count = -1;
+                    break;
+                }
+                acquired_count++;
+            }
+            buffers.push_back(buffer);
+        }
+        for (Buffer &buffer : buffers) {
+            pool.release(buffer);
+        }
+
+        if (acquired_count != p.m_acquired_count || pool.is_exhausted()) {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct DiskIoReads {
+    // Calls on the file before waiting for it: "read", "ahead", or "cancel".
+    // A final read() is added, and its content must arrive.
+    std::vector<std::string> m_calls;
+};
+
+static std::vector<DiskIoReads> m_disk_io_reads = {
+    { {} },
+    { { "ahead" } },
+    { { "read", "cancel" } },
+    { { "ahead", "read", "cancel" } },
+    { { "read", "read", "cancel" } },
+};
+
+static bool test_disk_io_reads() {
+    std::cerr << "test_disk_io_reads:\n";
+
+    char pathname[] = "/tmp/distray-unittest-XXXXXX";
+    int fd = mkstemp(pathname);
+    if (fd == -1 || ::write(fd, "content", 7) != 7) {
+        std::cerr << FAIL << "FAIL: Can't write " << pathname << NEUTRAL << "\n";
+        return false;
+    }
+    close(fd);
+
+    bool pass = true;
+    for (DiskIoReads &p : m_disk_io_reads) {
+        std::cerr << "    ";
+        for (const std::string &call : p.m_calls) {
+            std::cerr << call << " ";
+        }
+        std::cerr << "read: ";
+
+        DiskIo disk_io;
+        for (const std::string &call : p.m_calls) {
+            if (call == "read") {
+                disk_io.read(pathname);
+            } else if (call == "ahead") {
+                disk_io.read_ahead(pathname);
+            } else {
+                disk_io.cancel_read(pathname);
+            }
+        }
+        disk_io.read(pathname);
+
+        // Reads that were never cancelled must each be taken.
+        int waiters = 1 + std::count(p.m_calls.begin(), p.m_calls.end(), "read") -
+            std::count(p.m_calls.begin(), p.m_calls.end(), "cancel");
+        bool success = false;
+        std::string content;
+        for (int i = 0; i < waiters; i++) {
+            while (!disk_io.take_read(pathname, success, content)) {
+                struct pollfd pollfd { disk_io.get_fd(), POLLIN, 0 };
+                poll(&pollfd, 1, -1);
+                disk_io.collect();
+            }
+        }
+
+        if (!success || content != "content") {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            pass = false;
+            break;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+    unlink(pathname);
+
+    return pass;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct FrameTimeout {
+    double m_factor;
+    std::vector<double> m_seconds;
+    double m_timeout;
+};
+
+static std::vector<FrameTimeout> m_frame_timeout = {
+    { 3, { 100, 100, 100, 100 }, 0 },
+    { 3, { 100, 100, 100, 100, 100 }, 300 },
+    { 3, { 1, 2, 3, 4, 5 }, 60 },
+    { 2, { 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+           100, 100, 100, 100, 100, 100, 100, 100, 100, 1000 }, 200 },
+    { 0, { 100, 100, 100, 100, 100 }, 0 },
+    { 1.5, { 100, 100, 100, 100, 100 }, 150 },
+};
+
+static bool test_frame_timeout() {
+    std::cerr << "test_frame_timeout:\n";
+
+    for (FrameTimeout &p : m_frame_timeout) {
+        std::cerr << "    " << p.m_factor << ", " << p.m_seconds.size() << " frames: ";
+
+        FrameTimes frame_times(p.m_factor);
+        for (double seconds : p.m_seconds) {
+            frame_times.add(seconds);
+        }
+
+        if (frame_times.get_timeout() != p.m_timeout) {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct MemoryHungry {
+    int64_t m_max_rss_kb;
+    int64_t m_memory_size;
+    bool m_expected;
+};
+
+static std::vector<MemoryHungry> m_memory_hungry = {
+    { 1024, 0, false },
+    { 1024, 4*1024*1024, false },
+    { 2048, 4*1024*1024, false },
+    { 2049, 4*1024*1024, true },
+    { 512*1024, 1024*1024*1024, false },
+    { 600*1024, 1024*1024*1024, true },
+};
+
+static bool test_memory_hungry() {
+    std::cerr << "test_memory_hungry:\n";
+
+    for (MemoryHungry &p : m_memory_hungry) {
+        std::cerr << "    " << p.m_max_rss_kb << " KB of " << p.m_memory_size << ": ";
+
+        Drp::ResourceUsage usage;
+        usage.set_max_rss_kb(p.m_max_rss_kb);
+        if (is_memory_hungry(usage, p.m_memory_size) != p.m_expected) {
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct ChooseSlotCount {
+    int m_slot_count;
+    int m_core_count;
+    int64_t m_memory_size;
+    double m_cores_per_task;
+    int64_t m_rss_kb_per_task;
+    int m_expected;
+};
+
+static const int64_t GB = 1024*1024*1024;
+
+static std::vector<ChooseSlotCount> m_choose_slot_count = {
+    { 4, 0, 0, 0, 0, 4 },
+    { 4, 16, 64*GB, 1, 1024*1024, 4 },
+    { 8, 16, 64*GB, 3.5, 1024*1024, 4 },
+    { 8, 16, 64*GB, 16, 1024*1024, 1 },
+    { 8, 16, 64*GB, 32, 1024*1024, 1 },
+    { 8, 16, 16*GB, 1, 4*1024*1024, 3 },
+    { 8, 16, 16*GB, 1, 20*1024*1024, 1 },
+    { 8, 16, 0, 1, 20*1024*1024, 8 },
+};
+
+static bool test_choose_slot_count() {
+    std::cerr << "test_choose_slot_count:\n";
+
+    for (ChooseSlotCount &p : m_choose_slot_count) {
+        std::cerr << "    " << p.m_slot_count << " slots, " << p.m_core_count << " cores, " <<
+            p.m_memory_size << " bytes, " << p.m_cores_per_task << " cores and " <<
+            p.m_rss_kb_per_task << " KB per task: ";
+
+        int slot_count = choose_slot_count(p.m_slot_count, p.m_core_count, p.m_memory_size,
+                p.m_cores_per_task, p.m_rss_kb_per_task);
+        if (slot_count != p.m_expected) {
+            std::cerr << FAIL << "FAIL: " << slot_count << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct SlotTunerAdd {
+    int m_slot_count;
+    int m_core_count;
+    // Wall seconds of single-core tasks, finished in this order.
+    std::vector<double> m_seconds;
+    int m_expected;
+};
+
+static std::vector<SlotTunerAdd> m_slot_tuner_add = {
+    { 8, 8, { 10, 10 }, 1 },
+    { 8, 8, { 10, 10, 10 }, 2 },
+    { 8, 8, { 10, 10, 10, 10, 10, 10, 10, 10, 10 }, 8 },
+    // Two slots are no faster than one.
+    { 8, 8, { 10, 10, 10, 20, 20, 20 }, 2 },
+    // Four slots are slower than two, the largest count measured below them.
+    { 8, 8, { 10, 10, 10, 10, 10, 10, 40, 40, 40 }, 2 },
+    { 8, 2, { 10, 10, 10, 10, 10, 10 }, 2 },
+};
+
+static bool test_slot_tuner_add() {
+    std::cerr << "test_slot_tuner_add:\n";
+
+    for (SlotTunerAdd &p : m_slot_tuner_add) {
+        std::cerr << "    " << p.m_slot_count << " slots, " << p.m_core_count << " cores, " <<
+            p.m_seconds.size() << " tasks: ";
+
+        SlotTuner slot_tuner;
+        for (double seconds : p.m_seconds) {
+            Drp::ResourceUsage usage;
+            usage.set_wall_seconds(seconds);
+            usage.set_user_seconds(seconds);
+            usage.set_max_rss_kb(1024);
+            slot_tuner.add(usage, p.m_slot_count, p.m_core_count, 0);
+        }
+
+        if (slot_tuner.get_active() != p.m_expected) {
+            std::cerr << FAIL << "FAIL: " << slot_tuner.get_active() << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct CpuList {
+    std::string m_str;
+    bool m_success;
+    std::vector<int> m_cpus;
+    std::string m_formatted;
+};
+
+static std::vector<CpuList> m_cpu_list = {
+    { "0", true, { 0 }, "0" },
+    { "0-3", true, { 0, 1, 2, 3 }, "0-3" },
+    { "0-1,4,6-7", true, { 0, 1, 4, 6, 7 }, "0-1,4,6-7" },
+    { "0-3,8-11\n", true, { 0, 1, 2, 3, 8, 9, 10, 11 }, "0-3,8-11" },
+    { "", true, {}, "" },
+    { "a", false, {}, "" },
+    { "1-", false, {}, "" },
+    { "1,,2", false, {}, "" },
+};
+
+static bool test_cpu_list() {
+    std::cerr << "test_cpu_list:\n";
+
+    for (CpuList &p : m_cpu_list) {
+        std::cerr << "    \"" << p.m_str << "\": ";
+
+        std::vector<int> cpus;
+        bool success = parse_cpu_list(p.m_str, cpus);
+        if (success != p.m_success || (success &&
+                    (cpus != p.m_cpus || format_cpu_list(cpus) != p.m_formatted))) {
+
+            std::cerr << FAIL << "FAIL" << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct PlaceSlot {
+    std::vector<NumaNode> m_nodes;
+    int m_slot;
+    int m_slot_count;
+    std::string m_cpus;
+    std::vector<int> m_node_ids;
+};
+
+static std::vector<PlaceSlot> m_place_slot = {
+    { { { 0, { 0, 1, 2, 3 } } }, 0, 1, "0-3", { 0 } },
+    { { { 0, { 0, 1, 2, 3 } } }, 1, 2, "2-3", { 0 } },
+    { { { 0, { 0, 1, 2, 3 } }, { 1, { 4, 5, 6, 7 } } }, 0, 1, "0-7", { 0, 1 } },
+    { { { 0, { 0, 1, 2, 3 } }, { 1, { 4, 5, 6, 7 } } }, 1, 2, "4-7", { 1 } },
+    { { { 0, { 0, 1, 2, 3 } }, { 1, { 4, 5, 6, 7 } } }, 2, 4, "2-3", { 0 } },
+    { { { 0, { 0, 1, 2, 3 } }, { 1, { 4, 5, 6, 7 } } }, 1, 3, "4-7", { 1 } },
+    { { { 0, { 0, 1, 2, 3 } }, { 1, { 4, 5, 6, 7 } } }, 2, 3, "2-3", { 0 } },
+    { { { 0, { 0, 1 } } }, 2, 3, "1", { 0 } },
+};
+
+static bool test_place_slot() {
+    std::cerr << "test_place_slot:\n";
+
+    for (PlaceSlot &p : m_place_slot) {
+        std::cerr << "    " << p.m_nodes.size() << " nodes, slot " << p.m_slot << " of " <<
+            p.m_slot_count << ": ";
+
+        Placement placement = place_slot(p.m_nodes, p.m_slot, p.m_slot_count);
+        if (format_cpu_list(placement.m_cpus) != p.m_cpus || placement.m_nodes != p.m_node_ids) {
+            std::cerr << FAIL << "FAIL: " << format_cpu_list(placement.m_cpus) << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+struct ChooseShare {
+    std::vector<Share> m_shares;
+    int m_expected;
+};
+
+static std::vector<ChooseShare> m_choose_share = {
+    { {}, -1 },
+    { { { 0, 1, 0, 0, -1, false } }, -1 },
+    { { { 0, 1, 5, 0, -1, true } }, 0 },
+    { { { 0, 1, 2, 0, -1, true }, { 0, 1, 1, 0, -1, true } }, 1 },
+    { { { 0, 1, 1, 0, -1, true }, { 0, 1, 1, 0, -1, true } }, 0 },
+    { { { 0, 3, 2, 0, -1, true }, { 0, 1, 1, 0, -1, true } }, 0 },
+    { { { 0, 1, 0, 0, -1, true }, { 1, 1, 10, 0, -1, true } }, 1 },
+    { { { 0, 1, 0, 0, -1, true }, { 1, 1, 0, 0, -1, false } }, 0 },
+    { { { 0, 2, 4, 0, -1, true }, { 0, 1, 2, 0, -1, true }, { 0, 0.5, 0, 0, -1, true } }, 2 },
+    { { { 0, 1, 0, 0, -1, true }, { 0, 1, 3, 4, -1, true } }, 1 },
+    { { { 0, 1, 0, 0, -1, true }, { 0, 1, 4, 4, -1, true } }, 0 },
+    { { { 0, 1, 2, 3, -1, true }, { 0, 1, 1, 2, -1, true } }, 1 },
+    { { { 1, 1, 5, 0, -1, true }, { 0, 1, 0, 2, -1, true } }, 0 },
+    { { { 0, 1, 2, 0, 2, true }, { 0, 1, 5, 0, -1, true } }, 1 },
+    { { { 0, 1, 2, 0, 2, true } }, -1 },
+};
+
+static bool test_choose_share() {
+    std::cerr << "test_choose_share:\n";
+
+    for (ChooseShare &p : m_choose_share) {
+        std::cerr << "    ";
+        for (const Share &share : p.m_shares) {
+            std::cerr << "(" << share.m_priority << ", " << share.m_weight << ", " <<
+                share.m_running << ", " << share.m_min_running << ", " << share.m_max_running <<
+                (share.m_wants_worker ? ", wants" : "") << ") ";
+        }
+        std::cerr << ": ";
+
+        int index = choose_share(p.m_shares);
+        if (index != p.m_expected) {
+            std::cerr << FAIL << "FAIL: " << index << NEUTRAL << "\n";
+            return false;
+        } else {
+            std::cerr << PASS << "pass" << NEUTRAL << "\n";
+        }
+    }
+
+    return true;
+}
+
 int start_unittests(const Parameters &parameters) {
     bool pass = true;
 
     pass &= test_has_parameter();
     pass &= test_substitute_parameter();
+    pass &= test_substitute_parameters();
     pass &= test_is_pathname_local();
     pass &= test_parse_endpoint();
     pass &= test_do_dns_lookup();
+    pass &= test_index_order();
+    pass &= test_parse_frames();
+    pass &= test_frame_runs_insert();
+    pass &= test_split_words();
+    pass &= test_parse_manifest_line();
+    pass &= test_parse_stage_line();
+    pass &= test_acquire_buffers();
+    pass &= test_disk_io_reads();
+    pass &= test_frame_timeout();
+    pass &= test_memory_hungry();
+    pass &= test_choose_slot_count();
+    pass &= test_slot_tuner_add();
+    pass &= test_cpu_list();
+    pass &= test_place_slot();
+    pass &= test_choose_share();
 
     if (pass) {
         std::cout << "\n" << PASS << "All tests passed." << NEUTRAL << "\n";
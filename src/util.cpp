@@ -4,34 +4,75 @@
 #include <sstream>
 #include <iomanip>
 #include <stdexcept>
+#include <cstring>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 
 #include "util.hpp"
 
+// Keepalive probing: seconds of quiet before the first probe, seconds
+// between probes, and unanswered probes before the connection is dropped.
+static const int KEEPALIVE_IDLE_S = 60;
+static const int KEEPALIVE_INTERVAL_S = 10;
+static const int KEEPALIVE_COUNT = 6;
+
 bool Endpoint::resolve(bool is_server, const std::string &default_hostname, int default_port) {
     return parse_and_lookup_endpoint(m_endpoint, is_server,
             default_hostname, default_port, m_sockaddr);
 }
 
-int send_message(int sock_fd, const google::protobuf::Message &request) {
-    // Serialize to bytes.
-    uint32_t size = request.ByteSize();
-    uint32_t full_size = size + sizeof(size);
-    uint8_t *buf = new uint8_t[full_size];
-    *((uint32_t *) buf) = htonl(size);
-    request.SerializeToArray(buf + sizeof(size), size);
+int send_message(int sock_fd, const google::protobuf::Message &request,
+        std::vector<uint8_t> &buffer) {
 
-    // Send.
-    int result = send(sock_fd, buf, full_size, 0);
+    // Serialize into the reused buffer, growing it if necessary.
+    uint32_t size = request.ByteSizeLong();
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    request.SerializeWithCachedSizesToArray(buffer.data());
+
+    // Send the header and body together.
+    uint32_t header = htonl(size);
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = buffer.data();
+    iov[1].iov_len = size;
+    int iov_index = 0;
+    size_t bytes_left = sizeof(header) + size;
+
+    while (bytes_left > 0) {
+        ssize_t sent = writev(sock_fd, iov + iov_index, 2 - iov_index);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes_left -= sent;
 
-    delete[] buf;
+        // Skip what was sent.
+        while (iov_index < 2 && sent >= iov[iov_index].iov_len) {
+            sent -= iov[iov_index].iov_len;
+            iov_index++;
+        }
+        if (iov_index < 2) {
+            iov[iov_index].iov_base = (uint8_t *) iov[iov_index].iov_base + sent;
+            iov[iov_index].iov_len -= sent;
+        }
+    }
 
-    return result;
+    return sizeof(header) + size;
 }
 
-int receive_message(int sock_fd, google::protobuf::Message &response) {
+int receive_message(int sock_fd, google::protobuf::Message &response,
+        std::vector<uint8_t> &buffer) {
+
     uint32_t size;
 
     // Receive length.
@@ -52,13 +93,16 @@ int receive_message(int sock_fd, google::protobuf::Message &response) {
 
     size = ntohl(size);
 
-    uint8_t *buf = new uint8_t[size];
+    // Reuse the buffer, growing it if necessary.
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
 
     // Receive.
-    status = recv(sock_fd, buf, size, MSG_WAITALL);
+    status = recv(sock_fd, buffer.data(), size, MSG_WAITALL);
     if (status == -1) {
         perror("recv2");
-    } else if (status == 0) {
+    } else if (status == 0 && size > 0) {
         // Other side closed connection. This error isn't technically
         // correct, but it'll be handled the right way higher up the stack.
         errno = ECONNRESET;
@@ -69,24 +113,26 @@ int receive_message(int sock_fd, google::protobuf::Message &response) {
         exit(-1);
     } else {
         // Decode. The result code is undocumented, we're guessing here.
-        bool success = response.ParseFromArray(buf, size);
+        bool success = response.ParseFromArray(buffer.data(), size);
         if (!success) {
             std::cerr << "Can't decode protobuf.\n";
             exit(-1);
         }
     }
 
-    delete[] buf;
-
     return status;
 }
 
-// Finds a parameter of the form "%d" or "%0Nd" (where N is a positive integer)
-// and returns the begin (inclusive) and end (exclusive) index into the string.
-// The width is zero in the "%d" case or N in the "%0Nd" case. Returns whether
-// a parameter was found. The begin, end, and width parameters may be destroyed
-// even if the return value is false.
-static bool find_parameter(const std::string &str, int &begin, int &end, int &width) {
+// Finds a parameter of the form "%d", "%0Nd", "%/Kd", or "%0N/Kd" (where N
+// and K are positive integers), or the same with "{NAME}" instead of "d", and
+// returns the begin (inclusive) and end (exclusive) index into the string.
+// The width is zero in the "%d" case or N in the "%0Nd" case. The divisor is
+// K, or 1 if not specified. The name is NAME, or empty for the "d" forms.
+// Returns whether a parameter was found. The begin, end, width, divisor, and
+// name parameters may be destroyed even if the return value is false.
+static bool find_parameter(const std::string &str, int &begin, int &end, int &width,
+        int &divisor, std::string &name) {
+
     const char *s = str.c_str();
     const char *p = s;
 
@@ -102,49 +148,209 @@ static bool find_parameter(const std::string &str, int &begin, int &end, int &wi
 
         // Skip %.
         p++;
-        if (*p == '0' || *p == 'd') {
+        if (*p == '0' || *p == '/' || *p == 'd' || *p == '{') {
             // Parse optional numeric value.
             width = 0;
             while (*p >= '0' && *p <= '9') {
                 width = width*10 + (*p - '0');
                 p++;
             }
+
+            // Parse optional divisor.
+            divisor = 1;
+            if (*p == '/') {
+                p++;
+                if (*p < '1' || *p > '9') {
+                    continue;
+                }
+                divisor = 0;
+                while (*p >= '0' && *p <= '9') {
+                    divisor = divisor*10 + (*p - '0');
+                    p++;
+                }
+            }
+
             if (*p == 'd') {
                 // Found parameter.
+                name.clear();
                 end = p - s + 1;
                 return true;
             }
+
+            if (*p == '{') {
+                const char *close = strchr(p, '}');
+                if (close != nullptr && close > p + 1) {
+                    // Found named parameter.
+                    name.assign(p + 1, close - p - 1);
+                    end = close - s + 1;
+                    return true;
+                }
+            }
         }
     }
 }
 
 bool string_has_parameter(const std::string &str) {
-    int begin, end, width;
+    int begin, end, width, divisor;
+    std::string name;
 
-    return find_parameter(str, begin, end, width);
+    return find_parameter(str, begin, end, width, divisor, name);
 }
 
-// Substitute a parameter ("%d" or "%0Nd") into the string.
 std::string substitute_parameter(const std::string &str, int value) {
-    int begin, end, width;
+    return substitute_parameters(str, { { FRAME_PARAMETER, value } });
+}
+
+std::string substitute_parameters(const std::string &str,
+        const std::map<std::string, int> &values) {
+
+    int begin, end, width, divisor;
+    std::string name;
 
     // See if we have any parameters.
-    if (value >= 0 && find_parameter(str, begin, end, width)) {
+    if (!find_parameter(str, begin, end, width, divisor, name)) {
+        return str;
+    }
+
+    // The unnamed forms are the frame number.
+    std::map<std::string, int>::const_iterator itr =
+        values.find(name.empty() ? FRAME_PARAMETER : name);
+    std::string value_str;
+    if (itr == values.end() || itr->second < 0) {
+        // Unknown name or negative value, leave parameter unchanged.
+        value_str = str.substr(begin, end - begin);
+    } else {
         // Convert value to a string, the hard C++ way.
         std::stringstream value_stream;
         if (width == 0) {
-            value_stream << value;
+            value_stream << itr->second/divisor;
         } else {
-            value_stream << std::setfill('0') << std::setw(width) << value;
+            value_stream << std::setfill('0') << std::setw(width) << itr->second/divisor;
         }
-        std::string value_str = value_stream.str();
+        value_str = value_stream.str();
+    }
 
-        // Recurse to do the rest of the string.
-        return str.substr(0, begin) + value_str + substitute_parameter(str.substr(end), value);
-    } else {
-        // No parameters or negative value, return string unchanged.
-        return str;
+    // Recurse to do the rest of the string.
+    return str.substr(0, begin) + value_str + substitute_parameters(str.substr(end), values);
+}
+
+bool parse_cpu_list(const std::string &str, std::vector<int> &cpus) {
+    std::istringstream items(str);
+    std::string item;
+
+    cpus.clear();
+    while (std::getline(items, item, ',')) {
+        const char *s = item.c_str();
+        char *end;
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        int first = strtol(s, &end, 10);
+        int last = first;
+        if (*end == '-') {
+            s = end + 1;
+            if (*s < '0' || *s > '9') {
+                return false;
+            }
+            last = strtol(s, &end, 10);
+        }
+        if (*end != '\0' && *end != '\n') {
+            return false;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
     }
+
+    return true;
+}
+
+std::string format_cpu_list(const std::vector<int> &cpus) {
+    std::ostringstream list;
+
+    for (int i = 0; i < cpus.size(); ) {
+        // Extent of the run of consecutive CPUs.
+        int j = i + 1;
+        while (j < cpus.size() && cpus[j] == cpus[j - 1] + 1) {
+            j++;
+        }
+
+        if (i > 0) {
+            list << ",";
+        }
+        list << cpus[i];
+        if (j - 1 > i) {
+            list << "-" << cpus[j - 1];
+        }
+        i = j;
+    }
+
+    return list.str();
+}
+
+bool split_words(const std::string &line, std::vector<std::string> &words) {
+    std::string word;
+    bool in_word = false;
+    char quote = '\0';
+
+    for (int i = 0; i < line.size(); i++) {
+        char ch = line[i];
+
+        if (quote != '\0') {
+            if (ch == quote) {
+                quote = '\0';
+            } else if (ch == '\\' && quote == '"' && i + 1 < line.size()) {
+                word += line[++i];
+            } else {
+                word += ch;
+            }
+        } else if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            if (in_word) {
+                words.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        } else {
+            in_word = true;
+            if (ch == '"' || ch == '\'') {
+                quote = ch;
+            } else if (ch == '\\' && i + 1 < line.size()) {
+                word += line[++i];
+            } else {
+                word += ch;
+            }
+        }
+    }
+
+    if (in_word) {
+        words.push_back(word);
+    }
+
+    return quote == '\0';
+}
+
+pid_t start_local_command(const std::vector<std::string> &words, int stdin_fd) {
+    std::vector<const char *> args;
+    for (const std::string &word : words) {
+        args.push_back(word.c_str());
+    }
+    args.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child process. Search the path, since this runs locally.
+        if (stdin_fd != -1) {
+            dup2(stdin_fd, 0);
+        }
+        execvp(args[0], (char **) args.data());
+        std::cerr << "Could not execute " << args[0] << ": " << strerror(errno) << "\n";
+        exit(-1);
+    }
+    if (pid == -1) {
+        perror("fork");
+    }
+
+    return pid;
 }
 
 bool is_pathname_local(const std::string &pathname) {
@@ -235,12 +441,100 @@ int create_client_socket(const Endpoint &endpoint) {
             sizeof(endpoint.m_sockaddr));
     if (result == -1) {
         perror("connect");
+        close(sock_fd);
+        return -1;
+    }
+    set_keepalive(sock_fd);
+
+    return sock_fd;
+}
+
+// Fill the address of a Unix-domain socket. Returns whether the pathname fits.
+static bool make_unix_address(const std::string &pathname, struct sockaddr_un &address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (pathname.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket pathname is too long: " << pathname << "\n";
+        return false;
+    }
+    strcpy(address.sun_path, pathname.c_str());
+
+    return true;
+}
+
+int create_unix_server_socket(const std::string &pathname) {
+    struct sockaddr_un address;
+    if (!make_unix_address(pathname, address)) {
+        return -1;
+    }
+
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    // Left over from an earlier run.
+    unlink(pathname.c_str());
+
+    if (bind(sock_fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        perror("bind");
+        close(sock_fd);
+        return -1;
+    }
+    if (listen(sock_fd, 10) == -1) {
+        perror("listen");
+        close(sock_fd);
+        return -1;
+    }
+
+    return sock_fd;
+}
+
+int create_unix_client_socket(const std::string &pathname) {
+    struct sockaddr_un address;
+    if (!make_unix_address(pathname, address)) {
+        return -1;
+    }
+
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    if (connect(sock_fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        perror("connect");
+        close(sock_fd);
         return -1;
     }
 
     return sock_fd;
 }
 
+bool set_keepalive(int sock_fd) {
+    int opt = 1;
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt (SO_KEEPALIVE)");
+        return false;
+    }
+
+#ifdef TCP_KEEPIDLE
+    int idle = KEEPALIVE_IDLE_S;
+    int interval = KEEPALIVE_INTERVAL_S;
+    int count = KEEPALIVE_COUNT;
+    if (setsockopt(sock_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == -1 ||
+            setsockopt(sock_fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == -1 ||
+            setsockopt(sock_fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) == -1) {
+
+        perror("setsockopt (TCP_KEEPIDLE)");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
 // Parses a non-negative decimal integer. Returns -1 if the string is not
 // entirely made of a non-negative integer.
 static int parse_integer(const char *s) {
@@ -2,6 +2,10 @@
 #define UTIL_HPP
 
 #include <netdb.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <map>
 #include <google/protobuf/message.h>
 
 // Represents both an endpoint string (like "example.com:1120") and its
@@ -29,16 +33,54 @@ public:
     bool resolve(bool is_server, const std::string &default_hostname, int default_port);
 };
 
-int send_message(int sock_fd, const google::protobuf::Message &request);
-int receive_message(int sock_fd, google::protobuf::Message &response);
+// Send and receive messages on blocking sockets. The buffer is reused from
+// message to message, and only grows.
+int send_message(int sock_fd, const google::protobuf::Message &request,
+        std::vector<uint8_t> &buffer);
+int receive_message(int sock_fd, google::protobuf::Message &response,
+        std::vector<uint8_t> &buffer);
 
-// Whether a string includes a parameter ("%d" or "%0Nd").
+// Name of the parameter for the frame number, which can also be written "%d".
+static const char FRAME_PARAMETER[] = "frame";
+
+// Name of the parameter for the CPUs that the worker runs the executable
+// on, as a list such as "0-3,8-11". It's substituted by the worker, not the
+// controller.
+static const char CPUS_PARAMETER[] = "cpus";
+
+// Whether a string includes a parameter ("%d", "%0Nd", "%/Kd", or "%0N/Kd",
+// or a named parameter such as "%{tx}" or "%03{tx}").
 bool string_has_parameter(const std::string &str);
 
-// Substitute a parameter ("%d" or "%0Nd") into the string. Does no
-// expansion if the value is negative.
+// Substitute the frame number into the string's parameters ("%d", "%0Nd",
+// "%/Kd", "%0N/Kd", or the same with "{frame}" instead of "d"). The "/K"
+// forms divide the value by K, which is useful for files shared by groups
+// of frames. Does no expansion if the value is negative.
 std::string substitute_parameter(const std::string &str, int value);
 
+// Substitute named parameters ("%{NAME}", "%0N{NAME}", etc.) into the string.
+// The unnamed forms ("%d", etc.) are the value of FRAME_PARAMETER. Parameters
+// whose name isn't in the map, or whose value is negative, are left unchanged.
+std::string substitute_parameters(const std::string &str,
+        const std::map<std::string, int> &values);
+
+// Parse a list of CPU numbers such as "0-3,8,10-11", as in sysfs and
+// taskset. Returns whether successful.
+bool parse_cpu_list(const std::string &str, std::vector<int> &cpus);
+
+// Format sorted CPU numbers as a list such as "0-3,8,10-11".
+std::string format_cpu_list(const std::vector<int> &cpus);
+
+// Split a line into whitespace-separated words. Single and double quotes
+// group words with spaces, and a backslash escapes the next character
+// (except within single quotes). Returns false if a quote isn't closed.
+bool split_words(const std::string &line, std::vector<std::string> &words);
+
+// Start a command on this machine, searching the path for the executable.
+// Its standard input is stdin_fd, or ours if -1. Returns the process ID, or
+// -1 if it couldn't be started.
+pid_t start_local_command(const std::vector<std::string> &words, int stdin_fd = -1);
+
 // Check whether a pathname is local (relative and can't escape the current directory).
 bool is_pathname_local(const std::string &pathname);
 
@@ -54,6 +96,17 @@ int create_server_socket(const Endpoint &endpoint);
 // Create a client socket. Returns -1 (and sets errno) on failure, otherwise returns 0.
 int create_client_socket(const Endpoint &endpoint);
 
+// Create and connect Unix-domain sockets, such as for submitting jobs to a
+// controller on the same machine. The server replaces whatever is at the
+// pathname. Return -1 on failure, after writing an error to standard error.
+int create_unix_server_socket(const std::string &pathname);
+int create_unix_client_socket(const std::string &pathname);
+
+// Have the kernel probe the connection when it's quiet, so that a peer that
+// vanished without closing it is noticed within a couple of minutes rather
+// than hours. Returns whether successful.
+bool set_keepalive(int sock_fd);
+
 // Parse a "hostname:port" string into a hostname and port. Also accepts
 // ":port" (blank hostname), "port" (default hostname), "hostname:" (default
 // port), and "hostname" (default port). Returns whether successful. If not
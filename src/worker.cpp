@@ -1,15 +1,135 @@
 
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <random>
 #include <unistd.h>
 #include <cstring>
 #include <errno.h>
 #include <netinet/in.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <climits>
+#include <map>
 
 #include "worker.hpp"
 #include "Drp.pb.h"
 #include "util.hpp"
+#include "sysinfo.hpp"
+#include "MessageArena.hpp"
+#include "Pinning.hpp"
+
+// Our connection to the controller or the proxy, with memory that's reused
+// for every message, and for every connection of a daemon.
+struct Connection {
+    // Socket, or -1 if not connected.
+    int m_fd;
+
+    // Bytes of messages sent and received.
+    std::vector<uint8_t> m_buffer;
+
+    // Requests and their responses.
+    MessageArena m_arena;
+
+    // CPUs that executables run on, for the CPUS_PARAMETER.
+    std::string m_cpus;
+
+    // Directory that executables are relative to, or empty for the current
+    // one. Slots work in subdirectories of the worker's directory, but run
+    // the executables in it.
+    std::string m_executable_directory;
+
+    // Seconds of the built-in benchmark, or 0 if it hasn't run. It only
+    // depends on the machine, so later jobs get it without waiting.
+    double m_benchmark_seconds;
+
+    Connection(int fd, const std::string &cpus)
+        : m_fd(fd), m_cpus(cpus), m_benchmark_seconds(0) {
+
+        // Nothing.
+    }
+};
+
+// The executable of EXECUTE requests with a server key, which stays running
+// between requests for the same executable and key. It gets the arguments
+// of each request as a tab-separated line on its standard input, and
+// answers with a "done STATUS" line on its standard output. Its other
+// output lines are passed through.
+struct Server {
+    // Process, or -1 if not running.
+    pid_t m_pid;
+
+    // Our ends of its standard input and output.
+    int m_stdin;
+    int m_stdout;
+
+    // What it was started for.
+    std::string m_executable;
+    std::string m_key;
+
+    // What it has printed since its last whole line.
+    std::string m_output;
+
+    Server()
+        : m_pid(-1), m_stdin(-1), m_stdout(-1) {
+
+        // Nothing.
+    }
+};
+
+// The executable of an EXECUTE request, which runs while the worker handles
+// other requests, such as copying in the next frame's files.
+struct Execution {
+    // Copy of the request, since requests only live until the next one.
+    Drp::ExecuteRequest m_request;
+
+    // Process of the executable or of its post command, or -1 if none.
+    pid_t m_pid;
+
+    // Whether m_pid is the post command.
+    bool m_post;
+
+    // Whether m_pid is m_server, working on the request, and whether we've
+    // restarted it for the request after it exited.
+    bool m_on_server;
+    bool m_restarted;
+
+    // CPU seconds m_pid had used when it started on the request. Only
+    // servers have used any.
+    double m_cpu_start;
+
+    // Server for requests with a server key. It outlives requests.
+    Server m_server;
+
+    // Whether the controller asked us to stop.
+    bool m_cancelled;
+
+    // Watches the directories of early outputs, or -1 if none. The outputs
+    // are keyed by watch descriptor and name.
+    int m_inotify_fd;
+    std::map<std::pair<int, std::string>, std::string> m_outputs;
+
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::time_point m_next_heartbeat;
+
+    // Resources used by the processes that have exited so far.
+    Drp::ResourceUsage m_usage;
+
+    Execution()
+        : m_pid(-1), m_post(false), m_on_server(false), m_restarted(false), m_cpu_start(0),
+            m_cancelled(false), m_inotify_fd(-1) {
+
+        // Nothing.
+    }
+};
 
 static void handle_welcome(const Drp::WelcomeRequest &request, Drp::WelcomeResponse &response) {
     char hostname[128];
@@ -19,6 +139,14 @@ static void handle_welcome(const Drp::WelcomeRequest &request, Drp::WelcomeRespo
     }
     response.set_hostname(hostname);
     response.set_core_count(std::thread::hardware_concurrency());
+    response.set_memory_size(get_memory_size());
+    response.set_numa_node_count(get_numa_node_count());
+    response.set_cpu_model(get_cpu_model());
+}
+
+static void fill_load_report(Drp::LoadReport &load_report) {
+    load_report.set_load_average(get_load_average());
+    load_report.set_free_memory(get_free_memory());
 }
 
 static void handle_copy_in(const Drp::CopyInRequest &request, Drp::CopyInResponse &response) {
@@ -55,39 +183,109 @@ static void handle_copy_in(const Drp::CopyInRequest &request, Drp::CopyInRespons
         }
     }
 
-    // Write the file contents.
-    bool success = write_file(pathname, request.content());
+    // Write the file contents. An executable we abandoned may still be
+    // reading the same file, so replace it all at once.
+    std::string temporary = pathname + ".distray-" + std::to_string(getpid());
+    bool success = write_file(temporary, request.content()) &&
+        rename(temporary.c_str(), pathname.c_str()) == 0;
     if (!success) {
         std::cerr << "Failed to write to file: " << pathname << "\n";
+        unlink(temporary.c_str());
     }
 
     response.set_success(success);
 }
 
-static void handle_execute(const Drp::ExecuteRequest &request, Drp::ExecuteResponse &response) {
+static void handle_copy_out(const Drp::CopyOutRequest &request, Drp::CopyOutResponse &response) {
+    std::string pathname = request.pathname();
+
+    if (!is_pathname_local(pathname)) {
+        // Shouldn't happen, we check this on the controller.
+        std::cerr << "Asked to read from non-local pathname: " << pathname << "\n";
+        response.set_success(false);
+        return;
+    }
+
+    try {
+        response.set_content(read_file(pathname));
+        response.set_success(true);
+    } catch (std::runtime_error e) {
+        std::cerr << "Failed to read from file: " << pathname << "\n";
+        response.set_success(false);
+    }
+}
+
+static void handle_remove(const Drp::RemoveRequest &request) {
+    for (const std::string &pathname : request.pathname()) {
+        if (!is_pathname_local(pathname)) {
+            // Shouldn't happen, we check this on the controller.
+            std::cerr << "Asked to remove non-local pathname: " << pathname << "\n";
+            continue;
+        }
+
+        unlink(pathname.c_str());
+    }
+}
+
+// Replace every CPUS_PARAMETER in the string with the CPUs.
+static std::string substitute_cpus(std::string str, const std::string &cpus) {
+    std::string parameter = std::string("%{") + CPUS_PARAMETER + "}";
+
+    for (std::string::size_type i = str.find(parameter); i != std::string::npos;
+            i = str.find(parameter, i + cpus.size())) {
+
+        str.replace(i, parameter.size(), cpus);
+    }
+
+    return str;
+}
+
+// Start the executable, with the connection's CPUs substituted into its
+// arguments. Its standard input and output are the file descriptors, or ours
+// if -1. Returns its process ID, or -1 if it can't be started.
+static pid_t start_executable(const Drp::ExecuteRequest &request, const Connection &connection,
+        int stdin_fd = -1, int stdout_fd = -1) {
     std::string executable = request.executable();
 
     if (!is_pathname_local(executable)) {
         // Shouldn't happen, we check this on the controller.
         std::cerr << "Asked to run non-local executable: " << executable << "\n";
-        response.set_status(-1);
-        return;
+        return -1;
     }
+    std::string pathname = connection.m_executable_directory.empty() ? executable :
+        connection.m_executable_directory + "/" + executable;
 
     // Set up arguments.
     int count = request.argument_size();
     const char **args = new const char *[count + 2];
+    std::vector<std::string> arguments;
+    for (int i = 0; i < count; i++) {
+        arguments.push_back(substitute_cpus(request.argument(i), connection.m_cpus));
+    }
 
-    args[0] = executable.c_str();
+    args[0] = pathname.c_str();
     for (int i = 0; i < count; i++) {
-        args[i + 1] = request.argument(i).c_str();
+        args[i + 1] = arguments[i].c_str();
     }
     args[count + 1] = nullptr;
 
     // Fork a child process.
     pid_t pid = fork();
     if (pid == 0) {
-        // Child process.
+        // Child process. Put it in its own group so that a cancel stops
+        // whatever it starts, and let it see its own children exit.
+        setpgid(0, 0);
+        sigset_t sigchld;
+        sigemptyset(&sigchld);
+        sigaddset(&sigchld, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &sigchld, nullptr);
+        signal(SIGPIPE, SIG_DFL);
+        if (stdin_fd != -1) {
+            dup2(stdin_fd, 0);
+        }
+        if (stdout_fd != -1) {
+            dup2(stdout_fd, 1);
+        }
 
         // Do not search the path and don't change the environment.
         int result = execv(args[0], (char **) args);
@@ -100,102 +298,827 @@ static void handle_execute(const Drp::ExecuteRequest &request, Drp::ExecuteRespo
         exit(-1);
     }
 
-    // Parent process.
+    // Parent process. Free up our arguments.
+    delete[] args;
+    args = nullptr;
+
+    if (pid == -1) {
+        perror("fork");
+    } else {
+        // Also set the group here, in case we cancel before the child has
+        // run. Whichever of us gets there second fails harmlessly.
+        setpgid(pid, pid);
+    }
+
+    return pid;
+}
+
+// Exit status to report for a process, from waitpid(). Processes killed by
+// a signal get 128 plus the signal number, like in the shell.
+static int get_exit_status(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Add the resources used by an exited process to the usage.
+static void add_usage(Drp::ResourceUsage &usage, const struct rusage &rusage) {
+    usage.set_user_seconds(usage.user_seconds() +
+            rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec/1000000.0);
+    usage.set_system_seconds(usage.system_seconds() +
+            rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec/1000000.0);
+    usage.set_max_rss_kb(std::max<int64_t>(usage.max_rss_kb(), rusage.ru_maxrss));
+    usage.set_in_blocks(usage.in_blocks() + rusage.ru_inblock);
+    usage.set_out_blocks(usage.out_blocks() + rusage.ru_oublock);
+    usage.set_voluntary_switches(usage.voluntary_switches() + rusage.ru_nvcsw);
+    usage.set_involuntary_switches(usage.involuntary_switches() + rusage.ru_nivcsw);
+}
+
+// Run the executable and wait for it. Returns its exit status.
+static int run_executable(const Drp::ExecuteRequest &request, const Connection &connection) {
+    pid_t pid = start_executable(request, connection);
+    if (pid == -1) {
+        return -1;
+    }
+
     int status;
     wait4(pid, &status, 0, nullptr);
 
-    // Free up our arguments.
-    delete[] args;
-    args = nullptr;
+    return get_exit_status(status);
+}
+
+// Send an output to the controller in the middle of an execute.
+static void send_early_output(Connection &connection, const std::string &pathname) {
+    Drp::CopyOutRequest request;
+    request.set_pathname(pathname);
+
+    Drp::Response response;
+    response.set_request_type(Drp::COPY_OUT);
+    Drp::CopyOutResponse *copy_out_response = response.mutable_copy_out_response();
+    handle_copy_out(request, *copy_out_response);
+    copy_out_response->set_pathname(pathname);
+    fill_load_report(*response.mutable_load_report());
 
-    response.set_status(WEXITSTATUS(status));
+    std::cout << "Sending " << pathname << " early.\n";
+    if (send_message(connection.m_fd, response, connection.m_buffer) == -1) {
+        // The main loop will notice on its next receive.
+        perror("send_message");
+    }
 }
 
-static void handle_copy_out(const Drp::CopyOutRequest &request, Drp::CopyOutResponse &response) {
-    std::string pathname = request.pathname();
+// Send the outputs named by the inotify events that are ready, from watch
+// descriptor and name to pathname. Returns whether successful.
+static bool send_closed_outputs(Connection &connection, int inotify_fd,
+        const std::map<std::pair<int, std::string>, std::string> &outputs) {
 
-    if (!is_pathname_local(pathname)) {
-        // Shouldn't happen, we check this on the controller.
-        std::cerr << "Asked to read from non-local pathname: " << pathname << "\n";
-        response.set_success(false);
+    // Enough for at least one event with the longest name.
+    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length == -1) {
+            return errno == EAGAIN;
+        }
+
+        for (char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->len > 0) {
+                std::map<std::pair<int, std::string>, std::string>::const_iterator itr =
+                    outputs.find(std::make_pair(event->wd, std::string(event->name)));
+                if (itr != outputs.end()) {
+                    send_early_output(connection, itr->second);
+                }
+            }
+        }
+    }
+}
+
+static void finish_execution(Connection &connection, Execution &execution, int status);
+static void run_on_server(Connection &connection, Execution &execution);
+
+// Start running the executable of an EXECUTE request. The response is sent
+// by finish_execution() once it's done.
+static void start_execution(Connection &connection, Execution &execution,
+        const Drp::ExecuteRequest &request) {
+
+    execution.m_request = request;
+    execution.m_post = false;
+    execution.m_on_server = false;
+    execution.m_restarted = false;
+    execution.m_cpu_start = 0;
+    execution.m_cancelled = false;
+    execution.m_usage.Clear();
+    execution.m_start = std::chrono::steady_clock::now();
+    execution.m_next_heartbeat = execution.m_start +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(request.heartbeat_interval()));
+
+    // Watch the directories of the early outputs, since the outputs don't
+    // exist yet. Outputs in directories that don't exist yet, or all of them
+    // if inotify isn't available, are copied out afterward as usual.
+    execution.m_outputs.clear();
+    execution.m_inotify_fd = -1;
+    if (request.early_out_pathname_size() > 0) {
+        execution.m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (execution.m_inotify_fd == -1) {
+            perror("inotify_init1");
+        }
+    }
+    if (execution.m_inotify_fd != -1) {
+        for (const std::string &pathname : request.early_out_pathname()) {
+            std::string::size_type slash = pathname.rfind('/');
+            std::string directory = slash == std::string::npos ? "." : pathname.substr(0, slash);
+            std::string name = slash == std::string::npos ? pathname : pathname.substr(slash + 1);
+
+            int wd = inotify_add_watch(execution.m_inotify_fd, directory.c_str(), IN_CLOSE_WRITE);
+            if (wd != -1) {
+                execution.m_outputs[std::make_pair(wd, name)] = pathname;
+            }
+        }
+    }
+
+    if (request.has_server_key()) {
+        run_on_server(connection, execution);
         return;
     }
 
-    try {
-        response.set_content(read_file(pathname));
-        response.set_success(true);
-    } catch (std::runtime_error e) {
-        std::cerr << "Failed to read from file: " << pathname << "\n";
-        response.set_success(false);
+    execution.m_pid = start_executable(request, connection);
+    if (execution.m_pid == -1) {
+        finish_execution(connection, execution, -1);
     }
 }
 
-// Start a worker. Returns program exit code.
-int start_worker(Parameters &parameters) {
-    // Resolve endpoint.
-    bool success = parameters.m_endpoint.resolve(false, "", DEFAULT_WORKER_PORT);
-    if (!success) {
-        return -1;
+// Send the EXECUTE response for the execution, whose processes are done.
+static void finish_execution(Connection &connection, Execution &execution, int status) {
+    // Whatever the executable closed right before exiting.
+    if (execution.m_inotify_fd != -1) {
+        if (!send_closed_outputs(connection, execution.m_inotify_fd, execution.m_outputs)) {
+            perror("read");
+        }
+        close(execution.m_inotify_fd);
+        execution.m_inotify_fd = -1;
     }
+    execution.m_pid = -1;
 
-    // Connect to the controller or the proxy.
-    int sockfd = create_client_socket(parameters.m_endpoint);
-    if (sockfd == -1) {
-        return -1;
+    Drp::Response response;
+    response.set_request_type(Drp::EXECUTE);
+    Drp::ExecuteResponse *execute_response = response.mutable_execute_response();
+    execute_response->set_status(status);
+    execute_response->set_cancelled(execution.m_cancelled);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - execution.m_start;
+    execution.m_usage.set_wall_seconds(elapsed.count());
+    *execute_response->mutable_usage() = execution.m_usage;
+    fill_load_report(*response.mutable_load_report());
+    if (send_message(connection.m_fd, response, connection.m_buffer) == -1) {
+        // The main loop will notice on its next receive.
+        perror("send_message");
+    }
+}
+
+// The execution's executable or post command is done with the exit status.
+// Start the post command, or finish the execution.
+static void step_done(Connection &connection, Execution &execution, int status) {
+    if (!execution.m_post && status == 0 && !execution.m_cancelled &&
+            execution.m_request.has_post_request()) {
+
+        execution.m_post = true;
+        execution.m_pid = start_executable(execution.m_request.post_request(), connection);
+        if (execution.m_pid == -1) {
+            finish_execution(connection, execution, -1);
+        }
+    } else {
+        finish_execution(connection, execution, status);
+    }
+}
+
+// Forget the server's process, which has exited.
+static void close_server(Server &server) {
+    close(server.m_stdin);
+    close(server.m_stdout);
+    server.m_pid = -1;
+    server.m_stdin = -1;
+    server.m_stdout = -1;
+    server.m_output.clear();
+}
+
+// Stop the server, if it's running.
+static void stop_server(Server &server) {
+    if (server.m_pid != -1) {
+        kill(-server.m_pid, SIGKILL);
+        waitpid(server.m_pid, nullptr, 0);
+        close_server(server);
+    }
+}
+
+// Start the server for the request, with the request's arguments. Returns
+// whether successful.
+static bool start_server(Server &server, const Drp::ExecuteRequest &request,
+        const Connection &connection) {
+
+    int in[2];
+    int out[2];
+    if (pipe2(in, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return false;
+    }
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        close(in[0]);
+        close(in[1]);
+        return false;
+    }
+
+    server.m_pid = start_executable(request, connection, in[0], out[1]);
+    close(in[0]);
+    close(out[1]);
+    server.m_stdin = in[1];
+    server.m_stdout = out[0];
+    if (server.m_pid == -1) {
+        close_server(server);
+        return false;
+    }
+    fcntl(server.m_stdout, F_SETFL, O_NONBLOCK);
+    server.m_executable = request.executable();
+    server.m_key = request.server_key();
+
+    std::cout << "Started server " << server.m_executable << " for " << server.m_key << ".\n";
+    return true;
+}
+
+// Send the request's arguments to the server. Returns whether successful.
+static bool send_server_line(Server &server, const Drp::ExecuteRequest &request,
+        const std::string &cpus) {
+
+    std::string line;
+    for (int i = 0; i < request.argument_size(); i++) {
+        if (i > 0) {
+            line += '\t';
+        }
+        line += substitute_cpus(request.argument(i), cpus);
+    }
+    line += '\n';
+
+    for (size_t sent = 0; sent < line.size(); ) {
+        ssize_t result = write(server.m_stdin, line.data() + sent, line.size() - sent);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return false;
+        }
+        sent += result;
+    }
+
+    return true;
+}
+
+// Have the server run the execution's request, first starting it if it's
+// not running or was started for another executable or key.
+static void run_on_server(Connection &connection, Execution &execution) {
+    Server &server = execution.m_server;
+    const Drp::ExecuteRequest &request = execution.m_request;
+
+    if (server.m_pid != -1 &&
+            (server.m_executable != request.executable() || server.m_key != request.server_key())) {
+
+        std::cout << "Stopping server for " << server.m_key << ".\n";
+        stop_server(server);
     }
 
+    if ((server.m_pid == -1 && !start_server(server, request, connection)) ||
+            !send_server_line(server, request, connection.m_cpus)) {
+
+        stop_server(server);
+        finish_execution(connection, execution, -1);
+        return;
+    }
+
+    execution.m_pid = server.m_pid;
+    execution.m_on_server = true;
+    execution.m_cpu_start = get_process_cpu_seconds(server.m_pid);
+}
+
+static void read_server_output(Connection &connection, Execution &execution);
+
+// See if the server has exited. If it was working on the request, start it
+// again and resend the request, once.
+static void check_server(Connection &connection, Execution &execution) {
+    Server &server = execution.m_server;
+    int status;
+    if (server.m_pid == -1 || waitpid(server.m_pid, &status, WNOHANG) <= 0) {
+        return;
+    }
+
+    status = get_exit_status(status);
+
+    // It may have answered right before exiting.
+    if (execution.m_on_server && server.m_stdout != -1) {
+        read_server_output(connection, execution);
+    }
+    close_server(server);
+    if (!execution.m_on_server) {
+        std::cout << "Server exited (status " << status << ").\n";
+        return;
+    }
+
+    execution.m_on_server = false;
+    execution.m_pid = -1;
+    if (!execution.m_cancelled && !execution.m_restarted) {
+        std::cout << "Server exited (status " << status << ") during a task, restarting it.\n";
+        execution.m_restarted = true;
+        run_on_server(connection, execution);
+    } else {
+        // Exiting isn't an answer, even with a zero status.
+        finish_execution(connection, execution, status == 0 ? -1 : status);
+    }
+}
+
+// Read what the server printed. Passes lines through to our output, and
+// finishes the server's part of the execution when it says it's done.
+static void read_server_output(Connection &connection, Execution &execution) {
+    Server &server = execution.m_server;
+
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(server.m_stdout, buffer, sizeof(buffer))) > 0) {
+        server.m_output.append(buffer, length);
+    }
+    if (length == 0) {
+        // It can't answer anymore. We'll hear when it's gone.
+        close(server.m_stdout);
+        server.m_stdout = -1;
+        kill(-server.m_pid, SIGKILL);
+    }
+
+    for (std::string::size_type newline = server.m_output.find('\n');
+            newline != std::string::npos; newline = server.m_output.find('\n')) {
+
+        std::string line = server.m_output.substr(0, newline);
+        server.m_output.erase(0, newline + 1);
+
+        if (line.compare(0, 5, "done ") != 0 || !execution.m_on_server) {
+            std::cout << line << "\n";
+            continue;
+        }
+
+        // The server's CPU time isn't split into user and system time, and
+        // its peak memory is over its whole life.
+        execution.m_usage.set_user_seconds(
+                std::max(0.0, get_process_cpu_seconds(server.m_pid) - execution.m_cpu_start));
+        execution.m_usage.set_max_rss_kb(get_process_peak_memory_kb(server.m_pid));
+        execution.m_on_server = false;
+        execution.m_pid = -1;
+        execution.m_cpu_start = 0;
+        step_done(connection, execution, atoi(line.c_str() + 5));
+    }
+}
+
+// See if the execution's process has exited, and start the post command
+// or finish the execution if so.
+static void check_execution(Connection &connection, Execution &execution) {
+    check_server(connection, execution);
+
+    // The server answers on its output instead.
+    int status;
+    struct rusage rusage;
+    if (execution.m_pid == -1 || execution.m_on_server ||
+            wait4(execution.m_pid, &status, WNOHANG, &rusage) <= 0) {
+
+        return;
+    }
+
+    add_usage(execution.m_usage, rusage);
+    step_done(connection, execution, get_exit_status(status));
+}
+
+// Tell the controller that the execution is still going.
+static void send_heartbeat(Connection &connection, Execution &execution) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - execution.m_start;
+
+    Drp::Response response;
+    response.set_request_type(Drp::HEARTBEAT);
+    Drp::HeartbeatResponse *heartbeat_response = response.mutable_heartbeat_response();
+    heartbeat_response->set_elapsed(elapsed.count());
+    heartbeat_response->set_cpu_seconds(
+            get_process_cpu_seconds(execution.m_pid) - execution.m_cpu_start);
+    fill_load_report(*response.mutable_load_report());
+    if (send_message(connection.m_fd, response, connection.m_buffer) == -1) {
+        perror("send_message");
+    }
+
+    execution.m_next_heartbeat = now +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(execution.m_request.heartbeat_interval()));
+}
+
+// Stop the execution's processes. Its EXECUTE response is sent once they're gone.
+static void handle_cancel(Execution &execution, Drp::CancelResponse &response) {
+    if (execution.m_pid == -1) {
+        response.set_cancelled(false);
+        return;
+    }
+
+    std::cout << "Cancelling execution.\n";
+    kill(-execution.m_pid, SIGKILL);
+    execution.m_cancelled = true;
+    response.set_cancelled(true);
+}
+
+// Built-in CPU benchmark: escape-time iterations over the rows of an image,
+// like a Mandelbrot render, shared among all cores for a fixed amount of
+// time. Returns the seconds it would take to render the whole image.
+static double run_benchmark() {
+    static const int SIZE = 384;
+    static const int MAX_ITERATIONS = 256;
+    static const std::chrono::milliseconds DURATION(2000);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point end = start + DURATION;
+    std::atomic<int64_t> next_row(0);
+    std::atomic<int64_t> total(0);
+
+    auto work = [&]() {
+        int64_t count = 0;
+        while (std::chrono::steady_clock::now() < end) {
+            int y = next_row++ % SIZE;
+            for (int x = 0; x < SIZE; x++) {
+                double cr = x*3.0/SIZE - 2.0;
+                double ci = y*3.0/SIZE - 1.5;
+                double zr = 0, zi = 0;
+                int i;
+                for (i = 0; i < MAX_ITERATIONS && zr*zr + zi*zi < 4; i++) {
+                    double t = zr*zr - zi*zi + cr;
+                    zi = 2*zr*zi + ci;
+                    zr = t;
+                }
+                count += i;
+            }
+        }
+        // So the compiler can't skip the work.
+        total += count;
+    };
+
+    int thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++) {
+        threads.push_back(std::thread(work));
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Benchmark did " << next_row << " rows (" << total << " iterations).\n";
+
+    return elapsed.count()*SIZE/next_row;
+}
+
+static void handle_calibrate(Connection &connection, const Drp::CalibrateRequest &request,
+        Drp::CalibrateResponse &response) {
+
+    if (request.has_execute_request()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        response.set_status(run_executable(request.execute_request(), connection));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        response.set_seconds(elapsed.count());
+    } else {
+        if (connection.m_benchmark_seconds == 0) {
+            connection.m_benchmark_seconds = run_benchmark();
+        }
+        response.set_status(0);
+        response.set_seconds(connection.m_benchmark_seconds);
+    }
+}
+
+// Handle a request. Returns whether the response should be sent now. The
+// response to an EXECUTE request is sent when the executable is done.
+static bool handle_request(Connection &connection, Execution &execution,
+        const Drp::Request &request, Drp::Response &response) {
+
+    // std::cout << "Received message " << request.request_type() << "\n";
+    response.set_request_type(request.request_type());
+
+    switch (request.request_type()) {
+        case Drp::WELCOME:
+            handle_welcome(request.welcome_request(),
+                    *response.mutable_welcome_response());
+            break;
+
+        case Drp::COPY_IN:
+            handle_copy_in(request.copy_in_request(),
+                    *response.mutable_copy_in_response());
+            break;
+
+        case Drp::EXECUTE:
+            start_execution(connection, execution, request.execute_request());
+            return false;
+
+        case Drp::COPY_OUT:
+            handle_copy_out(request.copy_out_request(),
+                    *response.mutable_copy_out_response());
+            break;
+
+        case Drp::CALIBRATE:
+            handle_calibrate(connection, request.calibrate_request(),
+                    *response.mutable_calibrate_response());
+            break;
+
+        case Drp::STATUS:
+            // Nothing, the load report is always attached.
+            break;
+
+        case Drp::CANCEL:
+            handle_cancel(execution, *response.mutable_cancel_response());
+            break;
+
+        case Drp::REMOVE:
+            handle_remove(request.remove_request());
+            break;
+
+        default:
+            std::cerr << "Unhandled message type " << request.request_type() << "\n";
+            break;
+    }
+
+    return true;
+}
+
+// Take requests from the connection until it's closed. Sets whether any
+// request came. Returns whether the connection ended well.
+static bool serve_connection(Connection &connection, Execution &execution, int signal_fd,
+        bool &used) {
+
+    used = false;
+
     // Keep taking work to do.
     for (;;) {
-        Drp::Request request;
-        Drp::Response response;
+        // Wake up for requests, for exiting children, for closed outputs,
+        // and for the next heartbeat.
+        std::vector<struct pollfd> pollfds;
+        pollfds.push_back(pollfd { connection.m_fd, POLLIN, 0 });
+        pollfds.push_back(pollfd { signal_fd, POLLIN, 0 });
+        int inotify_index = -1;
+        if (execution.m_inotify_fd != -1) {
+            inotify_index = pollfds.size();
+            pollfds.push_back(pollfd { execution.m_inotify_fd, POLLIN, 0 });
+        }
+        int server_index = -1;
+        if (execution.m_server.m_stdout != -1) {
+            server_index = pollfds.size();
+            pollfds.push_back(pollfd { execution.m_server.m_stdout, POLLIN, 0 });
+        }
+        int timeout_ms = -1;
+        if (execution.m_pid != -1 && execution.m_request.heartbeat_interval() > 0) {
+            timeout_ms = std::max<int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        execution.m_next_heartbeat - std::chrono::steady_clock::now()).count());
+        }
 
-        int result = receive_message(sockfd, request);
+        int result = poll(pollfds.data(), pollfds.size(), timeout_ms);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return false;
+        }
+
+        if (pollfds[1].revents != 0) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) > 0) {
+                // Nothing.
+            }
+            check_execution(connection, execution);
+        }
+
+        if (inotify_index != -1 && pollfds[inotify_index].revents != 0 &&
+                execution.m_inotify_fd != -1) {
+
+            if (!send_closed_outputs(connection, execution.m_inotify_fd, execution.m_outputs)) {
+                perror("read");
+                close(execution.m_inotify_fd);
+                execution.m_inotify_fd = -1;
+            }
+        }
+
+        if (server_index != -1 && pollfds[server_index].revents != 0 &&
+                execution.m_server.m_stdout != -1) {
+
+            read_server_output(connection, execution);
+        }
+
+        if (execution.m_pid != -1 && execution.m_request.heartbeat_interval() > 0 &&
+                std::chrono::steady_clock::now() >= execution.m_next_heartbeat) {
+
+            send_heartbeat(connection, execution);
+        }
+
+        if (pollfds[0].revents == 0) {
+            continue;
+        }
+
+        // Free the previous request and response.
+        connection.m_arena.reset();
+        Drp::Request &request = connection.m_arena.create<Drp::Request>();
+        Drp::Response &response = connection.m_arena.create<Drp::Response>();
+
+        result = receive_message(connection.m_fd, request, connection.m_buffer);
         if (result == -1) {
             if (errno == ECONNRESET) {
                 // Graceful shutdown.
                 std::cout << "Remote side closed connection.\n";
-                return 0;
-            } else {
-                perror("receive_message");
-                return -1;
+                return true;
             }
+            perror("receive_message");
+            return false;
+        }
+        used = true;
+
+        // The running executable will send its own response, and a second
+        // one would confuse the controller, so give up on it.
+        if (request.request_type() == Drp::EXECUTE && execution.m_pid != -1) {
+            std::cerr << "Asked to execute while already executing.\n";
+            return false;
         }
 
-        // std::cout << "Received message " << request.request_type() << "\n";
-        response.set_request_type(request.request_type());
+        if (handle_request(connection, execution, request, response)) {
+            fill_load_report(*response.mutable_load_report());
+
+            result = send_message(connection.m_fd, response, connection.m_buffer);
+            if (result == -1) {
+                perror("send_message");
+                return false;
+            }
+        }
+    }
+}
 
-        switch (request.request_type()) {
-            case Drp::WELCOME:
-                handle_welcome(request.welcome_request(),
-                        *response.mutable_welcome_response());
-                break;
+// Stop the execution, since no one is waiting for it anymore. Keeps an idle
+// server running if asked to.
+static void abandon_execution(Execution &execution, bool keep_server) {
+    if (execution.m_on_server || !keep_server) {
+        stop_server(execution.m_server);
+    }
+    if (execution.m_pid != -1 && !execution.m_on_server) {
+        kill(-execution.m_pid, SIGKILL);
+        waitpid(execution.m_pid, nullptr, 0);
+    }
+    execution.m_pid = -1;
+    execution.m_on_server = false;
 
-            case Drp::COPY_IN:
-                handle_copy_in(request.copy_in_request(),
-                        *response.mutable_copy_in_response());
-                break;
+    if (execution.m_inotify_fd != -1) {
+        close(execution.m_inotify_fd);
+        execution.m_inotify_fd = -1;
+    }
+}
 
-            case Drp::EXECUTE:
-                handle_execute(request.execute_request(),
-                        *response.mutable_execute_response());
-                break;
+// Wait a random part of the delay before connecting again, and double the
+// delay for next time.
+static void wait_to_reconnect(double &delay, std::mt19937 &random) {
+    std::uniform_real_distribution<double> jitter(0.5, 1.0);
+    std::chrono::milliseconds wait(static_cast<int64_t>(delay*jitter(random)*1000));
 
-            case Drp::COPY_OUT:
-                handle_copy_out(request.copy_out_request(),
-                        *response.mutable_copy_out_response());
-                break;
+    std::cout << "Reconnecting in " << wait.count() << " ms.\n";
+    std::this_thread::sleep_for(wait);
+    delay = std::min(delay*2, MAX_RECONNECT_DELAY_S);
+}
 
-            default:
-                std::cerr << "Unhandled message type " << request.request_type() << "\n";
-                break;
+// Run one slot: connect and do what the controller asks until it's done
+// with us, then connect again if we're a daemon. Returns program exit code.
+static int run_slot(Parameters &parameters, int slot) {
+    // Keep to our share of the machine.
+    std::vector<int> cpus = get_allowed_cpus();
+    if (parameters.m_pin) {
+        std::vector<NumaNode> nodes = get_numa_nodes();
+        if (nodes.empty()) {
+            std::cerr << "Can't find the CPUs of this machine to pin to.\n";
+            return -1;
+        }
+        Placement placement = place_slot(nodes, slot, parameters.m_slots);
+        if (!pin_to_placement(placement)) {
+            return -1;
         }
+        cpus = placement.m_cpus;
+        std::cout << "Slot " << slot << " pinned to CPUs " << format_cpu_list(cpus);
+        if (placement.m_nodes.size() == 1) {
+            std::cout << " on node " << placement.m_nodes[0];
+        }
+        std::cout << ".\n";
+    }
 
-        result = send_message(sockfd, response);
-        if (result == -1) {
-            perror("send_message");
+    Connection connection(-1, format_cpu_list(cpus));
+
+    // With several slots, each works in its own directory, so that tasks
+    // with the same remote pathnames don't overwrite each other's files.
+    if (parameters.m_slots > 1) {
+        char *directory = getcwd(nullptr, 0);
+        if (directory == nullptr) {
+            perror("getcwd");
+            return -1;
+        }
+        connection.m_executable_directory = directory;
+        free(directory);
+
+        std::string slot_directory = "slot-" + std::to_string(slot);
+        if ((mkdir(slot_directory.c_str(), 0755) == -1 && errno != EEXIST) ||
+                chdir(slot_directory.c_str()) == -1) {
+
+            perror(slot_directory.c_str());
             return -1;
         }
     }
 
-    return 0;
+    // A server that dies shows up as its exit, not as a failed write.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Hear about exiting children on a file descriptor, so that we can wait
+    // for them and for requests at the same time.
+    sigset_t sigchld;
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld, nullptr);
+    int signal_fd = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd");
+        return -1;
+    }
+
+    // The executable we're running, if any.
+    Execution execution;
+
+    // Spread out the reconnections of many daemons.
+    std::mt19937 random(std::random_device{}());
+    double reconnect_delay = MIN_RECONNECT_DELAY_S;
+
+    bool success;
+    for (;;) {
+        // Connect to the controller or the proxy.
+        connection.m_fd = create_client_socket(parameters.m_endpoint);
+        if (connection.m_fd == -1) {
+            success = false;
+        } else {
+            bool used;
+            success = serve_connection(connection, execution, signal_fd, used);
+            close(connection.m_fd);
+            connection.m_fd = -1;
+            abandon_execution(execution, parameters.m_daemon);
+
+            // Try the next job right away.
+            if (used) {
+                reconnect_delay = MIN_RECONNECT_DELAY_S;
+                if (parameters.m_daemon) {
+                    continue;
+                }
+            }
+        }
+
+        if (!parameters.m_daemon) {
+            break;
+        }
+        wait_to_reconnect(reconnect_delay, random);
+    }
+
+    close(signal_fd);
+
+    return success ? 0 : -1;
+}
+
+int start_worker(Parameters &parameters) {
+    // Resolve endpoint.
+    bool success = parameters.m_endpoint.resolve(false, "", DEFAULT_WORKER_PORT);
+    if (!success) {
+        return -1;
+    }
+
+    if (parameters.m_slots == 1) {
+        return run_slot(parameters, 0);
+    }
+
+    // Each slot is a process with its own connection, so the controller
+    // sees a worker per slot and decides how many of them to use.
+    std::vector<pid_t> pids;
+    for (int slot = 0; slot < parameters.m_slots; slot++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            success = false;
+            break;
+        }
+        if (pid == 0) {
+            exit(run_slot(parameters, slot) == 0 ? 0 : 1);
+        }
+        pids.push_back(pid);
+    }
+
+    for (pid_t pid : pids) {
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            success = false;
+        }
+    }
+
+    return success ? 0 : -1;
 }
@@ -3,6 +3,11 @@
 
 #include "Parameters.hpp"
 
+// Seconds a daemon worker waits before reconnecting, the first time and
+// at most. The delay doubles with each failure.
+static const double MIN_RECONNECT_DELAY_S = 1;
+static const double MAX_RECONNECT_DELAY_S = 30;
+
 int start_worker(Parameters &parameters);
 
 #endif // WORKER_HPP